@@ -0,0 +1,202 @@
+#pragma once
+#include "pinned.h"
+#include <atomic>
+#include <mutex>
+
+// An append-only vector that any number of threads can push into at the same time, without locks, while other threads
+// read from it. Since the buffer is a pinned allocation, it never moves, so readers can keep pointers / references to
+// elements while writers append, and growing never has to stop the world to copy everything.
+//
+// Writers claim a slot with an atomic increment, and construct their element in it. Committing more pages is done by one
+// thread at a time, and is normally done ahead of time by whichever writer first gets close to the end of the committed
+// region, so the other writers don't have to wait for it. Elements become visible to readers in index order: size() only
+// counts an element once it and every element before it are fully constructed, and has acquire semantics, so everything
+// in [0, size()) can be read safely. Writers never wait for each other to publish: each slot has a ready flag (in a second
+// pinned allocation, grown along with the first), and whichever writer finishes the element at the current size()
+// advances it past every ready slot.
+//
+//  concurrent_pinned_vec<event> events;
+//
+//  // on any number of threads
+//  size_t index = events.push_back(e);
+//
+//  // on any other thread
+//  size_t size = events.size();
+//  for (size_t i = 0; i < size; i++)
+//    process(events[i]);
+//
+// The in-order publishing means a writer that gets descheduled between claiming a slot and filling it holds up the
+// size() seen by readers (but not the other writers) until it continues. Element constructors must not throw, because a
+// claimed slot can't be given back, and if committing more memory fails the vector can't take any more elements.
+//
+// Anything other than appending and reading (clear(), destruction) must not run concurrently with anything else.
+
+template <typename T>
+class concurrent_pinned_vec
+{
+public:
+  using value_type = T;
+  using size_type = size_t;
+  using reference = T&;
+  using const_reference = const T&;
+  using pointer = T*;
+  using const_pointer = const T*;
+  using iterator = T*;
+  using const_iterator = const T*;
+
+  explicit concurrent_pinned_vec(size_t max_size = PINNED_MAXSIZE_NORMAL)
+  {
+    if (pinned_alloc(0, max_size, &allocation) != 0)
+      throw std::bad_alloc();
+
+    if (pinned_alloc(0, max_size / sizeof(T), &ready_flags) != 0)
+    {
+      pinned_free(&allocation);
+      throw std::bad_alloc();
+    }
+  }
+
+  concurrent_pinned_vec(const concurrent_pinned_vec&) = delete;
+  concurrent_pinned_vec& operator=(const concurrent_pinned_vec&) = delete;
+
+  ~concurrent_pinned_vec()
+  {
+    clear();
+    pinned_free(&ready_flags);
+    pinned_free(&allocation);
+  }
+
+  // Returns the index of the new element. It is visible to other threads once size() is bigger than that index.
+  template<class... Args>
+  size_t emplace_back(Args&&... args)
+  {
+    static_assert(std::is_nothrow_constructible<T, Args&&...>::value, "concurrent_pinned_vec elements must be constructed without throwing");
+
+    size_t index = claimed.fetch_add(1, std::memory_order_relaxed);
+    ensure_committed(index);
+
+    new (&data()[index]) T(std::forward<Args>(args) ...);
+    ready()[index].store(1, std::memory_order_seq_cst);
+
+    // Publish our element, and any after it that were finished while we weren't at the front yet. This has to be seq_cst
+    // along with the store above, otherwise the writer of the element before us could check our flag before we set it
+    // while we look at published before they advance it, and both of us would leave our elements unpublished.
+    size_t current = published.load(std::memory_order_seq_cst);
+    while (current < committed.load(std::memory_order_acquire) && ready()[current].load(std::memory_order_seq_cst))
+    {
+      if (published.compare_exchange_weak(current, current + 1, std::memory_order_seq_cst))
+        current++;
+    }
+
+    return index;
+  }
+
+  size_t push_back(const T& value) { return emplace_back(value); }
+  size_t push_back(T&& value) { return emplace_back(std::move(value)); }
+
+  reference operator[](size_type pos) { return data()[pos]; }
+  const_reference operator[](size_type pos) const { return data()[pos]; }
+
+  pointer data() noexcept { return reinterpret_cast<T*>(allocation.data); }
+  const_pointer data() const noexcept { return reinterpret_cast<const T*>(allocation.data); }
+
+  // These are only consistent with each other while nobody is appending, otherwise use begin() + a size() you read once
+  iterator begin() noexcept { return data(); }
+  const_iterator begin() const noexcept { return data(); }
+  iterator end() noexcept { return data() + size(); }
+  const_iterator end() const noexcept { return data() + size(); }
+
+  // Number of elements that are ready to read
+  size_type size() const noexcept { return published.load(std::memory_order_acquire); }
+  bool empty() const noexcept { return size() == 0; }
+  size_type capacity() const noexcept { return committed.load(std::memory_order_acquire); }
+  size_type max_size() const noexcept { return allocation.max_size / sizeof(T); }
+
+  void reserve(size_type new_cap)
+  {
+    std::lock_guard<std::mutex> lock(commit_mutex);
+    if (new_cap > committed.load(std::memory_order_relaxed))
+      commit(new_cap);
+  }
+
+  // Not thread safe
+  void clear() noexcept
+  {
+    size_t count = published.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < count; i++)
+      data()[i].~T();
+
+    memset(ready_flags.data, 0, std::min(count, ready_flags.size));
+
+    claimed.store(0, std::memory_order_relaxed);
+    published.store(0, std::memory_order_relaxed);
+  }
+
+private:
+  void ensure_committed(size_t index)
+  {
+    if (index >= max_size())
+    {
+      throw std::bad_alloc();
+    }
+
+    size_t committed_count = committed.load(std::memory_order_acquire);
+
+    if (index >= committed_count)
+    {
+      // We've run right up against the end, so we have to wait
+      std::lock_guard<std::mutex> lock(commit_mutex);
+      committed_count = committed.load(std::memory_order_relaxed);
+      if (index >= committed_count)
+        commit(grow_target(std::max(committed_count, index + 1)));
+    }
+    else if (index >= committed_count - committed_count / 4)
+    {
+      // Getting close, so commit some more before anyone gets there. If another thread is already doing it, let it.
+      std::unique_lock<std::mutex> lock(commit_mutex, std::try_to_lock);
+      if (lock.owns_lock())
+      {
+        size_t current = committed.load(std::memory_order_relaxed);
+        if (current == committed_count)
+          commit(grow_target(current));
+      }
+    }
+  }
+
+  size_t grow_target(size_t current) const
+  {
+    // At least 64KiB at a time, so small element types don't hit the mutex all the time
+    size_t minimum = std::max<size_t>(1, (64 * 1024) / sizeof(T));
+    return std::min(std::max(current * 2, minimum), max_size());
+  }
+
+  // Must hold commit_mutex
+  void commit(size_t new_cap)
+  {
+    if (new_cap > max_size() || pinned_realloc(new_cap * sizeof(T), &allocation) != 0)
+    {
+      throw std::bad_alloc();
+    }
+
+    size_t new_committed = allocation.size / sizeof(T);
+    if (pinned_realloc(new_committed, &ready_flags) != 0)
+    {
+      throw std::bad_alloc();
+    }
+
+    committed.store(new_committed, std::memory_order_release);
+  }
+
+  // Zero-initialised memory is a valid std::atomic<uint8_t> holding 0 on every platform we care about
+  std::atomic<uint8_t>* ready() noexcept { return reinterpret_cast<std::atomic<uint8_t>*>(ready_flags.data); }
+
+  // Both only resized with commit_mutex held
+  pinned_alloc_info allocation = {};
+  pinned_alloc_info ready_flags = {};
+  std::mutex commit_mutex;
+
+  // Separate cache lines, so writers claiming slots don't slow down readers polling size()
+  alignas(64) std::atomic<size_t> claimed{0};
+  alignas(64) std::atomic<size_t> published{0};
+  alignas(64) std::atomic<size_t> committed{0};
+};
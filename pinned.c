@@ -1,5 +1,12 @@
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE // memfd_create, MAP_FIXED_NOREPLACE
+#endif
+
 #include "pinned.h"
 #include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
 
 _Static_assert(sizeof(void*) >= 8, "This ain't gonna work unless you have way more address space than you need");
 
@@ -11,6 +18,413 @@ static size_t align_size(size_t val, size_t block_size)
   return block_count * block_size;
 }
 
+#ifdef _MSC_VER
+# include <intrin.h>
+# define TOUCH_FOR_WRITE(p) _InterlockedOr8((volatile char*)(p), 0)
+#else
+# define TOUCH_FOR_WRITE(p) __atomic_fetch_or((char*)(p), 0, __ATOMIC_RELAXED)
+#endif
+
+// Write fault every page in [start, end) by atomically or-ing zero into its first byte, which leaves the contents alone
+// even if another thread is writing to the same page
+static void touch_pages(char* start, char* end, size_t page_size)
+{
+  for (char* page = start; page < end; page += page_size)
+    TOUCH_FOR_WRITE(page);
+}
+
+int pinned_alloc(size_t size, size_t max_size, pinned_alloc_info* allocation)
+{
+  pinned_placement placement = { PINNED_NUMA_FIRST_TOUCH, 0 };
+  return pinned_alloc_placed(size, max_size, placement, allocation);
+}
+
+// Backing files start with this header. We reserve 64KiB for it, so the data that comes after it starts at an offset that
+// can be mapped on every platform, whatever the page size / allocation granularity is.
+#define BACKING_HEADER_SIZE 65536
+#define BACKING_MAGIC 0x31434556444e4950ULL // "PINDVEC1"
+
+typedef struct backing_header
+{
+  uint64_t magic;
+  uint64_t length;
+  uint64_t base; // where the owner mapped it, so other processes can try to map it at the same address
+  uint64_t max_size;
+
+  // Only used by the owner's process, see pinned_snapshot()
+  uint64_t live_snapshots;
+  uint64_t copy_on_write_size; // how much of the owner's mapping is private while PINNED_FLAG_COPY_ON_WRITE is set
+} backing_header;
+
+// The length is how the owner of a shared allocation tells readers in other processes how much data there is, so it needs
+// release / acquire ordering. MSVC's volatile already has those semantics.
+#ifdef _MSC_VER
+# define STORE_RELEASE(p, v) (*(volatile uint64_t*)(p) = (v))
+# define LOAD_ACQUIRE(p) (*(const volatile uint64_t*)(p))
+#else
+# define STORE_RELEASE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+# define LOAD_ACQUIRE(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#endif
+
+void pinned_set_length(size_t length, pinned_alloc_info* allocation)
+{
+  if (allocation->backing && !(allocation->flags & PINNED_FLAG_READ_ONLY))
+    STORE_RELEASE(&((backing_header*)allocation->backing)->length, (uint64_t)length);
+}
+
+size_t pinned_get_length(const pinned_alloc_info* allocation)
+{
+  if (!allocation->backing)
+    return 0;
+  return (size_t)LOAD_ACQUIRE(&((const backing_header*)allocation->backing)->length);
+}
+
+// The platform specific parts of pinned_realloc() and pinned_relocate(), which wrap them to keep the stats
+static int realloc_pages(size_t new_size, pinned_alloc_info* allocation);
+static int relocate_pages(size_t new_max_size, pinned_alloc_info* allocation);
+
+// How many bytes the OS reports as accessed for each mapping, for PINNED_RESIDENCY_ACCESSED
+typedef struct accessed_range
+{
+  uintptr_t start;
+  uintptr_t end;
+  size_t accessed_bytes;
+} accessed_range;
+
+// The platform specific parts of pinned_get_residency(). Ranges come back sorted by address, and the caller frees them.
+static int read_accessed_ranges(accessed_range** ranges, size_t* count);
+static int count_resident(void* data, size_t size, size_t* resident_bytes);
+
+#ifndef PINNED_NO_STATS
+
+static uint64_t now_ns(void);
+
+#ifdef _MSC_VER
+# include <intrin.h>
+# define THREAD_LOCAL __declspec(thread)
+# define ADD_RELAXED(p, v) _InterlockedExchangeAdd64((volatile long long*)(p), (long long)(v))
+# define LOAD_RELAXED(p) (*(const volatile int64_t*)(p))
+# define STORE_RELAXED(p, v) _InterlockedExchange64((volatile long long*)(p), (long long)(v))
+#else
+# define THREAD_LOCAL _Thread_local
+# define ADD_RELAXED(p, v) __atomic_fetch_add((p), (v), __ATOMIC_RELAXED)
+# define LOAD_RELAXED(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+# define STORE_RELAXED(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#endif
+
+// Every thread adds to one of a handful of shards (picked the first time it touches the stats), each on its own cache
+// lines, so threads allocating at the same time don't all fight over the same counters. Reading the stats adds up all
+// the shards. The gauges are signed, as a thread can free an allocation that was counted in another thread's shard.
+#define STATS_SHARD_COUNT 16
+
+typedef struct stats_shard
+{
+  _Alignas(64) int64_t reserved_bytes;
+  int64_t committed_bytes;
+  int64_t live_allocations;
+  int64_t mmap_calls;
+  int64_t mprotect_calls;
+  int64_t munmap_calls;
+  int64_t grow_count;
+  int64_t shrink_count;
+  int64_t realloc_latency[PINNED_STATS_LATENCY_BUCKETS];
+} stats_shard;
+
+static stats_shard stats_shards[STATS_SHARD_COUNT];
+static THREAD_LOCAL stats_shard* thread_shard;
+static int64_t next_shard;
+
+static stats_shard* get_shard(void)
+{
+  if (!thread_shard)
+    thread_shard = &stats_shards[ADD_RELAXED(&next_shard, 1) % STATS_SHARD_COUNT];
+  return thread_shard;
+}
+
+# define STATS_ADD(field, value) ADD_RELAXED(&get_shard()->field, (int64_t)(value))
+# define STATS_NOW() now_ns()
+
+static void stats_track_allocation(int64_t reserved, int64_t committed, int64_t count)
+{
+  stats_shard* shard = get_shard();
+  ADD_RELAXED(&shard->reserved_bytes, reserved);
+  ADD_RELAXED(&shard->committed_bytes, committed);
+  ADD_RELAXED(&shard->live_allocations, count);
+}
+
+static void stats_track_resize(size_t old_size, size_t new_size)
+{
+  if (new_size != old_size)
+    STATS_ADD(committed_bytes, (int64_t)new_size - (int64_t)old_size);
+}
+
+// Every live allocation has an entry in the registry, so pinned_dump_residency() can find them all. The registry is a
+// pinned allocation itself, so entries never move, and pinned_realloc() can update an entry's size without the lock.
+// Adding and removing entries takes the lock, which is nothing next to the mmap() / munmap() that comes with them.
+#define REGISTRY_MAX_ENTRIES (1 << 20)
+
+typedef struct registry_entry
+{
+  void* data; // NULL for free entries
+  size_t max_size;
+  size_t size;
+  size_t next_free;
+} registry_entry;
+
+static void registry_lock(void);
+static void registry_unlock(void);
+
+static pinned_alloc_info registry;
+static size_t registry_used; // entries that have ever been used, free or not
+static size_t registry_free_head = PINNED_NO_REGISTRY_SLOT;
+
+static registry_entry* registry_entries(void)
+{
+  return (registry_entry*)registry.data;
+}
+
+static size_t registry_add(const pinned_alloc_info* allocation)
+{
+  size_t slot = PINNED_NO_REGISTRY_SLOT;
+  registry_lock();
+
+  if (!registry.data && pinned_alloc(0, REGISTRY_MAX_ENTRIES * sizeof(registry_entry), &registry) != 0)
+    registry.data = NULL;
+
+  if (registry.data)
+  {
+    if (registry_free_head != PINNED_NO_REGISTRY_SLOT)
+    {
+      slot = registry_free_head;
+      registry_free_head = registry_entries()[slot].next_free;
+    }
+    else if (registry_used < REGISTRY_MAX_ENTRIES)
+    {
+      size_t needed = (registry_used + 1) * sizeof(registry_entry);
+      size_t grown = needed * 2 < registry.max_size ? needed * 2 : registry.max_size;
+      if (needed <= registry.size || realloc_pages(grown, &registry) == 0)
+        slot = registry_used++;
+    }
+  }
+
+  // If the registry is full the allocation just doesn't show up in dumps
+  if (slot != PINNED_NO_REGISTRY_SLOT)
+  {
+    registry_entry* entry = &registry_entries()[slot];
+    entry->data = allocation->data;
+    entry->max_size = allocation->max_size;
+    STORE_RELAXED(&entry->size, allocation->size);
+  }
+
+  registry_unlock();
+  return slot;
+}
+
+static void registry_remove(size_t slot)
+{
+  registry_lock();
+  registry_entry* entry = &registry_entries()[slot];
+  entry->data = NULL;
+  entry->next_free = registry_free_head;
+  registry_free_head = slot;
+  registry_unlock();
+}
+
+// A copy of all the live entries, which the caller frees. NULL if out of memory. Live entries don't use next_free, so
+// the copies have the slot they came from there instead.
+static registry_entry* registry_snapshot(size_t* count)
+{
+  registry_lock();
+
+  registry_entry* copy = (registry_entry*)malloc((registry_used ? registry_used : 1) * sizeof(registry_entry));
+  *count = 0;
+  for (size_t i = 0; copy && i < registry_used; i++)
+  {
+    registry_entry* entry = &registry_entries()[i];
+    if (entry->data)
+    {
+      copy[*count] = *entry;
+      copy[*count].size = (size_t)LOAD_RELAXED(&entry->size);
+      copy[*count].next_free = i;
+      (*count)++;
+    }
+  }
+
+  registry_unlock();
+  return copy;
+}
+
+static void track_allocation(pinned_alloc_info* allocation)
+{
+  // The registry's own allocation isn't tracked, it would have to add itself to itself
+  if (allocation == &registry)
+  {
+    allocation->registry_slot = PINNED_NO_REGISTRY_SLOT;
+    return;
+  }
+
+  stats_track_allocation((int64_t)allocation->max_size, (int64_t)allocation->size, 1);
+  allocation->registry_slot = registry_add(allocation);
+}
+
+static void untrack_allocation(pinned_alloc_info* allocation)
+{
+  if (allocation == &registry)
+    return;
+
+  stats_track_allocation(-(int64_t)allocation->max_size, -(int64_t)allocation->size, -1);
+  if (allocation->registry_slot != PINNED_NO_REGISTRY_SLOT)
+    registry_remove(allocation->registry_slot);
+}
+
+static void track_resize(pinned_alloc_info* allocation, size_t old_size)
+{
+  stats_track_resize(old_size, allocation->size);
+  if (allocation->registry_slot != PINNED_NO_REGISTRY_SLOT && allocation->size != old_size)
+    STORE_RELAXED(&registry_entries()[allocation->registry_slot].size, allocation->size);
+}
+
+static void track_relocation(pinned_alloc_info* allocation, size_t old_max_size)
+{
+  stats_track_allocation((int64_t)allocation->max_size - (int64_t)old_max_size, 0, 0);
+  if (allocation->registry_slot != PINNED_NO_REGISTRY_SLOT)
+  {
+    // Dumps read these under the lock
+    registry_lock();
+    registry_entry* entry = &registry_entries()[allocation->registry_slot];
+    entry->data = allocation->data;
+    entry->max_size = allocation->max_size;
+    registry_unlock();
+  }
+}
+
+void pinned_get_stats(pinned_stats* stats)
+{
+  memset(stats, 0, sizeof(pinned_stats));
+
+  int64_t reserved = 0, committed = 0, live = 0;
+  for (int i = 0; i < STATS_SHARD_COUNT; i++)
+  {
+    stats_shard* shard = &stats_shards[i];
+    reserved += LOAD_RELAXED(&shard->reserved_bytes);
+    committed += LOAD_RELAXED(&shard->committed_bytes);
+    live += LOAD_RELAXED(&shard->live_allocations);
+    stats->mmap_calls += (unsigned long long)LOAD_RELAXED(&shard->mmap_calls);
+    stats->mprotect_calls += (unsigned long long)LOAD_RELAXED(&shard->mprotect_calls);
+    stats->munmap_calls += (unsigned long long)LOAD_RELAXED(&shard->munmap_calls);
+    stats->grow_count += (unsigned long long)LOAD_RELAXED(&shard->grow_count);
+    stats->shrink_count += (unsigned long long)LOAD_RELAXED(&shard->shrink_count);
+    for (int bucket = 0; bucket < PINNED_STATS_LATENCY_BUCKETS; bucket++)
+      stats->realloc_latency[bucket] += (unsigned long long)LOAD_RELAXED(&shard->realloc_latency[bucket]);
+  }
+
+  // Shards are read one at a time, so a sum can be briefly off while other threads allocate and free
+  stats->reserved_bytes = reserved > 0 ? (size_t)reserved : 0;
+  stats->committed_bytes = committed > 0 ? (size_t)committed : 0;
+  stats->live_allocations = live > 0 ? (size_t)live : 0;
+}
+
+void pinned_reset_stats(void)
+{
+  for (int i = 0; i < STATS_SHARD_COUNT; i++)
+  {
+    stats_shard* shard = &stats_shards[i];
+    STORE_RELAXED(&shard->mmap_calls, 0);
+    STORE_RELAXED(&shard->mprotect_calls, 0);
+    STORE_RELAXED(&shard->munmap_calls, 0);
+    STORE_RELAXED(&shard->grow_count, 0);
+    STORE_RELAXED(&shard->shrink_count, 0);
+    for (int bucket = 0; bucket < PINNED_STATS_LATENCY_BUCKETS; bucket++)
+      STORE_RELAXED(&shard->realloc_latency[bucket], 0);
+  }
+}
+
+#else // PINNED_NO_STATS
+
+# define STATS_ADD(field, value) ((void)0)
+# define STATS_NOW() ((uint64_t)0)
+
+static void stats_track_allocation(int64_t reserved, int64_t committed, int64_t count)
+{
+  (void)reserved; (void)committed; (void)count;
+}
+
+static void stats_track_resize(size_t old_size, size_t new_size)
+{
+  (void)old_size; (void)new_size;
+}
+
+static void track_allocation(pinned_alloc_info* allocation)
+{
+  allocation->registry_slot = PINNED_NO_REGISTRY_SLOT;
+}
+
+static void untrack_allocation(pinned_alloc_info* allocation)
+{
+  (void)allocation;
+}
+
+static void track_resize(pinned_alloc_info* allocation, size_t old_size)
+{
+  (void)allocation; (void)old_size;
+}
+
+static void track_relocation(pinned_alloc_info* allocation, size_t old_max_size)
+{
+  (void)allocation; (void)old_max_size;
+}
+
+void pinned_get_stats(pinned_stats* stats)
+{
+  memset(stats, 0, sizeof(pinned_stats));
+}
+
+void pinned_reset_stats(void)
+{
+}
+
+#endif // PINNED_NO_STATS
+
+int pinned_realloc(size_t new_size, pinned_alloc_info* allocation)
+{
+  uint64_t start = STATS_NOW();
+  size_t old_size = allocation->size;
+
+  int err = realloc_pages(new_size, allocation);
+
+  track_resize(allocation, old_size);
+  if (allocation->size > old_size)
+    STATS_ADD(grow_count, 1);
+  else if (allocation->size < old_size)
+    STATS_ADD(shrink_count, 1);
+
+#ifndef PINNED_NO_STATS
+  // Bucket i counts calls that took [2^(i-1), 2^i) nanoseconds
+  uint64_t elapsed = now_ns() - start;
+  int bucket = 0;
+  while (elapsed != 0 && bucket < PINNED_STATS_LATENCY_BUCKETS - 1)
+  {
+    elapsed >>= 1;
+    bucket++;
+  }
+  STATS_ADD(realloc_latency[bucket], 1);
+#else
+  (void)start;
+#endif
+
+  return err;
+}
+
+int pinned_relocate(size_t new_max_size, pinned_alloc_info* allocation)
+{
+  size_t old_max_size = allocation->max_size;
+
+  int err = relocate_pages(new_max_size, allocation);
+  if (err == 0)
+    track_relocation(allocation, old_max_size);
+  return err;
+}
+
 #ifdef _WIN32
 
 #ifndef WIN32_LEAN_AND_MEAN
@@ -20,13 +434,58 @@ static size_t align_size(size_t val, size_t block_size)
 
 #pragma comment(lib, "mincore")
 
-int pinned_alloc(size_t size, size_t max_size, pinned_alloc_info* allocation)
+#ifndef PINNED_NO_STATS
+static uint64_t now_ns(void)
+{
+  static LARGE_INTEGER frequency;
+  if (frequency.QuadPart == 0)
+    QueryPerformanceFrequency(&frequency);
+
+  LARGE_INTEGER counter;
+  QueryPerformanceCounter(&counter);
+  return (uint64_t)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+}
+#endif
+
+static BOOL commit_pages(void* address, size_t size, pinned_placement placement)
+{
+  STATS_ADD(mprotect_calls, 1);
+
+  // Windows has no interleave policy, and "local" is what it does by default anyway, so only binding does anything here.
+  // A bind mask with several nodes binds to the lowest one, as VirtualAlloc2 only takes a single preferred node.
+  if (placement.policy == PINNED_NUMA_BIND && placement.nodes != 0)
+  {
+    ULONG highest_node = 0;
+    if (GetNumaHighestNodeNumber(&highest_node) && highest_node > 0)
+    {
+      ULONG node = 0;
+      while (!(placement.nodes & PINNED_NUMA_NODE(node)))
+        node++;
+
+      if (node <= highest_node)
+      {
+        MEM_EXTENDED_PARAMETER parameter = {0};
+        parameter.Type = MemExtendedParameterNumaNode;
+        parameter.ULong = node;
+        return VirtualAlloc2(NULL, address, size, MEM_COMMIT, PAGE_READWRITE, &parameter, 1) != NULL;
+      }
+    }
+  }
+
+  return VirtualAlloc2(NULL, address, size, MEM_COMMIT, PAGE_READWRITE, NULL, 0) != NULL;
+}
+
+int pinned_alloc_placed(size_t size, size_t max_size, pinned_placement placement, pinned_alloc_info* allocation)
 {
   int err = 0;
   void* base_pointer = NULL;
 
+  if (placement.policy < PINNED_NUMA_FIRST_TOUCH || placement.policy > PINNED_NUMA_INTERLEAVE)
+    return ERROR_INVALID_PARAMETER;
+
   // Reserve (without committing) a huge region in virtual memory. Not committing means we don't use any physical ram, just address space
   base_pointer = VirtualAlloc2(NULL, NULL, max_size, MEM_RESERVE, PAGE_READWRITE, NULL, 0);
+  STATS_ADD(mmap_calls, 1);
   if (!base_pointer)
   {
     err = (int)GetLastError();
@@ -36,12 +495,17 @@ int pinned_alloc(size_t size, size_t max_size, pinned_alloc_info* allocation)
   allocation->data = base_pointer;
   allocation->size = 0;
   allocation->max_size = max_size;
+  allocation->placement = placement;
+  allocation->backing = NULL;
+  allocation->fd = -1;
+  allocation->flags = 0;
 
   // commit only the region we need immediately
-  err = pinned_realloc(size, allocation);
+  err = realloc_pages(size, allocation);
   if (err != 0)
     goto on_error;
 
+  track_allocation(allocation);
   goto ok;
 
 on_error:
@@ -49,13 +513,14 @@ on_error:
   {
     BOOL success = VirtualFree(base_pointer, 0, MEM_RELEASE);
     assert(success);
+    STATS_ADD(munmap_calls, 1);
   }
 
 ok:
   return err;
 }
 
-int pinned_realloc(size_t new_size, pinned_alloc_info* allocation)
+static int realloc_pages(size_t new_size, pinned_alloc_info* allocation)
 {
   if (new_size > allocation->max_size)
     return ERROR_INVALID_PARAMETER;
@@ -68,13 +533,14 @@ int pinned_realloc(size_t new_size, pinned_alloc_info* allocation)
   if (aligned_size < allocation->size)
   {
     // Decommit pages when shrinking
+    STATS_ADD(mprotect_calls, 1);
     if (!VirtualFree(((char*)allocation->data) + aligned_size, allocation->size - aligned_size, MEM_DECOMMIT))
       return (int) GetLastError();
   }
   else if (aligned_size > 0)
   {
     // Commit pages when growing
-    if (!VirtualAlloc2(NULL, ((char*)allocation->data) + allocation->size, aligned_size, MEM_COMMIT, PAGE_READWRITE, NULL, 0))
+    if (!commit_pages(((char*)allocation->data) + allocation->size, aligned_size, allocation->placement))
       return (int) GetLastError();
   }
 
@@ -83,82 +549,2402 @@ int pinned_realloc(size_t new_size, pinned_alloc_info* allocation)
   return 0;
 }
 
-void pinned_free(pinned_alloc_info* allocation)
+static int relocate_pages(size_t new_max_size, pinned_alloc_info* allocation)
 {
+  if (new_max_size < allocation->size || allocation->backing || (allocation->flags & PINNED_FLAG_READ_ONLY))
+    return ERROR_INVALID_PARAMETER;
+
+  char* new_data = (char*)VirtualAlloc2(NULL, NULL, new_max_size, MEM_RESERVE, PAGE_READWRITE, NULL, 0);
+  STATS_ADD(mmap_calls, 1);
+  if (!new_data)
+    return (int)GetLastError();
+
+  // There's no way to move pages from one reservation to another on windows, so this is a copy
+  if (allocation->size > 0 && !commit_pages(new_data, allocation->size, allocation->placement))
+  {
+    int err = (int)GetLastError();
+    VirtualFree(new_data, 0, MEM_RELEASE);
+    STATS_ADD(munmap_calls, 1);
+    return err;
+  }
+  memcpy(new_data, allocation->data, allocation->size);
+
   BOOL success = VirtualFree(allocation->data, 0, MEM_RELEASE);
   assert(success);
+  STATS_ADD(munmap_calls, 1);
+
+  allocation->data = new_data;
+  allocation->max_size = new_max_size;
+  return 0;
 }
 
-#else // _WIN32
+void pinned_free(pinned_alloc_info* allocation)
+{
+  untrack_allocation(allocation);
 
-#include <sys/mman.h>
-#include <errno.h>
-#include <unistd.h>
+  BOOL success = VirtualFree(allocation->data, 0, MEM_RELEASE);
+  assert(success);
+  STATS_ADD(munmap_calls, 1);
+}
 
-int pinned_alloc(size_t size, size_t max_size, pinned_alloc_info* allocation)
+size_t pinned_page_size(void)
 {
-  int err = 0;
-  void* base_pointer = NULL;
-
-  // Reserve (without committing, PROT_NONE means no access) a huge region in virtual memory. Not committing means we don't use any physical ram, just address space
-  base_pointer = mmap(NULL, max_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, 0, 0);
-  if (!base_pointer)
-  {
-    err = errno;
-    goto on_error;
-  }
+  SYSTEM_INFO system_info;
+  GetSystemInfo(&system_info);
+  return system_info.dwAllocationGranularity;
+}
 
-  allocation->data = base_pointer;
-  allocation->size = 0;
-  allocation->max_size = max_size;
+int pinned_discard(size_t offset, size_t length, pinned_alloc_info* allocation)
+{
+  if (offset + length > allocation->size)
+    return ERROR_INVALID_PARAMETER;
 
-  // commit only the region we need immediately
-  err = pinned_realloc(size, allocation);
-  if (err != 0)
-    goto on_error;
+  SYSTEM_INFO system_info;
+  GetSystemInfo(&system_info);
 
-  goto ok;
+  size_t start = align_size(offset, system_info.dwPageSize);
+  size_t end = ((offset + length) / system_info.dwPageSize) * system_info.dwPageSize;
+  if (end <= start)
+    return 0;
 
-on_error:
-  if (base_pointer)
-  {
-    int result = munmap(base_pointer, max_size);
-    assert(result == 0);
-  }
+  // Decommitting and committing again gets us fresh zeroed pages (MEM_RESET would leave the contents undefined)
+  char* address = ((char*)allocation->data) + start;
+  STATS_ADD(mprotect_calls, 1);
+  if (!VirtualFree(address, end - start, MEM_DECOMMIT))
+    return (int)GetLastError();
+  if (!commit_pages(address, end - start, allocation->placement))
+    return (int)GetLastError();
 
-ok:
-  return err;
+  return 0;
 }
 
-int pinned_realloc(size_t new_size, pinned_alloc_info* allocation)
+int pinned_prefault(size_t offset, size_t length, pinned_alloc_info* allocation)
 {
-  if (new_size > allocation->max_size)
-    return EINVAL;
+  if (offset + length > allocation->size || (allocation->flags & PINNED_FLAG_READ_ONLY))
+    return ERROR_INVALID_PARAMETER;
 
-  size_t aligned_size = align_size(new_size, getpagesize());
+  size_t page_size = pinned_page_size();
+  size_t start = (offset / page_size) * page_size;
+  touch_pages(((char*)allocation->data) + start, ((char*)allocation->data) + offset + length, page_size);
+  return 0;
+}
 
-  if (aligned_size < allocation->size)
+int pinned_move_pages(pinned_alloc_info* destination, size_t destination_offset, pinned_alloc_info* source, size_t source_offset, size_t length)
+{
+  size_t page_size = pinned_page_size();
+  if (destination == source || (destination_offset | source_offset | length) % page_size != 0 ||
+      destination_offset + length > destination->size || source_offset + length > source->size ||
+      destination->backing || source->backing || ((destination->flags | source->flags) & PINNED_FLAG_READ_ONLY))
   {
-    // Decommit pages when shrinking
-    if (mprotect(((char*)allocation->data) + aligned_size, allocation->size - aligned_size, PROT_NONE) != 0)
-      return errno;
+    return ERROR_INVALID_PARAMETER;
   }
-  else if (aligned_size > 0)
+
+  // There's no way to move pages from one reservation to another on windows, so this is just a copy
+  memcpy(((char*)destination->data) + destination_offset, ((char*)source->data) + source_offset, length);
+  return pinned_discard(source_offset, length, source);
+}
+
+// The pages overlapping [offset, offset + length), or 0 if the range isn't one pinned_commit_range() takes
+static size_t sparse_range(size_t offset, size_t length, const pinned_alloc_info* allocation, char** start)
+{
+  SYSTEM_INFO system_info;
+  GetSystemInfo(&system_info);
+
+  if (offset < allocation->size || offset + length > allocation->max_size || allocation->backing ||
+      (allocation->flags & PINNED_FLAG_READ_ONLY))
   {
-    // Commit pages when growing
-    if (mprotect(allocation->data, aligned_size, PROT_READ | PROT_WRITE) != 0)
-      return errno;
+    return 0;
   }
 
-  allocation->size = aligned_size;
+  size_t first = (offset / system_info.dwPageSize) * system_info.dwPageSize;
+  *start = ((char*)allocation->data) + first;
+  return align_size(offset + length, system_info.dwPageSize) - first;
+}
+
+int pinned_commit_range(size_t offset, size_t length, pinned_alloc_info* allocation)
+{
+  char* start;
+  size_t aligned_length = sparse_range(offset, length, allocation, &start);
+  if (aligned_length == 0)
+    return length == 0 ? 0 : ERROR_INVALID_PARAMETER;
 
+  if (!commit_pages(start, aligned_length, allocation->placement))
+    return (int)GetLastError();
   return 0;
 }
 
-void pinned_free(pinned_alloc_info* allocation)
+int pinned_decommit_range(size_t offset, size_t length, pinned_alloc_info* allocation)
 {
-  int result = munmap(allocation->data, allocation->max_size);
-  assert(result == 0);
+  char* start;
+  size_t aligned_length = sparse_range(offset, length, allocation, &start);
+  if (aligned_length == 0)
+    return length == 0 ? 0 : ERROR_INVALID_PARAMETER;
+
+  STATS_ADD(mprotect_calls, 1);
+  if (!VirtualFree(start, aligned_length, MEM_DECOMMIT))
+    return (int)GetLastError();
+  return 0;
+}
+
+int pinned_alloc_file(const char* path, size_t size, size_t max_size, pinned_alloc_info* allocation)
+{
+  (void)path; (void)size; (void)max_size; (void)allocation;
+  return ERROR_NOT_SUPPORTED;
 }
 
-#endif // _WIN32
\ No newline at end of file
+int pinned_snapshot(pinned_alloc_info* allocation, pinned_alloc_info* snapshot)
+{
+  (void)allocation; (void)snapshot;
+  return ERROR_NOT_SUPPORTED;
+}
+
+int pinned_map_file(int fd, size_t length, pinned_alloc_info* allocation)
+{
+  (void)fd; (void)length; (void)allocation;
+  return ERROR_NOT_SUPPORTED;
+}
+
+int pinned_cold_enable(size_t block_size, pinned_alloc_info* allocation)
+{
+  (void)block_size; (void)allocation;
+  return ERROR_NOT_SUPPORTED;
+}
+
+int pinned_cold_disable(pinned_alloc_info* allocation)
+{
+  (void)allocation;
+  return ERROR_NOT_SUPPORTED;
+}
+
+int pinned_cold_sweep(pinned_alloc_info* allocation, size_t* compressed_blocks)
+{
+  (void)allocation;
+  if (compressed_blocks)
+    *compressed_blocks = 0;
+  return ERROR_NOT_SUPPORTED;
+}
+
+int pinned_cold_wake(size_t offset, size_t length, pinned_alloc_info* allocation)
+{
+  (void)offset; (void)length; (void)allocation;
+  return ERROR_NOT_SUPPORTED;
+}
+
+int pinned_cold_get_stats(const pinned_alloc_info* allocation, pinned_cold_stats* stats)
+{
+  (void)allocation;
+  memset(stats, 0, sizeof(pinned_cold_stats));
+  return ERROR_NOT_SUPPORTED;
+}
+
+int pinned_dirty_enable(pinned_alloc_info* allocation)
+{
+  (void)allocation;
+  return ERROR_NOT_SUPPORTED;
+}
+
+int pinned_dirty_disable(pinned_alloc_info* allocation)
+{
+  (void)allocation;
+  return ERROR_NOT_SUPPORTED;
+}
+
+int pinned_dirty_checkpoint(pinned_alloc_info* allocation, pinned_dirty_callback callback, void* user)
+{
+  (void)allocation; (void)callback; (void)user;
+  return ERROR_NOT_SUPPORTED;
+}
+
+int pinned_dirty_mark(size_t offset, size_t length, pinned_alloc_info* allocation)
+{
+  (void)offset; (void)length; (void)allocation;
+  return ERROR_NOT_SUPPORTED;
+}
+
+int pinned_alloc_shared(size_t size, size_t max_size, pinned_alloc_info* allocation)
+{
+  (void)size; (void)max_size; (void)allocation;
+  return ERROR_NOT_SUPPORTED;
+}
+
+int pinned_attach(int fd, pinned_alloc_info* allocation)
+{
+  (void)fd; (void)allocation;
+  return ERROR_NOT_SUPPORTED;
+}
+
+int pinned_refresh(pinned_alloc_info* allocation)
+{
+  (void)allocation;
+  return ERROR_NOT_SUPPORTED;
+}
+
+int pinned_ring_alloc(size_t capacity, size_t max_capacity, pinned_ring_info* ring)
+{
+  (void)capacity; (void)max_capacity; (void)ring;
+  return ERROR_NOT_SUPPORTED;
+}
+
+int pinned_ring_resize(size_t new_capacity, unsigned long long begin, unsigned long long end, pinned_ring_info* ring)
+{
+  (void)new_capacity; (void)begin; (void)end; (void)ring;
+  return ERROR_NOT_SUPPORTED;
+}
+
+void pinned_ring_free(pinned_ring_info* ring)
+{
+  (void)ring;
+}
+
+int pinned_sync(size_t length, pinned_alloc_info* allocation)
+{
+  (void)length; (void)allocation;
+  return ERROR_NOT_SUPPORTED;
+}
+
+#include <psapi.h>
+
+#ifndef PINNED_NO_STATS
+static SRWLOCK registry_srwlock = SRWLOCK_INIT;
+
+static void registry_lock(void)
+{
+  AcquireSRWLockExclusive(&registry_srwlock);
+}
+
+static void registry_unlock(void)
+{
+  ReleaseSRWLockExclusive(&registry_srwlock);
+}
+#endif
+
+static int read_accessed_ranges(accessed_range** ranges, size_t* count)
+{
+  // The working set has no referenced bits we can read and clear without being a debugger
+  *ranges = NULL;
+  *count = 0;
+  return ERROR_NOT_SUPPORTED;
+}
+
+int pinned_clear_accessed(void)
+{
+  return ERROR_NOT_SUPPORTED;
+}
+
+static int count_resident(void* data, size_t size, size_t* resident_bytes)
+{
+  PSAPI_WORKING_SET_EX_INFORMATION pages[1024];
+  size_t page_size = pinned_page_size();
+  size_t page_count = size / page_size;
+
+  *resident_bytes = 0;
+  for (size_t first = 0; first < page_count; first += 1024)
+  {
+    size_t batch = page_count - first < 1024 ? page_count - first : 1024;
+    for (size_t i = 0; i < batch; i++)
+      pages[i].VirtualAddress = ((char*)data) + (first + i) * page_size;
+
+    if (!QueryWorkingSetEx(GetCurrentProcess(), pages, (DWORD)(batch * sizeof(pages[0]))))
+      return (int) GetLastError();
+
+    for (size_t i = 0; i < batch; i++)
+    {
+      if (pages[i].VirtualAttributes.Valid)
+        *resident_bytes += page_size;
+    }
+  }
+
+  return 0;
+}
+
+#else // _WIN32
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <linux/mempolicy.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sched.h>
+
+#ifndef PINNED_NO_STATS
+static uint64_t now_ns(void)
+{
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (uint64_t)time.tv_sec * 1000000000ULL + (uint64_t)time.tv_nsec;
+}
+#endif
+
+// The memory mapping calls, counted for pinned_get_stats()
+static void* counted_mmap(void* address, size_t length, int prot, int flags, int fd, off_t offset)
+{
+  STATS_ADD(mmap_calls, 1);
+  return mmap(address, length, prot, flags, fd, offset);
+}
+
+static int counted_munmap(void* address, size_t length)
+{
+  STATS_ADD(munmap_calls, 1);
+  return munmap(address, length);
+}
+
+static int counted_mprotect(void* address, size_t length, int prot)
+{
+  STATS_ADD(mprotect_calls, 1);
+  return mprotect(address, length, prot);
+}
+
+// Big enough for 1024 nodes, because the kernel refuses to write a mask smaller than the number of possible nodes
+#define NUMA_MASK_WORDS (1024 / (sizeof(unsigned long) * 8))
+
+// Bitmask of the NUMA nodes we are allowed to use, all clear if we can't tell (no NUMA support in the kernel, or a
+// seccomp filter that blocks the syscall), and how many there are. Read once, by whichever thread needs it first.
+// We call the syscalls directly instead of going through libnuma, so there's no extra dependency.
+static unsigned long allowed_numa_nodes[NUMA_MASK_WORDS];
+static size_t allowed_numa_node_count;
+static pthread_once_t allowed_numa_nodes_once = PTHREAD_ONCE_INIT;
+
+static void read_allowed_numa_nodes(void)
+{
+  if (syscall(SYS_get_mempolicy, NULL, allowed_numa_nodes, sizeof(allowed_numa_nodes) * 8 + 1, NULL, MPOL_F_MEMS_ALLOWED) != 0)
+    memset(allowed_numa_nodes, 0, sizeof(allowed_numa_nodes));
+
+  for (size_t i = 0; i < NUMA_MASK_WORDS; i++)
+    allowed_numa_node_count += (size_t)__builtin_popcountl(allowed_numa_nodes[i]);
+}
+
+// apply_placement() without reading the allowed nodes first, for the fault handler, which can't call pthread_once().
+// Whatever can end up here from the handler has read them already.
+static int place_pages(void* address, size_t size, pinned_placement placement)
+{
+  if (placement.policy == PINNED_NUMA_FIRST_TOUCH || size == 0)
+    return 0;
+
+  // Nothing to place on a single node machine
+  if (allowed_numa_node_count <= 1)
+    return 0;
+
+  // placement.nodes can only pick from the first 64 nodes, but 0 means all of them, however many there are
+  unsigned long nodes[NUMA_MASK_WORDS];
+  int any_nodes = 0;
+  for (size_t i = 0; i < NUMA_MASK_WORDS; i++)
+  {
+    size_t shift = i * sizeof(unsigned long) * 8;
+    nodes[i] = allowed_numa_nodes[i];
+    if (placement.nodes)
+      nodes[i] &= shift < 64 ? (unsigned long)(placement.nodes >> shift) : 0;
+    any_nodes |= nodes[i] != 0;
+  }
+
+  int mode = MPOL_LOCAL;
+  if (placement.policy == PINNED_NUMA_BIND)
+    mode = MPOL_BIND;
+  else if (placement.policy == PINNED_NUMA_INTERLEAVE)
+    mode = MPOL_INTERLEAVE;
+
+  if (mode != MPOL_LOCAL && !any_nodes)
+    return EINVAL;
+
+  if (syscall(SYS_mbind, address, size, mode, mode == MPOL_LOCAL ? NULL : nodes, sizeof(nodes) * 8 + 1, 0) != 0)
+    return errno;
+
+  return 0;
+}
+
+static int apply_placement(void* address, size_t size, pinned_placement placement)
+{
+  if (placement.policy != PINNED_NUMA_FIRST_TOUCH && size != 0)
+    pthread_once(&allowed_numa_nodes_once, read_allowed_numa_nodes);
+  return place_pages(address, size, placement);
+}
+
+int pinned_alloc_placed(size_t size, size_t max_size, pinned_placement placement, pinned_alloc_info* allocation)
+{
+  int err = 0;
+  void* base_pointer = NULL;
+
+  if (placement.policy < PINNED_NUMA_FIRST_TOUCH || placement.policy > PINNED_NUMA_INTERLEAVE)
+    return EINVAL;
+
+  // Reserve (without committing, PROT_NONE means no access) a huge region in virtual memory. Not committing means we don't use any physical ram, just address space
+  base_pointer = counted_mmap(NULL, max_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, 0, 0);
+  if (base_pointer == MAP_FAILED)
+  {
+    base_pointer = NULL;
+    err = errno;
+    goto on_error;
+  }
+
+  allocation->data = base_pointer;
+  allocation->size = 0;
+  allocation->max_size = max_size;
+  allocation->placement = placement;
+  allocation->backing = NULL;
+  allocation->fd = -1;
+  allocation->flags = 0;
+
+  // commit only the region we need immediately
+  err = realloc_pages(size, allocation);
+  if (err != 0)
+    goto on_error;
+
+  track_allocation(allocation);
+  goto ok;
+
+on_error:
+  if (base_pointer)
+  {
+    int result = counted_munmap(base_pointer, max_size);
+    assert(result == 0);
+  }
+
+ok:
+  return err;
+}
+
+// Sets up an allocation over an already open backing file (or memfd), which it takes ownership of
+static int alloc_backed(int fd, size_t size, size_t max_size, pinned_alloc_info* allocation)
+{
+  int err = 0;
+  void* base_pointer = NULL;
+  backing_header* header = NULL;
+  struct stat file_stat;
+
+  if (fstat(fd, &file_stat) != 0)
+  {
+    err = errno;
+    goto on_error;
+  }
+
+  if (file_stat.st_size == 0)
+  {
+    if (ftruncate(fd, BACKING_HEADER_SIZE) != 0)
+    {
+      err = errno;
+      goto on_error;
+    }
+  }
+  else if (file_stat.st_size < BACKING_HEADER_SIZE)
+  {
+    err = EINVAL;
+    goto on_error;
+  }
+
+  header = (backing_header*)counted_mmap(NULL, getpagesize(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (header == MAP_FAILED)
+  {
+    header = NULL;
+    err = errno;
+    goto on_error;
+  }
+
+  if (file_stat.st_size == 0)
+  {
+    header->magic = BACKING_MAGIC;
+    header->length = 0;
+  }
+  else if (header->magic != BACKING_MAGIC || header->length > max_size)
+  {
+    err = EINVAL;
+    goto on_error;
+  }
+
+  if (size < header->length)
+    size = (size_t)header->length;
+
+  base_pointer = counted_mmap(NULL, max_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, 0, 0);
+  if (base_pointer == MAP_FAILED)
+  {
+    base_pointer = NULL;
+    err = errno;
+    goto on_error;
+  }
+
+  header->base = (uint64_t)(uintptr_t)base_pointer;
+  header->max_size = max_size;
+  header->live_snapshots = 0;
+  header->copy_on_write_size = 0;
+
+  allocation->data = base_pointer;
+  allocation->size = 0;
+  allocation->max_size = max_size;
+  allocation->placement.policy = PINNED_NUMA_FIRST_TOUCH;
+  allocation->placement.nodes = 0;
+  allocation->backing = header;
+  allocation->fd = fd;
+  allocation->flags = 0;
+
+  // This also truncates away anything past the size we want, so the file size always matches the committed size
+  err = realloc_pages(size, allocation);
+  if (err != 0)
+    goto on_error;
+
+  track_allocation(allocation);
+  goto ok;
+
+on_error:
+  if (base_pointer)
+  {
+    int result = counted_munmap(base_pointer, max_size);
+    assert(result == 0);
+  }
+  if (header)
+  {
+    int result = counted_munmap(header, getpagesize());
+    assert(result == 0);
+  }
+  close(fd);
+
+ok:
+  return err;
+}
+
+int pinned_alloc_file(const char* path, size_t size, size_t max_size, pinned_alloc_info* allocation)
+{
+  int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0)
+    return errno;
+
+  // Two processes growing and shrinking the same file under each other would not end well
+  if (flock(fd, LOCK_EX | LOCK_NB) != 0)
+  {
+    int err = errno;
+    close(fd);
+    return err;
+  }
+
+  return alloc_backed(fd, size, max_size, allocation);
+}
+
+int pinned_alloc_shared(size_t size, size_t max_size, pinned_alloc_info* allocation)
+{
+  int fd = memfd_create("pinned_alloc", MFD_CLOEXEC);
+  if (fd < 0)
+    return errno;
+
+  return alloc_backed(fd, size, max_size, allocation);
+}
+
+// Map (or unmap) the part of the file between the current size and new_size over the reservation
+static int remap_reader(size_t new_size, pinned_alloc_info* allocation)
+{
+  char* data = (char*)allocation->data;
+
+  if (new_size < allocation->size)
+  {
+    if (counted_mmap(data + new_size, allocation->size - new_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED)
+      return errno;
+  }
+  else if (new_size > allocation->size)
+  {
+    if (counted_mmap(data + allocation->size, new_size - allocation->size, PROT_READ, MAP_SHARED | MAP_FIXED,
+             allocation->fd, BACKING_HEADER_SIZE + allocation->size) == MAP_FAILED)
+      return errno;
+  }
+
+  allocation->size = new_size;
+  return 0;
+}
+
+static int refresh_pages(pinned_alloc_info* allocation);
+
+int pinned_attach(int fd, pinned_alloc_info* allocation)
+{
+  int err = 0;
+  void* base_pointer = NULL;
+  backing_header* header = NULL;
+
+  header = (backing_header*)counted_mmap(NULL, getpagesize(), PROT_READ, MAP_SHARED, fd, 0);
+  if (header == MAP_FAILED)
+  {
+    header = NULL;
+    err = errno;
+    goto on_error;
+  }
+
+  if (header->magic != BACKING_MAGIC)
+  {
+    err = EINVAL;
+    goto on_error;
+  }
+
+  // Try to get the same address as the owner, so pointers into the buffer mean the same thing in both processes.
+  // If something else is already there, just take whatever we get.
+  base_pointer = counted_mmap((void*)(uintptr_t)header->base, header->max_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+  if (base_pointer == MAP_FAILED)
+    base_pointer = counted_mmap(NULL, header->max_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base_pointer == MAP_FAILED)
+  {
+    base_pointer = NULL;
+    err = errno;
+    goto on_error;
+  }
+
+  allocation->data = base_pointer;
+  allocation->size = 0;
+  allocation->max_size = header->max_size;
+  allocation->placement.policy = PINNED_NUMA_FIRST_TOUCH;
+  allocation->placement.nodes = 0;
+  allocation->backing = header;
+  allocation->fd = fd;
+  allocation->flags = PINNED_FLAG_READ_ONLY;
+
+  err = refresh_pages(allocation);
+  if (err != 0)
+    goto on_error;
+
+  track_allocation(allocation);
+  goto ok;
+
+on_error:
+  if (base_pointer)
+  {
+    int result = counted_munmap(base_pointer, header->max_size);
+    assert(result == 0);
+  }
+  if (header)
+  {
+    int result = counted_munmap(header, getpagesize());
+    assert(result == 0);
+  }
+  close(fd);
+
+ok:
+  return err;
+}
+
+static int refresh_pages(pinned_alloc_info* allocation)
+{
+  if (!(allocation->flags & PINNED_FLAG_READ_ONLY) || (allocation->flags & PINNED_FLAG_SNAPSHOT))
+    return EINVAL;
+
+  struct stat file_stat;
+  if (fstat(allocation->fd, &file_stat) != 0)
+    return errno;
+
+  size_t new_size = file_stat.st_size > BACKING_HEADER_SIZE ? (size_t)file_stat.st_size - BACKING_HEADER_SIZE : 0;
+  if (new_size > allocation->max_size)
+    new_size = allocation->max_size;
+
+  return remap_reader(new_size, allocation);
+}
+
+int pinned_refresh(pinned_alloc_info* allocation)
+{
+  size_t old_size = allocation->size;
+  int err = refresh_pages(allocation);
+  track_resize(allocation, old_size);
+  return err;
+}
+
+// Copy a run of the owner's pages into the file
+static int write_back(pinned_alloc_info* allocation, size_t offset, size_t length)
+{
+  size_t done = 0;
+  while (done < length)
+  {
+    ssize_t written = pwrite(allocation->fd, ((char*)allocation->data) + offset + done, length - done,
+                             (off_t)(BACKING_HEADER_SIZE + offset + done));
+    if (written < 0)
+      return errno;
+    done += (size_t)written;
+  }
+  return 0;
+}
+
+// Write whatever the owner has changed since it went copy-on-write back into the file, and map the file over it shared
+// again. The pages it changed are the ones that are now private (anonymous) copies, which /proc/self/pagemap tells apart
+// from pages still mapped from the file, so this costs a pwrite() per run of changed pages, not a copy of everything.
+static int end_copy_on_write(pinned_alloc_info* allocation)
+{
+  int err = 0;
+  backing_header* header = (backing_header*)allocation->backing;
+  if (__atomic_load_n(&header->live_snapshots, __ATOMIC_ACQUIRE) != 0)
+    return EBUSY;
+
+  size_t page_size = (size_t)getpagesize();
+  size_t size = (size_t)header->copy_on_write_size < allocation->size ? (size_t)header->copy_on_write_size : allocation->size;
+  size_t page_count = size / page_size;
+  size_t first_page = (uintptr_t)allocation->data / page_size;
+
+  uint64_t entries[512];
+  size_t run_start = 0;
+  size_t run_length = 0;
+
+  // Without pagemap, we have to write everything back
+  int pagemap = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+
+  for (size_t page = 0; page < page_count; page++)
+  {
+    if (page % 512 == 0 && pagemap >= 0)
+    {
+      size_t batch = page_count - page < 512 ? page_count - page : 512;
+      off_t offset = (off_t)((first_page + page) * sizeof(uint64_t));
+      if (pread(pagemap, entries, batch * sizeof(uint64_t), offset) != (ssize_t)(batch * sizeof(uint64_t)))
+      {
+        close(pagemap);
+        pagemap = -1;
+      }
+    }
+
+    // Present (bit 63) and not a page of the file (bit 61), or swapped out (bit 62), which only private pages can be
+    uint64_t entry = pagemap >= 0 ? entries[page % 512] : 1ULL << 63;
+    int changed = (((entry >> 63) & 1) && !((entry >> 61) & 1)) || ((entry >> 62) & 1);
+
+    if (changed)
+    {
+      if (run_length == 0)
+        run_start = page;
+      run_length++;
+    }
+    else if (run_length > 0)
+    {
+      err = write_back(allocation, run_start * page_size, run_length * page_size);
+      if (err != 0)
+        goto done;
+      run_length = 0;
+    }
+  }
+
+  if (run_length > 0)
+  {
+    err = write_back(allocation, run_start * page_size, run_length * page_size);
+    if (err != 0)
+      goto done;
+  }
+
+  if (size > 0 && counted_mmap(allocation->data, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, allocation->fd, BACKING_HEADER_SIZE) == MAP_FAILED)
+  {
+    err = errno;
+    goto done;
+  }
+
+  header->copy_on_write_size = 0;
+  allocation->flags &= ~PINNED_FLAG_COPY_ON_WRITE;
+
+done:
+  if (pagemap >= 0)
+    close(pagemap);
+  return err;
+}
+
+int pinned_snapshot(pinned_alloc_info* allocation, pinned_alloc_info* snapshot)
+{
+  int err = 0;
+  size_t page_size = (size_t)getpagesize();
+  size_t size = allocation->size;
+  size_t reserved = size > page_size ? size : page_size;
+  void* view = NULL;
+  backing_header* header = NULL;
+
+  if (!allocation->backing || (allocation->flags & PINNED_FLAG_READ_ONLY))
+    return EINVAL;
+
+  // The owner's changes since the last snapshot have to be in the file before it can be snapshotted again
+  if (allocation->flags & PINNED_FLAG_COPY_ON_WRITE)
+  {
+    err = end_copy_on_write(allocation);
+    if (err != 0)
+      return err;
+  }
+
+  header = (backing_header*)counted_mmap(NULL, page_size, PROT_READ | PROT_WRITE, MAP_SHARED, allocation->fd, 0);
+  if (header == MAP_FAILED)
+  {
+    header = NULL;
+    err = errno;
+    goto on_error;
+  }
+
+  // The snapshot is a read-only shared mapping of the file, which doesn't change from here on...
+  view = counted_mmap(NULL, reserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (view == MAP_FAILED)
+  {
+    view = NULL;
+    err = errno;
+    goto on_error;
+  }
+
+  if (size > 0 && counted_mmap(view, size, PROT_READ, MAP_SHARED | MAP_FIXED, allocation->fd, BACKING_HEADER_SIZE) == MAP_FAILED)
+  {
+    err = errno;
+    goto on_error;
+  }
+
+  // ...because the owner now gets a private mapping of it, at the same address, where the first write to each page
+  // copies it instead of writing to the file
+  if (size > 0 && counted_mmap(allocation->data, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, allocation->fd, BACKING_HEADER_SIZE) == MAP_FAILED)
+  {
+    err = errno;
+    goto on_error;
+  }
+
+  __atomic_fetch_add(&header->live_snapshots, 1, __ATOMIC_RELAXED);
+  header->copy_on_write_size = size;
+  allocation->flags |= PINNED_FLAG_COPY_ON_WRITE;
+
+  snapshot->data = view;
+  snapshot->size = size;
+  snapshot->max_size = reserved;
+  snapshot->placement.policy = PINNED_NUMA_FIRST_TOUCH;
+  snapshot->placement.nodes = 0;
+  snapshot->backing = header;
+  snapshot->fd = -1; // the mappings keep the file alive
+  snapshot->flags = PINNED_FLAG_READ_ONLY | PINNED_FLAG_SNAPSHOT;
+
+  track_allocation(snapshot);
+  goto ok;
+
+on_error:
+  if (view)
+  {
+    int result = counted_munmap(view, reserved);
+    assert(result == 0);
+  }
+  if (header)
+  {
+    int result = counted_munmap(header, page_size);
+    assert(result == 0);
+  }
+
+ok:
+  return err;
+}
+
+static int realloc_backed(size_t aligned_size, pinned_alloc_info* allocation)
+{
+  char* data = (char*)allocation->data;
+
+  if (aligned_size < allocation->size)
+  {
+    // Truncating the file would pull pages out from under the snapshots
+    if (allocation->flags & PINNED_FLAG_COPY_ON_WRITE)
+    {
+      int err = end_copy_on_write(allocation);
+      if (err != 0)
+        return err;
+    }
+    // Put the reservation back over the pages we don't need any more, and then cut them off the end of the file
+    if (counted_mmap(data + aligned_size, allocation->size - aligned_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED)
+      return errno;
+
+    allocation->size = aligned_size;
+    if (pinned_get_length(allocation) > aligned_size)
+      pinned_set_length(aligned_size, allocation);
+
+    if (ftruncate(allocation->fd, BACKING_HEADER_SIZE + aligned_size) != 0)
+      return errno;
+  }
+  else if (aligned_size > allocation->size)
+  {
+    // Grow the file first, and then map the new part of it over the reservation, right after the part we already have
+    if (ftruncate(allocation->fd, BACKING_HEADER_SIZE + aligned_size) != 0)
+      return errno;
+
+    if (counted_mmap(data + allocation->size, aligned_size - allocation->size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+             allocation->fd, BACKING_HEADER_SIZE + allocation->size) == MAP_FAILED)
+      return errno;
+
+    allocation->size = aligned_size;
+  }
+  else if (allocation->size == 0)
+  {
+    // Make sure a freshly opened file doesn't keep whatever was past the committed size last time
+    if (ftruncate(allocation->fd, BACKING_HEADER_SIZE) != 0)
+      return errno;
+  }
+
+  return 0;
+}
+
+int pinned_sync(size_t length, pinned_alloc_info* allocation)
+{
+  if (!allocation->backing || (allocation->flags & PINNED_FLAG_READ_ONLY))
+    return EINVAL;
+
+  // Changes since a snapshot aren't in the file yet
+  if (allocation->flags & PINNED_FLAG_COPY_ON_WRITE)
+  {
+    int err = end_copy_on_write(allocation);
+    if (err != 0)
+      return err;
+  }
+
+  // Data first, then the header, so the recorded length never covers data that didn't make it to disk
+  if (allocation->size > 0 && msync(allocation->data, allocation->size, MS_SYNC) != 0)
+    return errno;
+
+  pinned_set_length(length, allocation);
+  if (msync(allocation->backing, getpagesize(), MS_SYNC) != 0)
+    return errno;
+
+  return 0;
+}
+
+size_t pinned_page_size(void)
+{
+  return (size_t)getpagesize();
+}
+
+// The cold page tier and dirty page tracking both protect pages on purpose, and have a SIGSEGV handler deal with the
+// faults, which is installed the first time either is turned on. Operations that would pull pages out from under them
+// fail with EBUSY.
+#define TRAPPED_FLAGS (PINNED_FLAG_COLD | PINNED_FLAG_DIRTY)
+
+static pthread_once_t fault_handler_once = PTHREAD_ONCE_INIT;
+static void install_fault_handler(void);
+
+// Map fresh anonymous memory over a range of an allocation, throwing away whatever was mapped there
+static int replace_pages(char* start, size_t length, int prot, pinned_placement placement)
+{
+  if (counted_mmap(start, length, prot, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED)
+    return errno;
+  return prot == PROT_NONE ? 0 : apply_placement(start, length, placement);
+}
+
+int pinned_discard(size_t offset, size_t length, pinned_alloc_info* allocation)
+{
+  if (offset + length > allocation->size || (allocation->flags & PINNED_FLAG_READ_ONLY))
+    return EINVAL;
+  if (allocation->flags & TRAPPED_FLAGS)
+    return EBUSY;
+
+  size_t page_size = (size_t)getpagesize();
+  size_t start = align_size(offset, page_size);
+  size_t end = ((offset + length) / page_size) * page_size;
+  if (end <= start)
+    return 0;
+
+  if (allocation->backing)
+  {
+    // Punching a hole in the file would punch it in the snapshots too
+    if (allocation->flags & PINNED_FLAG_COPY_ON_WRITE)
+    {
+      int err = end_copy_on_write(allocation);
+      if (err != 0)
+        return err;
+    }
+
+    // MADV_DONTNEED would only drop our mapping of the pages, the data would stay in the file
+    if (fallocate(allocation->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, BACKING_HEADER_SIZE + start, end - start) != 0)
+      return errno;
+  }
+  else if (allocation->flags & PINNED_FLAG_FILE_PAGES)
+  {
+    return replace_pages(((char*)allocation->data) + start, end - start, PROT_READ | PROT_WRITE, allocation->placement);
+  }
+  else
+  {
+    if (madvise(((char*)allocation->data) + start, end - start, MADV_DONTNEED) != 0)
+      return errno;
+  }
+
+  return 0;
+}
+
+#ifndef MADV_POPULATE_WRITE
+# define MADV_POPULATE_WRITE 23
+#endif
+
+int pinned_prefault(size_t offset, size_t length, pinned_alloc_info* allocation)
+{
+  if (offset + length > allocation->size || (allocation->flags & PINNED_FLAG_READ_ONLY))
+    return EINVAL;
+
+  size_t page_size = (size_t)getpagesize();
+  char* start = ((char*)allocation->data) + (offset / page_size) * page_size;
+  char* end = ((char*)allocation->data) + align_size(offset + length, page_size);
+  if (end <= start)
+    return 0;
+
+  // MADV_POPULATE_WRITE fails on protected pages, touching them has the fault handler deal with them
+  if (allocation->flags & TRAPPED_FLAGS)
+  {
+    touch_pages(start, end, page_size);
+    return 0;
+  }
+
+  if (madvise(start, (size_t)(end - start), MADV_POPULATE_WRITE) == 0)
+    return 0;
+
+  // Older kernels don't know MADV_POPULATE_WRITE
+  if (errno != EINVAL)
+    return errno;
+
+  touch_pages(start, end, page_size);
+  return 0;
+}
+
+int pinned_move_pages(pinned_alloc_info* destination, size_t destination_offset, pinned_alloc_info* source, size_t source_offset, size_t length)
+{
+  size_t page_size = (size_t)getpagesize();
+  if (destination == source || (destination_offset | source_offset | length) % page_size != 0 ||
+      destination_offset + length > destination->size || source_offset + length > source->size ||
+      destination->backing || source->backing || ((destination->flags | source->flags) & PINNED_FLAG_READ_ONLY))
+  {
+    return EINVAL;
+  }
+  if ((destination->flags | source->flags) & TRAPPED_FLAGS)
+    return EBUSY;
+
+  if (length == 0)
+    return 0;
+
+  char* from = ((char*)source->data) + source_offset;
+  char* to = ((char*)destination->data) + destination_offset;
+
+  // mremap() can only move a range that is all one mapping. Pages moved in by an earlier call are a mapping of their own,
+  // so if the range takes in more than one, copy it instead (same for huge page mappings that aren't aligned enough).
+  STATS_ADD(mmap_calls, 1);
+  if (mremap(from, length, length, MREMAP_MAYMOVE | MREMAP_FIXED, to) == MAP_FAILED)
+  {
+    if (errno != EFAULT && errno != EINVAL)
+      return errno;
+
+    memcpy(to, from, length);
+    return pinned_discard(source_offset, length, source);
+  }
+
+  // The pages might have come from pinned_map_file()
+  destination->flags |= source->flags & PINNED_FLAG_FILE_PAGES;
+
+  // That leaves a hole in the source's reservation, which gets fresh zeroed pages
+  return replace_pages(from, length, PROT_READ | PROT_WRITE, source->placement);
+}
+
+int pinned_map_file(int fd, size_t length, pinned_alloc_info* allocation)
+{
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0)
+    return errno;
+
+  size_t aligned_length = align_size(length, getpagesize());
+  if (length > (size_t)file_stat.st_size || aligned_length > allocation->max_size || allocation->backing ||
+      (allocation->flags & PINNED_FLAG_READ_ONLY))
+  {
+    return EINVAL;
+  }
+  if (allocation->flags & TRAPPED_FLAGS)
+    return EBUSY;
+
+  if (length == 0)
+    return 0;
+
+  // Commit everything before the file goes over the start, so the allocation stays one committed range
+  size_t old_size = allocation->size;
+  if (aligned_length > allocation->size)
+  {
+    int err = realloc_pages(aligned_length, allocation);
+    if (err != 0)
+      return err;
+    track_resize(allocation, old_size);
+  }
+
+  if (counted_mmap(allocation->data, aligned_length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)
+    return errno;
+  allocation->flags |= PINNED_FLAG_FILE_PAGES;
+
+  // Whoever maps a file usually reads all of it, so get the kernel reading ahead
+  madvise(allocation->data, aligned_length, MADV_WILLNEED);
+  return 0;
+}
+
+// The pages overlapping [offset, offset + length), or 0 if the range isn't one pinned_commit_range() takes
+static size_t sparse_range(size_t offset, size_t length, const pinned_alloc_info* allocation, char** start)
+{
+  size_t page_size = (size_t)getpagesize();
+
+  if (offset < allocation->size || offset + length > allocation->max_size || allocation->backing ||
+      (allocation->flags & PINNED_FLAG_READ_ONLY))
+  {
+    return 0;
+  }
+
+  size_t first = (offset / page_size) * page_size;
+  *start = ((char*)allocation->data) + first;
+  return align_size(offset + length, page_size) - first;
+}
+
+int pinned_commit_range(size_t offset, size_t length, pinned_alloc_info* allocation)
+{
+  if (allocation->flags & TRAPPED_FLAGS)
+    return EBUSY;
+
+  char* start;
+  size_t aligned_length = sparse_range(offset, length, allocation, &start);
+  if (aligned_length == 0)
+    return length == 0 ? 0 : EINVAL;
+
+  if (counted_mprotect(start, aligned_length, PROT_READ | PROT_WRITE) != 0)
+    return errno;
+  return apply_placement(start, aligned_length, allocation->placement);
+}
+
+int pinned_decommit_range(size_t offset, size_t length, pinned_alloc_info* allocation)
+{
+  if (allocation->flags & TRAPPED_FLAGS)
+    return EBUSY;
+
+  char* start;
+  size_t aligned_length = sparse_range(offset, length, allocation, &start);
+  if (aligned_length == 0)
+    return length == 0 ? 0 : EINVAL;
+
+  // Same as shrinking, see realloc_pages()
+  if (allocation->flags & PINNED_FLAG_FILE_PAGES)
+    return replace_pages(start, aligned_length, PROT_NONE, allocation->placement);
+
+  if (madvise(start, aligned_length, MADV_DONTNEED) != 0)
+    return errno;
+  if (counted_mprotect(start, aligned_length, PROT_NONE) != 0)
+    return errno;
+  return 0;
+}
+
+// The cold page tier. Each managed block is in one of these states, which the fault handler and the sweep move it
+// between with compare and swap, so a block only ever has one of them working on it, and anyone else who faults on it
+// waits until it's usable again.
+enum
+{
+  COLD_HOT = 0,     // accessible
+  COLD_ARMED,       // protected, to see if it's touched before the next sweep
+  COLD_COMPRESSING, // being compressed by a sweep
+  COLD_COLD,        // compressed, with nothing committed behind it
+  COLD_WAKING,      // being unprotected or decompressed by the fault handler
+};
+
+typedef struct cold_block
+{
+  // The block's contents while it's cold. Left behind when it's woken up, for the next sweep to free, as the fault
+  // handler can't call free().
+  unsigned char* compressed;
+  uint32_t compressed_size;
+  uint32_t state;
+} cold_block;
+
+typedef struct cold_state
+{
+  char* data; // NULL for free slots
+  size_t block_size;
+  size_t block_count; // whole blocks inside the allocation, the handler only looks at those
+  pinned_placement placement;
+  pinned_alloc_info blocks;
+} cold_state;
+
+#define COLD_MAX_ALLOCATIONS 64
+#define COLD_DEFAULT_BLOCK_SIZE (64 * 1024)
+
+// Slots are only taken and given back under the lock, the fault handler just reads them
+static cold_state cold_states[COLD_MAX_ALLOCATIONS];
+static pthread_mutex_t cold_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static cold_block* cold_blocks(cold_state* state)
+{
+  return (cold_block*)state->blocks.data;
+}
+
+// The codec: runs of the same 64 bit word are stored once, everything else as is. Each run or stretch of other words
+// starts with a uint32_t token, which is the number of words it covers shifted left by one, with the low bit set for a
+// run, followed by the run's word or the words themselves. Returns 0 if the result doesn't fit in capacity.
+static size_t cold_compress(const uint64_t* words, size_t word_count, unsigned char* out, size_t capacity)
+{
+  size_t out_size = 0;
+  for (size_t i = 0; i < word_count;)
+  {
+    size_t count = 1;
+    while (i + count < word_count && words[i + count] == words[i])
+      count++;
+
+    int is_run = count > 1;
+    if (!is_run)
+    {
+      // Up to where the next run starts
+      while (i + count < word_count && !(i + count + 1 < word_count && words[i + count] == words[i + count + 1]))
+        count++;
+    }
+
+    uint32_t token = (uint32_t)(count << 1) | (uint32_t)is_run;
+    size_t payload = (is_run ? 1 : count) * sizeof(uint64_t);
+    if (out_size + sizeof(token) + payload > capacity)
+      return 0;
+
+    memcpy(out + out_size, &token, sizeof(token));
+    memcpy(out + out_size + sizeof(token), &words[i], payload);
+    out_size += sizeof(token) + payload;
+    i += count;
+  }
+  return out_size;
+}
+
+// words starts out zeroed, so runs of zeros are skipped
+static void cold_decompress(const unsigned char* in, size_t size, uint64_t* words)
+{
+  for (size_t position = 0; position < size;)
+  {
+    uint32_t token;
+    memcpy(&token, in + position, sizeof(token));
+    position += sizeof(token);
+
+    size_t count = token >> 1;
+    if (token & 1)
+    {
+      uint64_t word;
+      memcpy(&word, in + position, sizeof(word));
+      position += sizeof(word);
+      for (size_t i = 0; word != 0 && i < count; i++)
+        words[i] = word;
+    }
+    else
+    {
+      memcpy(words, in + position, count * sizeof(uint64_t));
+      position += count * sizeof(uint64_t);
+    }
+    words += count;
+  }
+}
+
+// Make a block accessible again, and return once it is, whoever does it. Runs in the fault handler, so it sticks to
+// plain system calls (not even the counted_ wrappers, as the stats live in a lazily set up thread local, and
+// place_pages() rather than apply_placement()): a compressed block is decompressed into fresh pages somewhere else, which are then moved over the block
+// in one go with mremap(), so no other thread can see it half done.
+static int cold_wake(cold_state* state, size_t index)
+{
+  cold_block* block = &cold_blocks(state)[index];
+  char* address = state->data + index * state->block_size;
+
+  for (;;)
+  {
+    uint32_t current = __atomic_load_n(&block->state, __ATOMIC_ACQUIRE);
+    if (current == COLD_HOT)
+      return 0;
+
+    if ((current == COLD_ARMED || current == COLD_COLD) &&
+        __atomic_compare_exchange_n(&block->state, &current, COLD_WAKING, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+      int err = 0;
+      if (current == COLD_ARMED)
+      {
+        if (mprotect(address, state->block_size, PROT_READ | PROT_WRITE) != 0)
+          err = errno;
+      }
+      else
+      {
+        char* pages = (char*)mmap(NULL, state->block_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (pages == MAP_FAILED)
+          err = errno;
+        if (err == 0)
+          err = place_pages(pages, state->block_size, state->placement);
+        if (err == 0)
+        {
+          cold_decompress(block->compressed, block->compressed_size, (uint64_t*)pages);
+          if (mremap(pages, state->block_size, state->block_size, MREMAP_MAYMOVE | MREMAP_FIXED, address) == MAP_FAILED)
+            err = errno;
+        }
+        if (err != 0 && pages != MAP_FAILED)
+          munmap(pages, state->block_size);
+      }
+
+      __atomic_store_n(&block->state, err == 0 ? COLD_HOT : current, __ATOMIC_RELEASE);
+      return err;
+    }
+
+    // Someone else is working on it
+    sched_yield();
+  }
+}
+
+// Called by the fault handler, true if address is in a cold block, which is usable again
+static int cold_handle_fault(char* address)
+{
+  for (size_t slot = 0; slot < COLD_MAX_ALLOCATIONS; slot++)
+  {
+    cold_state* state = &cold_states[slot];
+    char* data = __atomic_load_n(&state->data, __ATOMIC_ACQUIRE);
+    size_t block_count = __atomic_load_n(&state->block_count, __ATOMIC_ACQUIRE);
+    if (data && address >= data && address < data + block_count * state->block_size)
+      return cold_wake(state, (size_t)(address - data) / state->block_size) == 0;
+  }
+  return 0;
+}
+
+static cold_state* cold_find(const pinned_alloc_info* allocation)
+{
+  if (!(allocation->flags & PINNED_FLAG_COLD))
+    return NULL;
+
+  for (size_t slot = 0; slot < COLD_MAX_ALLOCATIONS; slot++)
+  {
+    if (cold_states[slot].data == allocation->data)
+      return &cold_states[slot];
+  }
+  return NULL;
+}
+
+// Start or stop managing blocks, for when the allocation has grown or is about to shrink to size. Blocks that are
+// dropped are woken up first, so the allocation can do whatever it likes with them.
+static int cold_track(cold_state* state, size_t size)
+{
+  size_t block_count = size / state->block_size;
+  size_t old_count = state->block_count;
+
+  if (block_count < old_count)
+  {
+    for (size_t i = block_count; i < old_count; i++)
+    {
+      int err = cold_wake(state, i);
+      if (err != 0)
+        return err;
+    }
+
+    __atomic_store_n(&state->block_count, block_count, __ATOMIC_RELEASE);
+    for (size_t i = block_count; i < old_count; i++)
+      free(cold_blocks(state)[i].compressed);
+    memset(&cold_blocks(state)[block_count], 0, (old_count - block_count) * sizeof(cold_block));
+  }
+  else if (block_count > old_count)
+  {
+    // New blocks start out zeroed, which is hot with nothing compressed
+    int err = pinned_realloc(block_count * sizeof(cold_block), &state->blocks);
+    if (err != 0)
+      return err;
+    __atomic_store_n(&state->block_count, block_count, __ATOMIC_RELEASE);
+  }
+  return 0;
+}
+
+// Free everything without waking anything up, for when the allocation is going away
+static void cold_release(pinned_alloc_info* allocation)
+{
+  cold_state* state = cold_find(allocation);
+  if (!state)
+    return;
+
+  pthread_mutex_lock(&cold_lock);
+  __atomic_store_n(&state->data, NULL, __ATOMIC_RELEASE);
+  __atomic_store_n(&state->block_count, 0, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&cold_lock);
+
+  for (size_t i = 0; i < state->blocks.size / sizeof(cold_block); i++)
+    free(cold_blocks(state)[i].compressed);
+  pinned_free(&state->blocks);
+  allocation->flags &= ~PINNED_FLAG_COLD;
+}
+
+int pinned_cold_enable(size_t block_size, pinned_alloc_info* allocation)
+{
+  if (block_size == 0)
+    block_size = COLD_DEFAULT_BLOCK_SIZE;
+
+  if (block_size % (size_t)getpagesize() != 0 || block_size > ((size_t)1 << 30) || allocation->backing ||
+      (allocation->flags & (PINNED_FLAG_READ_ONLY | PINNED_FLAG_FILE_PAGES)))
+  {
+    return EINVAL;
+  }
+  if (allocation->flags & PINNED_FLAG_COLD)
+    return 0;
+  if (allocation->flags & PINNED_FLAG_DIRTY)
+    return EBUSY;
+
+  // Waking a block places its fresh pages, and the fault handler can't be the first to read the nodes
+  pthread_once(&allowed_numa_nodes_once, read_allowed_numa_nodes);
+  pthread_once(&fault_handler_once, install_fault_handler);
+
+  cold_state* state = NULL;
+  pthread_mutex_lock(&cold_lock);
+  for (size_t slot = 0; !state && slot < COLD_MAX_ALLOCATIONS; slot++)
+  {
+    if (!cold_states[slot].data)
+      state = &cold_states[slot];
+  }
+
+  int err = state ? 0 : ENOMEM;
+  if (err == 0)
+    err = pinned_alloc(0, (allocation->max_size / block_size + 1) * sizeof(cold_block), &state->blocks);
+
+  if (err == 0)
+  {
+    state->block_size = block_size;
+    state->block_count = 0;
+    state->placement = allocation->placement;
+    __atomic_store_n(&state->data, (char*)allocation->data, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&cold_lock);
+
+  if (err != 0)
+    return err;
+
+  allocation->flags |= PINNED_FLAG_COLD;
+  return 0;
+}
+
+int pinned_cold_disable(pinned_alloc_info* allocation)
+{
+  cold_state* state = cold_find(allocation);
+  if (!state)
+    return (allocation->flags & PINNED_FLAG_COLD) ? EINVAL : 0;
+
+  int err = cold_track(state, 0);
+  if (err != 0)
+    return err;
+
+  cold_release(allocation);
+  return 0;
+}
+
+int pinned_cold_sweep(pinned_alloc_info* allocation, size_t* compressed_blocks)
+{
+  if (compressed_blocks)
+    *compressed_blocks = 0;
+
+  cold_state* state = cold_find(allocation);
+  if (!state)
+    return EINVAL;
+
+  int err = cold_track(state, allocation->size);
+  if (err != 0)
+    return err;
+
+  size_t capacity = state->block_size / 2;
+  unsigned char* scratch = (unsigned char*)malloc(capacity);
+  if (!scratch)
+    return ENOMEM;
+
+  cold_block* blocks = cold_blocks(state);
+  size_t block_count = state->block_count;
+  for (size_t i = 0; i < block_count && err == 0;)
+  {
+    char* address = state->data + i * state->block_size;
+    uint32_t current = __atomic_load_n(&blocks[i].state, __ATOMIC_ACQUIRE);
+
+    if (current == COLD_HOT)
+    {
+      // Arm the whole stretch of hot blocks from here with one mprotect(). Their compressed copies (if they were cold
+      // before) are out of date, and the fault handler is done with them.
+      size_t end = i;
+      while (end < block_count && __atomic_load_n(&blocks[end].state, __ATOMIC_ACQUIRE) == COLD_HOT)
+      {
+        free(blocks[end].compressed);
+        blocks[end].compressed = NULL;
+        blocks[end].compressed_size = 0;
+        __atomic_store_n(&blocks[end].state, COLD_ARMED, __ATOMIC_RELEASE);
+        end++;
+      }
+
+      if (counted_mprotect(address, (end - i) * state->block_size, PROT_NONE) != 0)
+      {
+        // Every stretch of blocks in a different state from the ones around it is a mapping of its own, and past
+        // vm.max_map_count there are no more (ENOMEM). That's no reason to fail, the stretch just stays hot for now.
+        // If even putting it back fails, the blocks stay armed, which the fault handler deals with.
+        if (errno != ENOMEM)
+          err = errno;
+        else if (counted_mprotect(address, (end - i) * state->block_size, PROT_READ | PROT_WRITE) == 0)
+        {
+          for (size_t j = i; j < end; j++)
+          {
+            uint32_t armed = COLD_ARMED;
+            __atomic_compare_exchange_n(&blocks[j].state, &armed, COLD_HOT, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+          }
+        }
+      }
+      i = end;
+      continue;
+    }
+
+    if (current == COLD_ARMED &&
+        __atomic_compare_exchange_n(&blocks[i].state, &current, COLD_COMPRESSING, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+      // Untouched since the last sweep. Readers can carry on while it's compressed, writers wait.
+      if (counted_mprotect(address, state->block_size, PROT_READ) != 0)
+      {
+        // Still protected, so it stays armed, and out of mappings is no reason to fail (see above)
+        if (errno != ENOMEM)
+          err = errno;
+        __atomic_store_n(&blocks[i].state, COLD_ARMED, __ATOMIC_RELEASE);
+        i++;
+        continue;
+      }
+
+      size_t size = cold_compress((const uint64_t*)address, state->block_size / sizeof(uint64_t), scratch, capacity);
+
+      unsigned char* compressed = size ? (unsigned char*)malloc(size) : NULL;
+      if (compressed)
+      {
+        memcpy(compressed, scratch, size);
+        blocks[i].compressed = compressed;
+        blocks[i].compressed_size = (uint32_t)size;
+
+        if (counted_mprotect(address, state->block_size, PROT_NONE) != 0 ||
+            madvise(address, state->block_size, MADV_DONTNEED) != 0)
+        {
+          err = errno;
+        }
+        __atomic_store_n(&blocks[i].state, COLD_COLD, __ATOMIC_RELEASE);
+        if (compressed_blocks)
+          (*compressed_blocks)++;
+      }
+      else
+      {
+        // Doesn't compress (or no memory to put it in), so it stays as it is
+        if (counted_mprotect(address, state->block_size, PROT_READ | PROT_WRITE) != 0)
+          err = errno;
+        __atomic_store_n(&blocks[i].state, COLD_HOT, __ATOMIC_RELEASE);
+      }
+    }
+    i++;
+  }
+
+  free(scratch);
+  return err;
+}
+
+int pinned_cold_wake(size_t offset, size_t length, pinned_alloc_info* allocation)
+{
+  if (offset + length > allocation->size)
+    return EINVAL;
+
+  cold_state* state = cold_find(allocation);
+  if (!state || length == 0)
+    return 0;
+
+  // Blocks past block_count aren't managed (yet), so there's nothing to wake
+  size_t first = offset / state->block_size;
+  size_t last = (offset + length + state->block_size - 1) / state->block_size;
+  size_t block_count = __atomic_load_n(&state->block_count, __ATOMIC_ACQUIRE);
+  if (last > block_count)
+    last = block_count;
+
+  for (size_t i = first; i < last; i++)
+  {
+    int err = cold_wake(state, i);
+    if (err != 0)
+      return err;
+  }
+  return 0;
+}
+
+int pinned_cold_get_stats(const pinned_alloc_info* allocation, pinned_cold_stats* stats)
+{
+  memset(stats, 0, sizeof(pinned_cold_stats));
+
+  cold_state* state = cold_find(allocation);
+  if (!state)
+    return EINVAL;
+
+  cold_block* blocks = cold_blocks(state);
+  stats->managed_bytes = state->block_count * state->block_size;
+  for (size_t i = 0; i < state->block_count; i++)
+  {
+    if (__atomic_load_n(&blocks[i].state, __ATOMIC_ACQUIRE) == COLD_COLD)
+    {
+      stats->cold_bytes += state->block_size;
+      stats->compressed_bytes += blocks[i].compressed_size;
+    }
+  }
+  return 0;
+}
+
+// Dirty page tracking. Tracked pages are kept read-only until they're written to, when the fault handler makes them
+// writable and sets their bit in the bitmap. A checkpoint takes the bits, and write-protects those pages again.
+typedef struct dirty_state
+{
+  char* data; // NULL for free slots
+  size_t page_count; // the pages being tracked, the handler only looks at those
+  pinned_alloc_info bitmap;
+} dirty_state;
+
+#define DIRTY_MAX_ALLOCATIONS 64
+
+static dirty_state dirty_states[DIRTY_MAX_ALLOCATIONS];
+static pthread_mutex_t dirty_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t* dirty_bits(dirty_state* state)
+{
+  return (uint64_t*)state->bitmap.data;
+}
+
+// Called by the fault handler, true if address is in a tracked page, which is now writable and marked dirty. The page is
+// unprotected before it's marked, so a checkpoint can't take the bit and write-protect the page in between, and then
+// have the write that faulted go through anyway.
+static int dirty_handle_fault(char* address)
+{
+  size_t page_size = (size_t)getpagesize();
+  for (size_t slot = 0; slot < DIRTY_MAX_ALLOCATIONS; slot++)
+  {
+    dirty_state* state = &dirty_states[slot];
+    char* data = __atomic_load_n(&state->data, __ATOMIC_ACQUIRE);
+    size_t page_count = __atomic_load_n(&state->page_count, __ATOMIC_ACQUIRE);
+    if (!data || address < data || address >= data + page_count * page_size)
+      continue;
+
+    // Plain mprotect(), the counted_ wrapper isn't async-signal-safe (see cold_wake())
+    size_t page = (size_t)(address - data) / page_size;
+    if (mprotect(data + page * page_size, page_size, PROT_READ | PROT_WRITE) != 0)
+      return 0;
+    __atomic_fetch_or(&dirty_bits(state)[page / 64], (uint64_t)1 << (page % 64), __ATOMIC_RELEASE);
+    return 1;
+  }
+  return 0;
+}
+
+static dirty_state* dirty_find(const pinned_alloc_info* allocation)
+{
+  if (!(allocation->flags & PINNED_FLAG_DIRTY))
+    return NULL;
+
+  for (size_t slot = 0; slot < DIRTY_MAX_ALLOCATIONS; slot++)
+  {
+    if (dirty_states[slot].data == allocation->data)
+      return &dirty_states[slot];
+  }
+  return NULL;
+}
+
+// Stop tracking the pages past size, for when the allocation is about to shrink to it
+static void dirty_truncate(dirty_state* state, size_t size)
+{
+  size_t page_count = size / (size_t)getpagesize();
+  if (page_count >= state->page_count)
+    return;
+
+  __atomic_store_n(&state->page_count, page_count, __ATOMIC_RELEASE);
+
+  // Growing back has to start from clean bits
+  size_t word_index = page_count / 64;
+  if (page_count % 64 != 0)
+    __atomic_fetch_and(&dirty_bits(state)[word_index++], ((uint64_t)1 << (page_count % 64)) - 1, __ATOMIC_RELAXED);
+  size_t word_count = state->bitmap.size / sizeof(uint64_t);
+  if (word_count > word_index)
+    memset(&dirty_bits(state)[word_index], 0, (word_count - word_index) * sizeof(uint64_t));
+}
+
+static void dirty_release(pinned_alloc_info* allocation)
+{
+  dirty_state* state = dirty_find(allocation);
+  if (!state)
+    return;
+
+  pthread_mutex_lock(&dirty_lock);
+  __atomic_store_n(&state->data, NULL, __ATOMIC_RELEASE);
+  __atomic_store_n(&state->page_count, 0, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&dirty_lock);
+
+  pinned_free(&state->bitmap);
+  allocation->flags &= ~PINNED_FLAG_DIRTY;
+}
+
+int pinned_dirty_enable(pinned_alloc_info* allocation)
+{
+  if (allocation->backing || (allocation->flags & (PINNED_FLAG_READ_ONLY | PINNED_FLAG_FILE_PAGES)))
+    return EINVAL;
+  if (allocation->flags & PINNED_FLAG_DIRTY)
+    return 0;
+  if (allocation->flags & TRAPPED_FLAGS)
+    return EBUSY;
+
+  pthread_once(&fault_handler_once, install_fault_handler);
+
+  size_t page_size = (size_t)getpagesize();
+  size_t page_count = allocation->size / page_size;
+
+  dirty_state* state = NULL;
+  pthread_mutex_lock(&dirty_lock);
+  for (size_t slot = 0; !state && slot < DIRTY_MAX_ALLOCATIONS; slot++)
+  {
+    if (!dirty_states[slot].data)
+      state = &dirty_states[slot];
+  }
+
+  int err = state ? 0 : ENOMEM;
+  if (err == 0)
+  {
+    size_t max_words = (allocation->max_size / page_size + 63) / 64;
+    err = pinned_alloc((page_count + 63) / 64 * sizeof(uint64_t), max_words * sizeof(uint64_t), &state->bitmap);
+  }
+
+  // Everything starts out clean
+  if (err == 0 && page_count > 0 && counted_mprotect(allocation->data, page_count * page_size, PROT_READ) != 0)
+  {
+    err = errno;
+    pinned_free(&state->bitmap);
+  }
+
+  if (err == 0)
+  {
+    state->page_count = page_count;
+    __atomic_store_n(&state->data, (char*)allocation->data, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&dirty_lock);
+
+  if (err != 0)
+    return err;
+
+  allocation->flags |= PINNED_FLAG_DIRTY;
+  return 0;
+}
+
+int pinned_dirty_disable(pinned_alloc_info* allocation)
+{
+  dirty_state* state = dirty_find(allocation);
+  if (!state)
+    return (allocation->flags & PINNED_FLAG_DIRTY) ? EINVAL : 0;
+
+  size_t page_count = state->page_count;
+  dirty_release(allocation);
+  if (page_count > 0 && counted_mprotect(allocation->data, page_count * (size_t)getpagesize(), PROT_READ | PROT_WRITE) != 0)
+    return errno;
+  return 0;
+}
+
+int pinned_dirty_checkpoint(pinned_alloc_info* allocation, pinned_dirty_callback callback, void* user)
+{
+  dirty_state* state = dirty_find(allocation);
+  if (!state)
+    return EINVAL;
+
+  size_t page_size = (size_t)getpagesize();
+  size_t old_count = state->page_count;
+  size_t page_count = allocation->size / page_size;
+  if (page_count > old_count)
+  {
+    int err = pinned_realloc((page_count + 63) / 64 * sizeof(uint64_t), &state->bitmap);
+    if (err != 0)
+      return err;
+
+    // The new pages stay writable until they're protected below, so the handler can take them on from here
+    __atomic_store_n(&state->page_count, page_count, __ATOMIC_RELEASE);
+  }
+
+  // Take the bits a word at a time, protect the pages that were dirty, and only then hand them out, so the callback
+  // sees every write that made it in before they were protected, and everything after that faults and is marked for
+  // the next checkpoint. Pages the allocation has grown by since the last checkpoint count as dirty.
+  uint64_t* bits = dirty_bits(state);
+  size_t run_start = 0, run_length = 0;
+  for (size_t word_index = 0; word_index < (page_count + 63) / 64; word_index++)
+  {
+    uint64_t word = __atomic_exchange_n(&bits[word_index], 0, __ATOMIC_ACQUIRE);
+    for (size_t bit = 0; bit < 64 && word_index * 64 + bit < page_count; bit++)
+    {
+      size_t page = word_index * 64 + bit;
+      if (((word >> bit) & 1) || page >= old_count)
+      {
+        if (run_length == 0)
+          run_start = page;
+        run_length++;
+        continue;
+      }
+
+      if (run_length > 0)
+      {
+        if (counted_mprotect(state->data + run_start * page_size, run_length * page_size, PROT_READ) != 0)
+          return errno;
+        callback(run_start * page_size, run_length * page_size, user);
+        run_length = 0;
+      }
+    }
+  }
+
+  if (run_length > 0)
+  {
+    if (counted_mprotect(state->data + run_start * page_size, run_length * page_size, PROT_READ) != 0)
+      return errno;
+    callback(run_start * page_size, run_length * page_size, user);
+  }
+  return 0;
+}
+
+int pinned_dirty_mark(size_t offset, size_t length, pinned_alloc_info* allocation)
+{
+  if (offset + length > allocation->size)
+    return EINVAL;
+
+  dirty_state* state = dirty_find(allocation);
+  if (!state || length == 0)
+    return 0;
+
+  // Pages past page_count aren't protected, and count as dirty anyway. Unprotect first, then mark, like the handler.
+  size_t page_size = (size_t)getpagesize();
+  size_t first = offset / page_size;
+  size_t last = (offset + length + page_size - 1) / page_size;
+  size_t page_count = __atomic_load_n(&state->page_count, __ATOMIC_ACQUIRE);
+  if (last > page_count)
+    last = page_count;
+  if (first >= last)
+    return 0;
+
+  if (counted_mprotect(state->data + first * page_size, (last - first) * page_size, PROT_READ | PROT_WRITE) != 0)
+    return errno;
+  for (size_t page = first; page < last; page++)
+    __atomic_fetch_or(&dirty_bits(state)[page / 64], (uint64_t)1 << (page % 64), __ATOMIC_RELEASE);
+  return 0;
+}
+
+// Faults in cold blocks and dirty tracked pages are handled here, everything else goes to whatever SIGSEGV handler was
+// installed before
+static struct sigaction previous_fault_action;
+
+static void fault_handler(int signal_number, siginfo_t* info, void* context)
+{
+  int saved_errno = errno;
+  char* address = (char*)info->si_addr;
+
+  if (cold_handle_fault(address) || dirty_handle_fault(address))
+  {
+    errno = saved_errno;
+    return; // the access is retried, and works this time
+  }
+
+  if (previous_fault_action.sa_flags & SA_SIGINFO)
+  {
+    previous_fault_action.sa_sigaction(signal_number, info, context);
+  }
+  else if (previous_fault_action.sa_handler == SIG_DFL || previous_fault_action.sa_handler == SIG_IGN)
+  {
+    // Returning retries the access, which then crashes the usual way
+    struct sigaction default_action;
+    memset(&default_action, 0, sizeof(default_action));
+    default_action.sa_handler = SIG_DFL;
+    sigaction(SIGSEGV, &default_action, NULL);
+  }
+  else
+  {
+    previous_fault_action.sa_handler(signal_number);
+  }
+  errno = saved_errno;
+}
+
+static void install_fault_handler(void)
+{
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = fault_handler;
+  action.sa_flags = SA_SIGINFO | SA_RESTART | SA_ONSTACK;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGSEGV, &action, &previous_fault_action);
+}
+
+static int realloc_pages(size_t new_size, pinned_alloc_info* allocation)
+{
+  if (new_size > allocation->max_size)
+    return EINVAL;
+
+  size_t aligned_size = align_size(new_size, getpagesize());
+
+  if (allocation->flags & PINNED_FLAG_READ_ONLY)
+    return EINVAL;
+
+  if (allocation->backing)
+    return realloc_backed(aligned_size, allocation);
+
+  if (aligned_size < allocation->size && (allocation->flags & PINNED_FLAG_COLD))
+  {
+    // Blocks that are going away have to be brought back first, so the tier lets go of them
+    int err = cold_track(cold_find(allocation), aligned_size);
+    if (err != 0)
+      return err;
+  }
+  if (aligned_size < allocation->size && (allocation->flags & PINNED_FLAG_DIRTY))
+    dirty_truncate(dirty_find(allocation), aligned_size);
+
+  if (aligned_size < allocation->size && (allocation->flags & PINNED_FLAG_FILE_PAGES))
+  {
+    // MADV_DONTNEED on pages from pinned_map_file() would only bring the file's contents back, so put fresh
+    // reserved-only memory over them instead
+    int err = replace_pages(((char*)allocation->data) + aligned_size, allocation->size - aligned_size, PROT_NONE, allocation->placement);
+    if (err != 0)
+      return err;
+  }
+  else if (aligned_size < allocation->size)
+  {
+    // Decommit pages when shrinking. mprotect() alone would keep the contents (and the physical memory) around,
+    // so throw them away first, which also means they come back zeroed if we grow again, just like on windows.
+    if (madvise(((char*)allocation->data) + aligned_size, allocation->size - aligned_size, MADV_DONTNEED) != 0)
+      return errno;
+    if (counted_mprotect(((char*)allocation->data) + aligned_size, allocation->size - aligned_size, PROT_NONE) != 0)
+      return errno;
+  }
+  else if (aligned_size > 0)
+  {
+    // Commit pages when growing. With the cold tier or dirty tracking on, the pages already committed can be protected
+    // on purpose, so those are left alone.
+    size_t from = (allocation->flags & TRAPPED_FLAGS) ? allocation->size : 0;
+    if (aligned_size > from && counted_mprotect(((char*)allocation->data) + from, aligned_size - from, PROT_READ | PROT_WRITE) != 0)
+      return errno;
+
+    if (aligned_size > allocation->size)
+    {
+      int err = apply_placement(((char*)allocation->data) + allocation->size, aligned_size - allocation->size, allocation->placement);
+      if (err != 0)
+      {
+        // Nothing has touched the new pages yet, so just take them back, and the allocation is as it was
+        counted_mprotect(((char*)allocation->data) + allocation->size, aligned_size - allocation->size, PROT_NONE);
+        return err;
+      }
+    }
+  }
+
+  allocation->size = aligned_size;
+
+  return 0;
+}
+
+static int relocate_pages(size_t new_max_size, pinned_alloc_info* allocation)
+{
+  if (new_max_size < allocation->size || allocation->backing || (allocation->flags & PINNED_FLAG_READ_ONLY))
+    return EINVAL;
+  if (allocation->flags & TRAPPED_FLAGS)
+    return EBUSY;
+
+  char* new_data = (char*)counted_mmap(NULL, new_max_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, 0, 0);
+  if (new_data == MAP_FAILED)
+    return errno;
+
+  // Like pinned_move_pages(), the committed pages are moved if they're all one mapping, and copied if they aren't (eg
+  // when a file was mapped in with pinned_map_file(), or the placement split them up)
+  STATS_ADD(mmap_calls, 1);
+  if (allocation->size > 0 && mremap(allocation->data, allocation->size, allocation->size, MREMAP_MAYMOVE | MREMAP_FIXED, new_data) == MAP_FAILED)
+  {
+    int err = errno;
+    if (err == EFAULT || err == EINVAL)
+    {
+      err = counted_mprotect(new_data, allocation->size, PROT_READ | PROT_WRITE) == 0 ?
+        apply_placement(new_data, allocation->size, allocation->placement) : errno;
+    }
+
+    if (err != 0)
+    {
+      counted_munmap(new_data, new_max_size);
+      return err;
+    }
+
+    memcpy(new_data, allocation->data, allocation->size);
+    allocation->flags &= ~PINNED_FLAG_FILE_PAGES;
+  }
+
+  // Whatever is left of the old reservation, which is all of it if the pages were copied
+  int result = counted_munmap(allocation->data, allocation->max_size);
+  assert(result == 0);
+
+  allocation->data = new_data;
+  allocation->max_size = new_max_size;
+  return 0;
+}
+
+void pinned_free(pinned_alloc_info* allocation)
+{
+  untrack_allocation(allocation);
+  cold_release(allocation);
+  dirty_release(allocation);
+
+  if (allocation->flags & PINNED_FLAG_SNAPSHOT)
+    __atomic_fetch_sub(&((backing_header*)allocation->backing)->live_snapshots, 1, __ATOMIC_RELEASE);
+
+  // A file backed allocation has to get its changes into the file before it goes. If there are still snapshots around,
+  // they can't go in without changing the snapshots, so they're lost.
+  if (allocation->flags & PINNED_FLAG_COPY_ON_WRITE)
+    end_copy_on_write(allocation);
+
+  int result = counted_munmap(allocation->data, allocation->max_size);
+  assert(result == 0);
+
+  if (allocation->backing)
+  {
+    result = counted_munmap(allocation->backing, getpagesize());
+    assert(result == 0);
+    if (allocation->fd >= 0)
+      close(allocation->fd);
+  }
+}
+
+// Map the whole of fd (which is size bytes) at address, and then again straight after it
+static int map_ring_twice(char* address, size_t size, int fd)
+{
+  if (counted_mmap(address, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+    return errno;
+  if (counted_mmap(address + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+    return errno;
+  return 0;
+}
+
+int pinned_ring_alloc(size_t capacity, size_t max_capacity, pinned_ring_info* ring)
+{
+  int err = 0;
+  void* base_pointer = NULL;
+  int fd = -1;
+
+  size_t page_size = (size_t)getpagesize();
+  capacity = align_size(capacity == 0 ? 1 : capacity, page_size);
+  max_capacity = align_size(max_capacity, page_size);
+  if (capacity > max_capacity)
+    return EINVAL;
+
+  base_pointer = counted_mmap(NULL, max_capacity * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base_pointer == MAP_FAILED)
+  {
+    base_pointer = NULL;
+    err = errno;
+    goto on_error;
+  }
+
+  fd = memfd_create("pinned_ring", MFD_CLOEXEC);
+  if (fd < 0 || ftruncate(fd, capacity) != 0)
+  {
+    err = errno;
+    goto on_error;
+  }
+
+  err = map_ring_twice((char*)base_pointer, capacity, fd);
+  if (err != 0)
+    goto on_error;
+
+  ring->data = base_pointer;
+  ring->capacity = capacity;
+  ring->max_capacity = max_capacity;
+  ring->fd = fd;
+
+  stats_track_allocation((int64_t)max_capacity * 2, (int64_t)capacity, 1);
+
+  goto ok;
+
+on_error:
+  if (base_pointer)
+  {
+    int result = counted_munmap(base_pointer, max_capacity * 2);
+    assert(result == 0);
+  }
+  if (fd >= 0)
+    close(fd);
+
+ok:
+  return err;
+}
+
+// Put the ring back the way it was before a resize to new_capacity, which failed with some of the new mappings in place
+static int restore_ring(pinned_ring_info* ring, size_t new_capacity)
+{
+  if (new_capacity > ring->capacity &&
+      counted_mmap(((char*)ring->data) + ring->capacity * 2, (new_capacity - ring->capacity) * 2, PROT_NONE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED)
+  {
+    return errno;
+  }
+  return map_ring_twice((char*)ring->data, ring->capacity, ring->fd);
+}
+
+int pinned_ring_resize(size_t new_capacity, unsigned long long begin, unsigned long long end, pinned_ring_info* ring)
+{
+  int err = 0;
+  char* staging = NULL;
+
+  new_capacity = align_size(new_capacity == 0 ? 1 : new_capacity, (size_t)getpagesize());
+  if (new_capacity > ring->max_capacity || end < begin || end - begin > new_capacity || end - begin > ring->capacity)
+    return EINVAL;
+
+  int fd = memfd_create("pinned_ring", MFD_CLOEXEC);
+  if (fd < 0 || ftruncate(fd, new_capacity) != 0)
+  {
+    err = errno;
+    goto on_error;
+  }
+
+  // Fill the new ring somewhere else first, so the old one's memory stays intact if anything fails.
+  // The live bytes are contiguous in the old ring thanks to the double mapping, but might wrap around in the new one.
+  staging = (char*)counted_mmap(NULL, new_capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (staging == MAP_FAILED)
+  {
+    staging = NULL;
+    err = errno;
+    goto on_error;
+  }
+
+  {
+    size_t length = (size_t)(end - begin);
+    const char* source = ((const char*)ring->data) + (size_t)(begin % ring->capacity);
+    size_t destination = (size_t)(begin % new_capacity);
+    size_t before_wrap = length < new_capacity - destination ? length : new_capacity - destination;
+
+    memcpy(staging + destination, source, before_wrap);
+    memcpy(staging, source + before_wrap, length - before_wrap);
+  }
+
+  err = map_ring_twice((char*)ring->data, new_capacity, fd);
+
+  // Put the reservation back over the end of the old mapping if we shrank
+  if (err == 0 && new_capacity < ring->capacity)
+  {
+    if (counted_mmap(((char*)ring->data) + new_capacity * 2, (ring->capacity - new_capacity) * 2, PROT_NONE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED)
+    {
+      err = errno;
+    }
+  }
+
+  // Either half might already be the new ring, so map the old one back over both. If even that fails, the ring is
+  // left unusable, and all that can be done with it is pinned_ring_free().
+  if (err != 0)
+  {
+    restore_ring(ring, new_capacity);
+    goto on_error;
+  }
+
+  close(ring->fd);
+  ring->fd = fd;
+  stats_track_resize(ring->capacity, new_capacity);
+  ring->capacity = new_capacity;
+  fd = -1;
+
+on_error:
+  if (staging)
+  {
+    int result = counted_munmap(staging, new_capacity);
+    assert(result == 0);
+  }
+  if (fd >= 0)
+    close(fd);
+
+  return err;
+}
+
+void pinned_ring_free(pinned_ring_info* ring)
+{
+  stats_track_allocation(-(int64_t)ring->max_capacity * 2, -(int64_t)ring->capacity, -1);
+
+  int result = counted_munmap(ring->data, ring->max_capacity * 2);
+  assert(result == 0);
+  close(ring->fd);
+}
+
+#ifndef PINNED_NO_STATS
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void registry_lock(void)
+{
+  pthread_mutex_lock(&registry_mutex);
+}
+
+static void registry_unlock(void)
+{
+  pthread_mutex_unlock(&registry_mutex);
+}
+#endif
+
+// The "Referenced:" line of each mapping in smaps, which counts the pages whose referenced bit has been set since the
+// last write to clear_refs
+static int read_accessed_ranges(accessed_range** ranges, size_t* count)
+{
+  int err = 0;
+  char line[512];
+  int line_start = 1;
+  size_t capacity = 0;
+  accessed_range* current = NULL;
+
+  *ranges = NULL;
+  *count = 0;
+
+  FILE* smaps = fopen("/proc/self/smaps", "r");
+  if (!smaps)
+    return errno;
+
+  while (fgets(line, sizeof(line), smaps))
+  {
+    // Long lines (mappings of files with long paths) come back in pieces, only the first piece is interesting
+    int at_start = line_start;
+    line_start = strchr(line, '\n') != NULL;
+    if (!at_start)
+      continue;
+
+    unsigned long start, end;
+    size_t kilobytes;
+    if (sscanf(line, "%lx-%lx ", &start, &end) == 2)
+    {
+      if (*count == capacity)
+      {
+        capacity = capacity ? capacity * 2 : 256;
+        accessed_range* grown = (accessed_range*)realloc(*ranges, capacity * sizeof(accessed_range));
+        if (!grown)
+        {
+          err = ENOMEM;
+          goto on_error;
+        }
+        *ranges = grown;
+      }
+
+      current = &(*ranges)[(*count)++];
+      current->start = (uintptr_t)start;
+      current->end = (uintptr_t)end;
+      current->accessed_bytes = 0;
+    }
+    else if (current && sscanf(line, "Referenced: %zu kB", &kilobytes) == 1)
+    {
+      current->accessed_bytes = kilobytes * 1024;
+    }
+  }
+
+  if (ferror(smaps))
+  {
+    err = EIO;
+    goto on_error;
+  }
+
+  goto ok;
+
+on_error:
+  free(*ranges);
+  *ranges = NULL;
+  *count = 0;
+
+ok:
+  fclose(smaps);
+  return err;
+}
+
+int pinned_clear_accessed(void)
+{
+  int fd = open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+  if (fd < 0)
+    return errno;
+
+  // "1" clears the referenced bits of every page in the process
+  int err = write(fd, "1", 1) == 1 ? 0 : errno;
+  close(fd);
+  return err;
+}
+
+static int count_resident(void* data, size_t size, size_t* resident_bytes)
+{
+  unsigned char pages[4096];
+  size_t page_size = (size_t)getpagesize();
+  size_t page_count = size / page_size;
+
+  *resident_bytes = 0;
+  for (size_t first = 0; first < page_count; first += sizeof(pages))
+  {
+    size_t batch = page_count - first < sizeof(pages) ? page_count - first : sizeof(pages);
+    if (mincore(((char*)data) + first * page_size, batch * page_size, pages) != 0)
+      return errno;
+
+    for (size_t i = 0; i < batch; i++)
+    {
+      if (pages[i] & 1)
+        *resident_bytes += page_size;
+    }
+  }
+
+  return 0;
+}
+
+#endif // _WIN32
+
+#ifdef _WIN32
+# define OUT_OF_MEMORY_ERROR ERROR_NOT_ENOUGH_MEMORY
+#else
+# define OUT_OF_MEMORY_ERROR ENOMEM
+#endif
+
+// The accessed bytes of the mappings that overlap [data, data + size). The kernel only counts them per mapping, and a
+// mapping can hold more than one allocation (or only part of one), so each mapping's count is split by how much of it
+// overlaps.
+static size_t count_accessed(const accessed_range* ranges, size_t range_count, void* data, size_t size)
+{
+  uintptr_t start = (uintptr_t)data;
+  uintptr_t end = start + size;
+
+  // First range that ends after start
+  size_t low = 0, high = range_count;
+  while (low < high)
+  {
+    size_t middle = low + (high - low) / 2;
+    if (ranges[middle].end <= start)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+
+  size_t accessed_bytes = 0;
+  for (size_t i = low; i < range_count && ranges[i].start < end; i++)
+  {
+    uintptr_t overlap_start = ranges[i].start > start ? ranges[i].start : start;
+    uintptr_t overlap_end = ranges[i].end < end ? ranges[i].end : end;
+    double share = (double)(overlap_end - overlap_start) / (double)(ranges[i].end - ranges[i].start);
+    accessed_bytes += (size_t)((double)ranges[i].accessed_bytes * share);
+  }
+
+  return accessed_bytes;
+}
+
+static int get_residency(void* data, size_t size, const accessed_range* ranges, size_t range_count, pinned_residency* residency)
+{
+  residency->committed_bytes = size;
+  residency->accessed_bytes = ranges ? count_accessed(ranges, range_count, data, size) : 0;
+  return count_resident(data, size, &residency->resident_bytes);
+}
+
+int pinned_get_residency(const pinned_alloc_info* allocation, unsigned flags, pinned_residency* residency)
+{
+  accessed_range* ranges = NULL;
+  size_t range_count = 0;
+
+  if (flags & PINNED_RESIDENCY_ACCESSED)
+  {
+    int err = read_accessed_ranges(&ranges, &range_count);
+    if (err != 0)
+      return err;
+  }
+
+  int err = get_residency(allocation->data, allocation->size, ranges, range_count, residency);
+  free(ranges);
+  return err;
+}
+
+int pinned_dump_residency(unsigned flags, pinned_residency_callback callback, void* user)
+{
+#ifndef PINNED_NO_STATS
+  int err = 0;
+  accessed_range* ranges = NULL;
+  size_t range_count = 0;
+  size_t entry_count = 0;
+
+  // Work from a copy, so allocating and freeing isn't blocked on this, or on the callback
+  registry_entry* entries = registry_snapshot(&entry_count);
+  if (!entries)
+    return OUT_OF_MEMORY_ERROR;
+
+  if (flags & PINNED_RESIDENCY_ACCESSED)
+  {
+    err = read_accessed_ranges(&ranges, &range_count);
+    if (err != 0)
+      goto on_error;
+  }
+
+  for (size_t i = 0; i < entry_count; i++)
+  {
+    // Skip allocations that have been freed (or moved) since the snapshot. pinned_free() takes the entry out before it
+    // unmaps anything, so checking it and measuring under the lock means the address range can't be unmapped and
+    // reused by some other mapping in between. The callback runs without the lock.
+    pinned_residency residency;
+    int alive = 0;
+    registry_lock();
+    registry_entry* entry = &registry_entries()[entries[i].next_free];
+    if (entry->data == entries[i].data && entry->max_size == entries[i].max_size)
+      alive = get_residency(entry->data, (size_t)LOAD_RELAXED(&entry->size), ranges, range_count, &residency) == 0;
+    registry_unlock();
+
+    if (alive)
+      callback(entries[i].data, entries[i].max_size, &residency, user);
+  }
+
+on_error:
+  free(ranges);
+  free(entries);
+  return err;
+#else
+  (void)flags; (void)callback; (void)user;
+  return 0;
+#endif
+}
\ No newline at end of file
@@ -19,13 +19,65 @@
 extern "C" {
 #endif
 
+// NUMA placement for the pages of an allocation. By default, pages are placed wherever the kernel decides when they are
+// first touched, which usually means "on the node of whatever thread wrote to them first". The other policies are applied
+// (with mbind() on linux) to each range of pages as it is committed, so they carry over to everything pinned_realloc adds later.
+// On a machine with only one NUMA node, or an OS / kernel without NUMA support, all policies silently behave like
+// PINNED_NUMA_FIRST_TOUCH.
+typedef enum pinned_numa_policy
+{
+  PINNED_NUMA_FIRST_TOUCH = 0, // leave it to the OS (the default)
+  PINNED_NUMA_LOCAL,           // always allocate on the node of the thread that faults the page in
+  PINNED_NUMA_BIND,            // only allocate on the nodes in pinned_placement::nodes
+  PINNED_NUMA_INTERLEAVE,      // spread pages round-robin over the nodes in pinned_placement::nodes
+} pinned_numa_policy;
+
+typedef struct pinned_placement
+{
+  pinned_numa_policy policy;
+  unsigned long long nodes; // bitmask of NUMA nodes for PINNED_NUMA_BIND and PINNED_NUMA_INTERLEAVE, 0 means all nodes
+} pinned_placement;
+
+# define PINNED_NUMA_NODE(n) (1ULL << (n))
+
 typedef struct pinned_alloc_info
 {
   void* data;
   size_t size;
   size_t max_size;
+  pinned_placement placement;
+
+  // Only used by allocations backed by a file (see pinned_alloc_file() / pinned_alloc_shared()), NULL / unused otherwise
+  void* backing;
+  int fd;
+
+  unsigned flags;
+
+  // Where the allocation is in the list of live allocations that pinned_dump_residency() goes through, or
+  // PINNED_NO_REGISTRY_SLOT if it isn't in it
+  size_t registry_slot;
 } pinned_alloc_info;
 
+# define PINNED_NO_REGISTRY_SLOT ((size_t)-1)
+
+// Set on allocations created with pinned_attach(), which can't be resized (except by pinned_refresh()) or written to
+# define PINNED_FLAG_READ_ONLY 0x1
+
+// Set on snapshots (see pinned_snapshot()), which are read-only as well
+# define PINNED_FLAG_SNAPSHOT 0x2
+
+// Set on an allocation that has been snapshotted, while its pages are copy-on-write
+# define PINNED_FLAG_COPY_ON_WRITE 0x4
+
+// Set on an allocation that has had a file mapped into it with pinned_map_file()
+# define PINNED_FLAG_FILE_PAGES 0x8
+
+// Set on an allocation with the cold page tier turned on, see pinned_cold_enable()
+# define PINNED_FLAG_COLD 0x10
+
+// Set on an allocation with dirty page tracking turned on, see pinned_dirty_enable()
+# define PINNED_FLAG_DIRTY 0x20
+
 // You must pick a maximum size for your allocation, which will also determine how many allocations you can create.
 // Virtual memory is big, but it is not infinite, and it's probably not the full 64 bits you might expect either.
 // For example, on 64-bit windows the available virtual address space is only 128 TiB, instead of the 16 exabytes
@@ -42,9 +94,252 @@ typedef struct pinned_alloc_info
 # define PINNED_MAXSIZE_NORMAL  0x0000000400000000LL
 
 int pinned_alloc(size_t size, size_t max_size, pinned_alloc_info* allocation);
+int pinned_alloc_placed(size_t size, size_t max_size, pinned_placement placement, pinned_alloc_info* allocation);
 int pinned_realloc(size_t new_size, pinned_alloc_info* allocation);
 void pinned_free(pinned_alloc_info* allocation);
 
+// The granularity pinned_realloc works in, sizes are always rounded up to a multiple of this
+size_t pinned_page_size(void);
+
+// Give the physical memory behind a range of an allocation back to the OS, without changing the size of the allocation.
+// Only whole pages inside the range are released, and they read as zero afterwards. This is for when you're done with
+// a chunk in the middle of an allocation, eg the start of a log that has been consumed.
+int pinned_discard(size_t offset, size_t length, pinned_alloc_info* allocation);
+
+// Fault in every page overlapping a range of an allocation, as if it had been written to, without changing its contents.
+// Committed pages only get physical memory when they're first touched, so this is a way to pay for that up front, or to
+// have a particular thread pay for it: with the default first touch NUMA policy, the pages end up on the node of the
+// thread that calls this. Uses MADV_POPULATE_WRITE where the kernel has it (5.14 and up), which is a lot faster than
+// taking a fault per page.
+int pinned_prefault(size_t offset, size_t length, pinned_alloc_info* allocation);
+
+// Move length bytes of committed pages from one allocation to another, without copying them: the pages are remapped
+// into the destination with mremap(), so moving a few GiB costs about as much as moving a few pages. The source range
+// reads as zero afterwards, and whatever was in the destination range is gone. Offsets and length have to be multiples
+// of pinned_page_size(), both ranges have to be committed, and neither allocation can be file backed or shared. Ranges
+// that can't be remapped in one go (eg ones that were moved in pieces before) are copied instead, and so is everything
+// on windows.
+int pinned_move_pages(pinned_alloc_info* destination, size_t destination_offset, pinned_alloc_info* source, size_t source_offset, size_t length);
+
+// Commit or decommit the pages overlapping a range of the reservation past allocation->size, for allocations that are
+// used sparsely rather than grown from the front. Committed pages read as zero until they're written, decommitted ones
+// give their memory back, and touching them crashes like touching any reserved page. The allocation's size doesn't
+// change, and pages committed this way aren't counted in pinned_get_stats()' committed_bytes or seen by
+// pinned_get_residency(). Freeing the allocation releases them along with everything else. Only for allocations that
+// aren't file backed or shared.
+int pinned_commit_range(size_t offset, size_t length, pinned_alloc_info* allocation);
+int pinned_decommit_range(size_t offset, size_t length, pinned_alloc_info* allocation);
+
+// Move an allocation to a new reservation of new_max_size bytes, for when it has to grow past the max_size it was
+// created with. This is the one thing that changes allocation->data, so every pointer into the allocation has to be
+// updated afterwards, but the contents aren't copied: the committed pages are moved over with mremap(), so it costs
+// about the same whatever the size. That means allocations can start with a modest max_size and only pay for more
+// address space if they turn out to need it. The first allocation->size bytes are kept, pages committed past that with
+// pinned_commit_range() are released. Committed pages that can't be moved in one go (see pinned_move_pages()) are
+// copied instead, and so is everything on windows. Only for allocations that aren't file backed or shared.
+int pinned_relocate(size_t new_max_size, pinned_alloc_info* allocation);
+
+// File backed allocations map a file into the reserved region instead of anonymous memory, and pinned_realloc grows or
+// shrinks the file (with ftruncate) along with the allocation. If the file already exists, it is reopened with at least
+// as many bytes committed as its recorded length, so the data from the last run is right there, no loading required.
+// The file starts with a small header that records the length of the data actually in use (the allocation size is
+// rounded up to whole pages, so it can't be used for this), which you update with pinned_set_length() / pinned_sync().
+// Only one process can have a given file open at a time. Not supported on windows yet.
+int pinned_alloc_file(const char* path, size_t size, size_t max_size, pinned_alloc_info* allocation);
+
+// Record the number of bytes in use, for whoever opens the file next
+void pinned_set_length(size_t length, pinned_alloc_info* allocation);
+size_t pinned_get_length(const pinned_alloc_info* allocation);
+
+// pinned_set_length(), and then block until the data and the header are written to disk
+int pinned_sync(size_t length, pinned_alloc_info* allocation);
+
+// Shared allocations are backed by an anonymous in-memory file (a memfd), which other processes can map to see the same
+// memory with no copying. The owner creates it with pinned_alloc_shared(), and passes allocation.fd to the other processes
+// (over a unix socket with SCM_RIGHTS, by fork()ing, or through /proc/<pid>/fd/<fd>), which then call pinned_attach().
+// Readers get a read-only mapping at the same address as the owner if that range is free in their address space, so
+// pointers into the buffer can be passed around as-is. Check allocation.data if you rely on that.
+//
+// Only the owner can resize the allocation. Readers call pinned_refresh() to map whatever the owner has added since they
+// last looked. The owner publishes how much of the buffer holds valid data with pinned_set_length(), which has release
+// semantics, and readers read it with pinned_get_length() (acquire), so a reader that sees a length can read everything
+// up to it once its mapping is big enough:
+//
+//  size_t length = pinned_get_length(&allocation);
+//  if (length > allocation.size)
+//    pinned_refresh(&allocation);
+//
+// The owner shrinking a shared allocation while readers are still using the truncated part will crash them (SIGBUS).
+// Not supported on windows yet.
+int pinned_alloc_shared(size_t size, size_t max_size, pinned_alloc_info* allocation);
+int pinned_attach(int fd, pinned_alloc_info* allocation); // takes ownership of fd
+int pinned_refresh(pinned_alloc_info* allocation);
+
+// A read-only, point-in-time copy of a file backed or shared allocation, that doesn't copy anything. The snapshot maps
+// the backing file, and the allocation's own mapping is switched to a private (MAP_PRIVATE) mapping of the same file at
+// the same address, so from then on, the first write to each page makes a copy of it for the owner, and the file (and
+// the snapshot) keep the old contents. Taking a snapshot costs a few mmap() calls whatever the size, and after that the
+// owner pays a page fault and a page copy for each page it writes to, once. Snapshots can be read from any thread, while
+// the owner keeps writing, and live on if the allocation is freed. Free them with pinned_free().
+//
+// The owner's changes go back into the file the next time it takes a snapshot, syncs, shrinks or discards, which is only
+// possible once all the snapshots have been freed: until then, those fail with EBUSY. That also means readers in other
+// processes (see pinned_attach()) and the file on disk don't see anything written after a snapshot until then, and a
+// file backed allocation freed while it still has snapshots loses what was written since. Not supported on windows.
+int pinned_snapshot(pinned_alloc_info* allocation, pinned_alloc_info* snapshot);
+
+// Map the first length bytes of an open file over the start of an allocation, replacing whatever was there, so the file
+// can be used in place without reading it in. The mapping is private: the allocation can be written to, but the file
+// never changes, and pages are only read from the file as they are touched. The allocation is committed up to at least
+// length (rounded up to a whole page, the rest of the last page reads as zero), and growing it further commits ordinary
+// pages straight after the file's, so a file loaded this way can be appended to in place. Shrinking or discarding pages
+// throws away the file's contents with them, like anything else. length can't be more than the file's size, and the
+// file shouldn't be truncated while it's mapped (touching pages past its new end raises SIGBUS). fd can be closed
+// afterwards. Only for allocations that aren't file backed or shared. Not supported on windows.
+int pinned_map_file(int fd, size_t length, pinned_alloc_info* allocation);
+
+// A compressed tier for allocations that are big but only have a small hot set at any one time. With it turned on,
+// pinned_cold_sweep() goes over the allocation in blocks of block_size bytes (a multiple of pinned_page_size(), 64 KiB if
+// 0) like a clock: blocks that haven't been touched since the last sweep are compressed into memory on the side and
+// their pages are given back, and the others are protected with mprotect(), so the next sweep can tell whether they
+// were used in the meantime. Touching a protected or compressed block is caught by a SIGSEGV handler, which unprotects or
+// decompresses it in place, so addresses never change and the code using the allocation doesn't have to know, it just
+// takes a fault the first time it touches each block after a sweep. Sweep from wherever suits (a timer thread, between
+// batches of work), other threads can keep using the allocation meanwhile, but only one thread can sweep it at a time.
+//
+// The codec is built in and made for speed: it stores runs of the same 64 bit word once, so it does well on zeros and
+// fill values and not at all on data without repeats. Blocks that don't compress to half their size or less stay as
+// they are. Only whole blocks inside allocation->size are managed, and compressed copies of blocks that have been touched
+// again are freed by the next sweep. pinned_realloc() works as usual, but pinned_discard(), pinned_move_pages(),
+// pinned_relocate(), pinned_map_file() and pinned_commit_range() fail with EBUSY until pinned_cold_disable(), which
+// decompresses everything. Faults outside of cold allocations go to whatever SIGSEGV handler was there before the
+// first pinned_cold_enable(). At most 64 allocations can have the tier on at once. Not for file backed or shared
+// allocations, and not supported on windows.
+//
+// "Doesn't have to know" stops at the kernel, which doesn't go through the SIGSEGV handler: write(), send() or read()
+// on a protected or compressed block fails with EFAULT. pinned_cold_wake() makes a range accessible again (it does
+// nothing if the tier is off), and it stays that way until the next sweep, so don't sweep in between. Also, each run of
+// blocks in a different state from its neighbours is a mapping of its own, and a process only gets vm.max_map_count of
+// those (65530 by default). Sweeps that run out leave the blocks they couldn't protect hot, but waking up a block can
+// need a mapping too, and if it can't get one the fault is fatal. Keep allocation size / block_size well under the
+// limit, using a bigger block_size for bigger allocations.
+typedef struct pinned_cold_stats
+{
+  size_t managed_bytes;    // the whole blocks inside the allocation
+  size_t cold_bytes;       // the blocks that are compressed, uncompressed
+  size_t compressed_bytes; // the same blocks, compressed
+} pinned_cold_stats;
+
+int pinned_cold_enable(size_t block_size, pinned_alloc_info* allocation);
+int pinned_cold_disable(pinned_alloc_info* allocation);
+int pinned_cold_sweep(pinned_alloc_info* allocation, size_t* compressed_blocks); // compressed_blocks can be NULL
+int pinned_cold_get_stats(const pinned_alloc_info* allocation, pinned_cold_stats* stats);
+int pinned_cold_wake(size_t offset, size_t length, pinned_alloc_info* allocation);
+
+// Dirty page tracking, so that copying an allocation somewhere else (another process, a file, over the network) and
+// keeping the copy up to date only costs as much as what changed. Once it's turned on, the allocation's pages are
+// write-protected, and the first write to each one since the last checkpoint is caught by the same SIGSEGV handler as
+// the cold page tier, which marks the page dirty and lets the write through, so every page costs one fault per
+// checkpoint interval however often it's written. pinned_dirty_checkpoint() calls callback with the offset and length
+// of each run of pages written to since the last checkpoint (or since tracking was turned on), in order, and
+// write-protects them again. Pages the allocation grew by count as dirty, and those it shrank by are forgotten. Other
+// threads can keep writing during a checkpoint: writes that land before a page is write-protected again are there for
+// the callback to read, and the rest are marked for the next checkpoint, so what the callback reads can be newer than
+// the checkpoint but never older. Only one thread can checkpoint an allocation at a time. Has the same restrictions as
+// the cold page tier (see above), and can't be on at the same time as it on the same allocation.
+//
+// The kernel doesn't go through the SIGSEGV handler, so read(), recv() and anything else that has the kernel write into
+// a write-protected page fails with EFAULT. Call pinned_dirty_mark() on the range first, which marks its pages dirty and
+// makes them writable until the next checkpoint (and does nothing if tracking is off).
+typedef void (*pinned_dirty_callback)(size_t offset, size_t length, void* user);
+
+int pinned_dirty_enable(pinned_alloc_info* allocation);
+int pinned_dirty_disable(pinned_alloc_info* allocation);
+int pinned_dirty_checkpoint(pinned_alloc_info* allocation, pinned_dirty_callback callback, void* user);
+int pinned_dirty_mark(size_t offset, size_t length, pinned_alloc_info* allocation);
+
+// A ring buffer with its memory mapped twice, back to back, so that data[i] and data[i + capacity] are the same byte.
+// That means any capacity bytes starting anywhere in the first copy can be read or written as one contiguous block,
+// even when they wrap around the end of the ring, with no copying and no splitting reads and writes in two.
+// Like pinned_alloc, it starts by reserving address space for the biggest size it could grow to (2 * max_capacity),
+// so resizing doesn't move it. Capacities are rounded up to a multiple of pinned_page_size().
+typedef struct pinned_ring_info
+{
+  void* data;
+  size_t capacity;
+  size_t max_capacity;
+  int fd;
+} pinned_ring_info;
+
+int pinned_ring_alloc(size_t capacity, size_t max_capacity, pinned_ring_info* ring);
+
+// Change the capacity, keeping the bytes between the positions begin and end (as in, positions in an endless stream,
+// that live at position % capacity in the ring) at the same positions in the resized ring. end - begin has to fit in
+// the new capacity. Nothing else can be using the ring while it is resized. If it fails, the ring is left as it was
+// (unless mapping the old ring back fails too, in which case it can only be freed).
+int pinned_ring_resize(size_t new_capacity, unsigned long long begin, unsigned long long end, pinned_ring_info* ring);
+void pinned_ring_free(pinned_ring_info* ring);
+
+// Process-wide counters for everything allocated through this API, so you can see what pinned allocations cost in
+// production. Updating them is a few relaxed atomic adds on a per-thread shard (plus reading the clock twice in
+// pinned_realloc), which is nothing next to the syscalls being counted, so they're on by default. Define
+// PINNED_NO_STATS when compiling pinned.c to compile them out, and pinned_get_stats() will just return zeros.
+# define PINNED_STATS_LATENCY_BUCKETS 32
+
+typedef struct pinned_stats
+{
+  // Current totals over all live allocations (and rings)
+  size_t reserved_bytes;
+  size_t committed_bytes;
+  size_t live_allocations;
+
+  // Counts since the start of the process, or the last pinned_reset_stats(). On windows, mmap is VirtualAlloc with
+  // MEM_RESERVE, mprotect is committing (VirtualAlloc with MEM_COMMIT) or decommitting, and munmap is releasing.
+  unsigned long long mmap_calls;
+  unsigned long long mprotect_calls;
+  unsigned long long munmap_calls;
+
+  // pinned_realloc() calls that changed the size
+  unsigned long long grow_count;
+  unsigned long long shrink_count;
+
+  // Histogram of how long pinned_realloc() calls took: bucket i counts calls that took from 2^(i-1) up to 2^i
+  // nanoseconds, bucket 0 the ones under a nanosecond, and the last one everything from about a second up
+  unsigned long long realloc_latency[PINNED_STATS_LATENCY_BUCKETS];
+} pinned_stats;
+
+void pinned_get_stats(pinned_stats* stats);
+
+// Zero the counts. The current totals stay as they are, as they describe allocations that are still around.
+void pinned_reset_stats(void);
+
+// How much of an allocation is actually taking up physical memory. Committed pages only use RAM once they're touched, and
+// can be swapped out (or discarded) after that, so resident_bytes is often well below committed_bytes, which is the
+// number to look at when deciding whether to shrink or trim an allocation.
+//
+// With PINNED_RESIDENCY_ACCESSED, accessed_bytes also estimates how much of it has been read or written since the last
+// pinned_clear_accessed(), from the kernel's referenced bits (/proc/self/smaps). Clear, run the workload for a while,
+// and whatever wasn't accessed is idle. The kernel reports that per mapping, so it's spread evenly over the part of a
+// mapping that belongs to the allocation, and pinned_clear_accessed() resets it for the whole process. It's slow (it
+// reads all of smaps), so it's only worth doing from diagnostics, and it's not supported on windows.
+# define PINNED_RESIDENCY_ACCESSED 0x1
+
+typedef struct pinned_residency
+{
+  size_t committed_bytes;
+  size_t resident_bytes;
+  size_t accessed_bytes; // only filled in with PINNED_RESIDENCY_ACCESSED
+} pinned_residency;
+
+int pinned_get_residency(const pinned_alloc_info* allocation, unsigned flags, pinned_residency* residency);
+int pinned_clear_accessed(void);
+
+// Calls callback with the residency of every live allocation (rings aren't included). The list of allocations is kept
+// with the stats, so with PINNED_NO_STATS there's nothing to go through and the callback is never called.
+// Allocations freed while the dump is running are skipped, and so are ones that pinned_relocate() moved.
+typedef void (*pinned_residency_callback)(void* data, size_t max_size, const pinned_residency* residency, void* user);
+int pinned_dump_residency(unsigned flags, pinned_residency_callback callback, void* user);
+
 // Example use:
 //
 // pinned_alloc_info allocation;
@@ -61,6 +356,11 @@ void pinned_free(pinned_alloc_info* allocation);
 // do_more_stuff_with_old_pointer(pointer_inside_buffer); // valid, because pinned_realloc does not reallocate pointers
 //
 // pinned_free(&allocation);
+//
+// To spread a big buffer over all the NUMA nodes of the machine, so that threads on every socket get the same bandwidth:
+//
+// pinned_placement placement = { PINNED_NUMA_INTERLEAVE, 0 };
+// int ret = pinned_alloc_placed(1024, PINNED_MAXSIZE_LARGE, placement, &allocation);
 
 #ifdef __cplusplus
 };
@@ -68,12 +368,85 @@ void pinned_free(pinned_alloc_info* allocation);
 #include <new>
 #include <iterator>
 #include <stdexcept>
+#include <system_error>
+#include <type_traits>
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <exception>
+#include <thread>
+#include <vector>
+
+struct pinned_shared_tag {};
+constexpr pinned_shared_tag pinned_shared{};
+
+struct pinned_parallel_tag {};
+constexpr pinned_parallel_tag pinned_parallel{};
+
+struct pinned_file_tag {};
+constexpr pinned_file_tag pinned_file{};
+
+template <typename T>
+class pinned_snapshot_view;
+
+// Growth policies decide how much a pinned_vec commits when it runs out of room. next_size(committed, needed) gets the
+// bytes committed now and the bytes needed, and returns how many bytes to commit, at least needed (pinned_realloc()
+// rounds it up to whole pages).
+//
+// std::vector doubles because growing means copying everything, so it wants to grow as rarely as possible. A pinned_vec
+// never copies when it grows, it just commits more pages, so all growing less often saves is a syscall now and then,
+// and doubling can leave almost half of what's committed unused (a 9 GiB vector commits 16 GiB).
+
+// Like std::vector
+struct pinned_growth_doubling
+{
+  static size_t next_size(size_t committed, size_t needed) noexcept
+  {
+    return std::max(committed * 2, needed);
+  }
+};
+
+// Commit in whole steps of StepBytes, so at most StepBytes are ever wasted, at the cost of a syscall every StepBytes
+template <size_t StepBytes = 2 * 1024 * 1024>
+struct pinned_growth_step
+{
+  static_assert(StepBytes > 0, "the step can't be 0");
+
+  static size_t next_size(size_t, size_t needed) noexcept
+  {
+    return ((needed + StepBytes - 1) / StepBytes) * StepBytes;
+  }
+};
+
+// Grow by Percent of what's committed, in whole chunks of ChunkBytes. Small vectors grow a chunk at a time, big ones
+// waste at most Percent, and the number of syscalls still only grows with the log of the size. The default.
+template <unsigned Percent = 25, size_t ChunkBytes = 64 * 1024>
+struct pinned_growth_chunked
+{
+  static_assert(ChunkBytes > 0, "the chunk size can't be 0");
+
+  static size_t next_size(size_t committed, size_t needed) noexcept
+  {
+    size_t grown = std::max(needed, committed + committed / 100 * Percent);
+    return ((grown + ChunkBytes - 1) / ChunkBytes) * ChunkBytes;
+  }
+};
 
 // This class is basically the same thing as the above interface, but wrapped in an std::vector-like class.
 // Iterators are *not* invalidated on push_back() / emplace_back(). They are of course, when you call erase()
 // or insert() on the middle of the vector.
+//
+// For trivially copyable types, insert() / erase() shift elements with a single memmove(), and for trivial types resize()
+// doesn't bother zeroing memory that is still zero from when it was committed. resize_uninitialized() and append() are
+// there for when you want to fill a big chunk of the vector in one go.
+//
+// Growth is the growth policy, see above. It's used whenever the vector grows, except for reserve(), which commits
+// exactly what it's asked for.
+//
+// Growing past max_size() throws std::bad_alloc, unless a relocation callback has been set with on_relocate(), see there.
 
-template <typename T>
+template <typename T, typename Growth = pinned_growth_chunked<>>
 class pinned_vec
 {
 public:
@@ -95,19 +468,62 @@ public:
       throw std::bad_alloc();
   }
 
-  explicit pinned_vec(size_t count, size_t max_size = PINNED_MAXSIZE_NORMAL)
+  explicit pinned_vec(pinned_placement placement, size_t max_size = PINNED_MAXSIZE_NORMAL)
   {
-    if (pinned_alloc(count * sizeof(T), max_size, &allocation) != 0)
+    if (pinned_alloc_placed(0, max_size, placement, &allocation) != 0)
       throw std::bad_alloc();
+  }
 
-    for (size_t i = 0; i < count; i++)
-      new (&data()[i]) T();
+  explicit pinned_vec(size_t count, size_t max_size = PINNED_MAXSIZE_NORMAL, pinned_placement placement = {})
+  {
+    if (pinned_alloc_placed(count * sizeof(T), max_size, placement, &allocation) != 0)
+      throw std::bad_alloc();
+
+    // Freshly committed pages are already zeroed, which is all T() does for trivial types
+    if constexpr (!std::is_trivial<T>::value)
+    {
+      for (size_t i = 0; i < count; i++)
+        new (&data()[i]) T();
+    }
     this->count = count;
   }
 
-  pinned_vec(size_type count, const T& value, size_t max_size = PINNED_MAXSIZE_NORMAL)
+  // Like pinned_vec(count), but splits constructing the elements between threads, see resize(new_count, pinned_parallel)
+  pinned_vec(size_t count, pinned_parallel_tag, unsigned thread_count = 0, size_t max_size = PINNED_MAXSIZE_NORMAL, pinned_placement placement = {})
+    : pinned_vec(placement, max_size)
   {
-    if (pinned_alloc(count * sizeof(T), max_size, &allocation) != 0)
+    reserve(count);
+    resize(count, pinned_parallel, thread_count);
+  }
+
+  // Opens (or creates) a file backed vector, see pinned_alloc_file(). The size is restored from the last time the vector
+  // was destroyed or sync()ed, and the contents are just whatever bytes are in the file, so T has to be trivially copyable.
+  pinned_vec(pinned_file_tag, const char* path, size_t max_size = PINNED_MAXSIZE_NORMAL)
+  {
+    static_assert(std::is_trivially_copyable<T>::value, "file backed pinned_vecs can only hold trivially copyable types");
+
+    int err = pinned_alloc_file(path, 0, max_size, &allocation);
+    if (err != 0)
+      throw std::system_error(err, std::system_category());
+
+    count = pinned_get_length(&allocation) / sizeof(T);
+    high_water = capacity(); // there could be anything in the file past count
+  }
+
+  // Creates a vector in shared memory, see pinned_alloc_shared(). Other processes can see it with a pinned_shared_view,
+  // up to the size at the last publish().
+  pinned_vec(pinned_shared_tag, size_t max_size = PINNED_MAXSIZE_NORMAL)
+  {
+    static_assert(std::is_trivially_copyable<T>::value, "shared pinned_vecs can only hold trivially copyable types");
+
+    int err = pinned_alloc_shared(0, max_size, &allocation);
+    if (err != 0)
+      throw std::system_error(err, std::system_category());
+  }
+
+  pinned_vec(size_type count, const T& value, size_t max_size = PINNED_MAXSIZE_NORMAL, pinned_placement placement = {})
+  {
+    if (pinned_alloc_placed(count * sizeof(T), max_size, placement, &allocation) != 0)
       throw std::bad_alloc();
 
     for (size_t i = 0; i < count; i++)
@@ -115,9 +531,54 @@ public:
     this->count = count;
   }
 
+  // Copies into a new anonymous allocation with the same max_size and placement, even if other is file backed or shared
+  pinned_vec(const pinned_vec& other) : pinned_vec(other.placement(), other.allocation.max_size)
+  {
+    append(other.begin(), other.end());
+  }
+
+  // Takes other's allocation as-is. other is left empty with no address space reserved, and reserves a new anonymous
+  // allocation of the same max_size the next time it grows.
+  pinned_vec(pinned_vec&& other) noexcept
+    : allocation(other.allocation), count(other.count), high_water(other.high_water),
+      relocate_handler(other.relocate_handler), relocate_user(other.relocate_user)
+  {
+    other.allocation = pinned_alloc_info();
+    other.allocation.max_size = allocation.max_size;
+    other.allocation.placement = allocation.placement;
+    other.count = 0;
+    other.high_water = 0;
+    other.relocate_handler = nullptr;
+  }
+
+  pinned_vec& operator=(const pinned_vec& other)
+  {
+    if (this != &other)
+    {
+      clear();
+      append(other.begin(), other.end());
+    }
+    return *this;
+  }
+
+  // What this vector held is freed (or written back to its file) like in the destructor
+  pinned_vec& operator=(pinned_vec&& other) noexcept
+  {
+    pinned_vec taken(std::move(other));
+    swap(taken);
+    return *this;
+  }
+
   ~pinned_vec()
   {
-    resize(0);
+    if (!allocation.data)
+      return; // moved from
+
+    // File backed vectors only hold trivially copyable types, so there's nothing to destroy, and the contents stay in the file
+    if (allocation.backing)
+      pinned_set_length(count * sizeof(T), &allocation);
+    else
+      resize(0);
     pinned_free(&allocation);
   }
 
@@ -167,12 +628,123 @@ public:
   size_type size() const noexcept { return count; }
   size_type max_size() const noexcept { return allocation.max_size / sizeof(T); }
   size_type capacity() const noexcept { return allocation.size / sizeof(T); }
+  pinned_placement placement() const noexcept { return allocation.placement; }
+  const pinned_alloc_info& allocation_info() const noexcept { return allocation; }
+
+  // How much of the vector is actually in RAM, see pinned_get_residency()
+  pinned_residency residency(unsigned flags = 0) const
+  {
+    pinned_residency result;
+    int err = pinned_get_residency(&allocation, flags, &result);
+    if (err != 0)
+      throw std::system_error(err, std::system_category());
+    return result;
+  }
+
+  // Compress the parts of the vector that go unused, see pinned_cold_enable()
+  void enable_cold_pages(size_t block_size = 0)
+  {
+    int err = pinned_cold_enable(block_size, &allocation);
+    if (err != 0)
+      throw std::system_error(err, std::system_category());
+  }
+
+  void disable_cold_pages()
+  {
+    int err = pinned_cold_disable(&allocation);
+    if (err != 0)
+      throw std::system_error(err, std::system_category());
+  }
+
+  // Returns the number of blocks compressed
+  size_t sweep_cold_pages()
+  {
+    size_t compressed = 0;
+    int err = pinned_cold_sweep(&allocation, &compressed);
+    if (err != 0)
+      throw std::system_error(err, std::system_category());
+    return compressed;
+  }
+
+  // Makes elements [first, first + n) accessible, for before the kernel reads or writes them (write(), send()), see
+  // pinned_cold_wake(). Can go past size(), up to capacity().
+  void wake_cold_pages(size_type first, size_type n)
+  {
+    if (first > capacity() || n > capacity() - first)
+      throw std::out_of_range("out of range");
+
+    int err = pinned_cold_wake(first * sizeof(T), n * sizeof(T), &allocation);
+    if (err != 0)
+      throw std::system_error(err, std::system_category());
+  }
+
+  pinned_cold_stats cold_stats() const
+  {
+    pinned_cold_stats result;
+    int err = pinned_cold_get_stats(&allocation, &result);
+    if (err != 0)
+      throw std::system_error(err, std::system_category());
+    return result;
+  }
+
+  // Keep track of which pages are written to, see pinned_dirty_enable()
+  void enable_dirty_tracking()
+  {
+    int err = pinned_dirty_enable(&allocation);
+    if (err != 0)
+      throw std::system_error(err, std::system_category());
+  }
+
+  void disable_dirty_tracking()
+  {
+    int err = pinned_dirty_disable(&allocation);
+    if (err != 0)
+      throw std::system_error(err, std::system_category());
+  }
+
+  // Marks elements [first, first + n) as written to, for before the kernel writes into them (read(), recv()), see
+  // pinned_dirty_mark(). Can go past size(), up to capacity().
+  void mark_dirty(size_type first, size_type n)
+  {
+    if (first > capacity() || n > capacity() - first)
+      throw std::out_of_range("out of range");
+
+    int err = pinned_dirty_mark(first * sizeof(T), n * sizeof(T), &allocation);
+    if (err != 0)
+      throw std::system_error(err, std::system_category());
+  }
+
+  // Calls callback(offset, length), in bytes, for each run of pages written to since the last checkpoint, see
+  // pinned_dirty_checkpoint(). callback can't throw.
+  template <typename Callback>
+  void checkpoint_dirty(Callback&& callback)
+  {
+    using callback_type = typename std::remove_reference<Callback>::type;
+    pinned_dirty_callback call = [](size_t offset, size_t length, void* user) { (*static_cast<callback_type*>(user))(offset, length); };
+
+    int err = pinned_dirty_checkpoint(&allocation, call, const_cast<void*>(static_cast<const void*>(&callback)));
+    if (err != 0)
+      throw std::system_error(err, std::system_category());
+  }
 
   void reserve(size_type new_cap)
   {
     if (new_cap <= capacity())
       return;
 
+    if (new_cap > max_size() && relocate_handler)
+      relocate(new_cap);
+
+    if (!allocation.data)
+    {
+      // Moved from, so there's nothing reserved yet
+      pinned_alloc_info fresh = {};
+      if (pinned_alloc_placed(new_cap * sizeof(T), allocation.max_size, allocation.placement, &fresh) != 0)
+        throw std::bad_alloc();
+      allocation = fresh;
+      return;
+    }
+
     if (pinned_realloc(new_cap * sizeof(T), &allocation) != 0)
       throw std::bad_alloc();
   }
@@ -184,6 +756,7 @@ public:
     {
       if (pinned_realloc(count * sizeof(T), &allocation) != 0)
         throw std::bad_alloc();
+      high_water = std::min(high_water, capacity()); // decommitted pages come back zeroed
     }
   }
 
@@ -196,7 +769,17 @@ public:
   reference emplace_back(Args&&... args)
   {
     if (count == capacity())
-      reserve(size() == 0 ? 1 : size() * 2);
+    {
+      if (will_relocate(count + 1))
+      {
+        // args might refer to one of our elements, which are about to move
+        T value(std::forward<Args>(args) ...);
+        grow_for(count + 1);
+        return emplace_back(std::move(value));
+      }
+
+      grow_for(count + 1);
+    }
 
     new (&data()[count]) T(std::forward<Args>(args) ...);
     reference retval = data()[count];
@@ -206,35 +789,44 @@ public:
 
   void push_back(const T& value)
   {
-    if (count == capacity())
-      reserve(size() == 0 ? 1 : size() * 2);
-
-    new (&data()[count]) T(value);
-    count++;
+    emplace_back(value);
   }
 
   void push_back(const T&& value)
   {
-    if (count == capacity())
-      reserve(size() == 0 ? 1 : size() * 2);
-
-    new (&data()[count]) T(std::move(value));
-    count++;
+    emplace_back(std::move(value));
   }
 
   template<class InputIt>
   iterator insert(iterator pos, InputIt first, InputIt last)
   {
-    size_t to_add_count = size_t(last - first);
+    size_t to_add_count = size_t(std::distance(first, last));
 
     if (to_add_count == 0)
       return pos;
 
-    if (count + to_add_count > capacity())
-      reserve(std::max(capacity() * 2, count + to_add_count));
-
     size_t destination_index_start = size_t(pos - begin());
 
+    if (will_relocate(count + to_add_count))
+    {
+      // The range might be part of ourselves, which is about to move
+      std::vector<T> staged(first, last);
+      grow_for(count + to_add_count);
+      return insert(begin() + destination_index_start, staged.begin(), staged.end());
+    }
+
+    grow_for(count + to_add_count);
+
+    if constexpr (std::is_trivially_copyable<T>::value)
+    {
+      T* destination = data() + destination_index_start;
+      memmove(destination + to_add_count, destination, (count - destination_index_start) * sizeof(T));
+      copy_into_gap(destination_index_start, to_add_count, first);
+
+      count += to_add_count;
+      return destination;
+    }
+
     // First move existing things forward
     for (int64_t source_index = int64_t(count) - 1; source_index >= int64_t(destination_index_start); source_index--)
     {
@@ -251,7 +843,7 @@ public:
       size_t i = 0;
       for (InputIt it = first; it != last; ++it, i++)
       {
-        if (i >= count)
+        if (destination_index_start + i >= count)
           new(&data()[destination_index_start + i]) T(*it);
         else
           data()[destination_index_start + i] = *it;
@@ -293,10 +885,17 @@ public:
     int64_t start_index = int64_t(first - begin());
     int64_t range_size = int64_t(last - first);
 
-    for (int64_t i = start_index; i < int64_t(size()) - range_size; i++)
-      data()[i] = std::move(data()[i + range_size]);
+    if constexpr (std::is_trivially_copyable<T>::value)
+    {
+      memmove(first, last, size_t(end() - last) * sizeof(T));
+    }
+    else
+    {
+      for (int64_t i = start_index; i < int64_t(size()) - range_size; i++)
+        data()[i] = std::move(data()[i + range_size]);
+    }
 
-    resize(size() - range_size);
+    shrink_count(size() - range_size);
 
     return last - range_size;
   }
@@ -316,24 +915,43 @@ public:
     return erase(const_cast<iterator>(pos), const_cast<iterator>(pos + 1));
   }
 
+  // Same as insert(end(), first, last)
+  template<class InputIt>
+  void append(InputIt first, InputIt last)
+  {
+    insert(end(), first, last);
+  }
+
   void pop_back()
   {
-    data()[count-1].~T();
-    count--;
+    shrink_count(count - 1);
   }
 
   void resize(size_type new_count)
   {
     if (new_count > count)
     {
-      for (size_type i = count; i < new_count; i++)
-        emplace_back();
+      grow_for(new_count);
+
+      if constexpr (std::is_trivial<T>::value)
+      {
+        // Memory we have never used is still zero from when it was committed, so we only have to clear whatever we
+        // left behind the last time the vector shrank
+        size_t dirty_end = std::min(high_water, new_count);
+        if (dirty_end > count)
+          memset(data() + count, 0, (dirty_end - count) * sizeof(T));
+      }
+      else
+      {
+        for (size_type i = count; i < new_count; i++)
+          new (&data()[i]) T();
+      }
+
+      count = new_count;
     }
     else if (new_count < count)
     {
-      for (size_type i = new_count; i < count; i++)
-        data()[i].~T();
-      count = new_count;
+      shrink_count(new_count);
     }
   }
 
@@ -341,23 +959,453 @@ public:
   {
     if (new_count > count)
     {
-      for (size_type i = count; i < new_count; i++)
-        emplace_back(value);
+      if (will_relocate(new_count))
+      {
+        // value might be one of our elements, which is about to move
+        value_type staged(value);
+        grow_for(new_count);
+        resize(new_count, staged);
+        return;
+      }
+
+      grow_for(new_count);
+      std::uninitialized_fill(data() + count, data() + new_count, value);
+      count = new_count;
     }
     else if (new_count < count)
+    {
+      shrink_count(new_count);
+    }
+  }
+
+  // Like resize(), but the new elements are split into one contiguous slice per thread (thread_count, or one per core if
+  // that's 0), and each thread constructs its slice. For trivial types there's nothing to construct, so the threads just
+  // fault their slices in with pinned_prefault(). Either way, the page faults of a huge resize are spread over all the
+  // cores instead of happening one after another, and with the default first touch NUMA placement, the pages of each
+  // slice end up on the node of the thread that touched them.
+  //
+  // Small resizes aren't worth starting threads for, and just call resize(). If a constructor throws, every new element
+  // that was constructed is destroyed again, the size is left as it was, and the exception is rethrown.
+  void resize(size_type new_count, pinned_parallel_tag, unsigned thread_count = 0)
+  {
+    constexpr size_t min_bytes_per_thread = 16 * 1024 * 1024;
+
+    if (thread_count == 0)
+      thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+    size_t new_bytes = new_count > count ? (new_count - count) * sizeof(T) : 0;
+    thread_count = unsigned(std::min<size_t>(thread_count, new_bytes / min_bytes_per_thread));
+    if (thread_count <= 1)
+    {
+      resize(new_count);
+      return;
+    }
+
+    grow_for(new_count);
+
+    // Slices start on page boundaries (as near as whole elements allow), so threads don't fault in each other's pages
+    size_t page_elements = std::max<size_t>(1, pinned_page_size() / sizeof(T));
+    size_t per_thread = ((new_count - count) / thread_count + page_elements - 1) / page_elements * page_elements;
+
+    std::vector<std::thread> threads;
+    std::vector<size_t> constructed(thread_count, 0);
+    std::vector<std::exception_ptr> errors(thread_count);
+
+    for (unsigned t = 0; t < thread_count; t++)
+    {
+      size_t first = std::min(count + t * per_thread, new_count);
+      size_t last = std::min(first + per_thread, new_count);
+      if (t == thread_count - 1)
+        last = new_count;
+
+      auto work = [this, t, first, last, &constructed, &errors]()
+      {
+        try
+        {
+          construct_range(first, last, constructed[t]);
+        }
+        catch (...)
+        {
+          errors[t] = std::current_exception();
+        }
+      };
+
+      try
+      {
+        threads.emplace_back(work);
+      }
+      catch (...)
+      {
+        // Couldn't start another thread, so do this slice here
+        work();
+      }
+    }
+
+    for (std::thread& thread : threads)
+      thread.join();
+
+    for (unsigned t = 0; t < thread_count; t++)
+    {
+      if (errors[t])
+      {
+        // Each slice constructs from the front, so constructed[t] elements from its start are alive
+        if constexpr (!std::is_trivially_destructible<T>::value)
+        {
+          for (unsigned u = 0; u < thread_count; u++)
+          {
+            size_t first = std::min(count + u * per_thread, new_count);
+            for (size_t i = first; i < first + constructed[u]; i++)
+              data()[i].~T();
+          }
+        }
+
+        high_water = std::max(high_water, new_count);
+        std::rethrow_exception(errors[t]);
+      }
+    }
+
+    count = new_count;
+  }
+
+  // Like resize(), but leaves any new elements uninitialised (well, they're zero if that memory was never used before,
+  // but don't count on it), for when you're about to overwrite them anyway, eg by reading a file into them.
+  void resize_uninitialized(size_type new_count)
+  {
+    static_assert(std::is_trivial<T>::value, "resize_uninitialized() only makes sense for trivial types");
+
+    if (new_count > count)
+      grow_for(new_count);
+    else
+      high_water = std::max(high_water, count);
+
+    count = new_count;
+  }
+
+  // Only for shared vectors, makes everything up to the current size visible to pinned_shared_views
+  void publish() noexcept
+  {
+    pinned_set_length(count * sizeof(T), &allocation);
+  }
+
+  // A read-only copy of the vector as it is right now, which costs a few mmap() calls instead of copying anything, see
+  // pinned_snapshot(). Only for shared and file backed vectors. While any snapshot is alive, shrinking the vector's
+  // memory (shrink_to_fit()), sync() and taking another snapshot throw.
+  pinned_snapshot_view<T> snapshot()
+  {
+    pinned_alloc_info snapshot_allocation;
+    int err = pinned_snapshot(&allocation, &snapshot_allocation);
+    if (err != 0)
+      throw std::system_error(err, std::system_category());
+    return pinned_snapshot_view<T>(snapshot_allocation, count);
+  }
+
+  // Only for file backed vectors, makes sure everything up to now is on disk
+  void sync()
+  {
+    int err = pinned_sync(count * sizeof(T), &allocation);
+    if (err != 0)
+      throw std::system_error(err, std::system_category());
+  }
+
+  // Move other's elements from first on to the end of this vector. For trivially copyable types, when both the end of
+  // this vector and first fall on a page boundary (multiples of pinned_page_size() bytes in), the pages holding them are
+  // moved over with pinned_move_pages() instead of being copied, so concatenating or splitting huge vectors at page
+  // boundaries only costs some page table updates. Otherwise the elements are copied (or moved one by one, for other
+  // types). Either way other is left with first elements.
+  void splice(pinned_vec& other, size_type first = 0)
+  {
+    if (first > other.count)
+      throw std::out_of_range("out of range");
+    if (&other == this || first == other.count)
+      return;
+
+    size_t moving = other.count - first;
+    reserve(count + moving);
+
+    if constexpr (std::is_trivially_copyable<T>::value)
+    {
+      size_t page_size = pinned_page_size();
+      size_t offset = count * sizeof(T);
+      size_t source_offset = first * sizeof(T);
+
+      if (offset % page_size == 0 && source_offset % page_size == 0 && !allocation.backing && !other.allocation.backing)
+      {
+        // The last page can have bytes past other's end, which come along too
+        size_t length = ((moving * sizeof(T) + page_size - 1) / page_size) * page_size;
+        int err = pinned_move_pages(&allocation, offset, &other.allocation, source_offset, length);
+        if (err != 0)
+          throw std::system_error(err, std::system_category());
+
+        high_water = std::max(high_water, (offset + length + sizeof(T) - 1) / sizeof(T));
+        count += moving;
+        other.shrink_count(first);
+        return;
+      }
+
+      memcpy(data() + count, other.data() + first, moving * sizeof(T));
+      count += moving;
+    }
+    else
+    {
+      for (size_t i = first; i < other.count; i++, count++)
+        new (&data()[count]) T(std::move(other.data()[i]));
+    }
+
+    other.shrink_count(first);
+  }
+
+  // Called after the vector has moved to a new reservation, with where the elements were and where they are now
+  using relocate_callback = void (*)(T* old_data, T* new_data, void* user);
+
+  // Lets the vector grow past max_size(): instead of throwing std::bad_alloc, it moves to a reservation at least twice
+  // as big with pinned_relocate(), and calls callback. That's the one time pointers and iterators into a pinned_vec are
+  // invalidated, so callback is where the owner updates whatever holds them. Since the address space only grows when it
+  // has to, vectors that are usually small but occasionally huge can start with a small max_size instead of
+  // PINNED_MAXSIZE_HUGE. Elements are moved without running their move constructors, so T has to be trivially copyable,
+  // and it doesn't work for file backed or shared vectors. Pass nullptr to go back to throwing.
+  void on_relocate(relocate_callback callback, void* user = nullptr) noexcept
+  {
+    static_assert(std::is_trivially_copyable<T>::value, "only vectors of trivially copyable types can be relocated");
+    relocate_handler = callback;
+    relocate_user = user;
+  }
+
+  void swap(pinned_vec& other) noexcept
+  {
+    std::swap(allocation, other.allocation);
+    std::swap(count, other.count);
+    std::swap(high_water, other.high_water);
+    std::swap(relocate_handler, other.relocate_handler);
+    std::swap(relocate_user, other.relocate_user);
+  }
+
+private:
+  // Move to a reservation with room for needed elements, doubling max_size so a vector that keeps on growing only
+  // relocates a few times
+  void relocate(size_t needed)
+  {
+    if (needed > size_t(-1) / 2 / sizeof(T))
+      throw std::bad_alloc();
+
+    size_t new_max_size = std::max(allocation.max_size, pinned_page_size());
+    while (new_max_size < needed * sizeof(T))
+      new_max_size *= 2;
+
+    if (!allocation.data)
+    {
+      // Moved from, reserve() reserves this much when it gets to it
+      allocation.max_size = new_max_size;
+      return;
+    }
+
+    T* old_data = data();
+    if (pinned_relocate(new_max_size, &allocation) != 0)
+      throw std::bad_alloc();
+    relocate_handler(old_data, data(), relocate_user);
+  }
+
+  // Whether grow_for(needed) will move everything to a new reservation, so that references into the vector that were
+  // passed in have to be copied first
+  bool will_relocate(size_t needed) const noexcept
+  {
+    return needed > capacity() && needed > max_size() && relocate_handler;
+  }
+
+  void grow_for(size_t needed)
+  {
+    if (needed <= capacity())
+      return;
+
+    if (needed > max_size() && relocate_handler)
+      relocate(needed);
+
+    // Up to max_size, as long as needed fits in it
+    size_t bytes = std::min<size_t>(Growth::next_size(allocation.size, needed * sizeof(T)), allocation.max_size);
+    reserve(std::max(bytes / sizeof(T), needed));
+  }
+
+  // Value-initialise [first, last), which is past count. constructed counts the elements constructed so far, so the
+  // caller knows what to destroy if a constructor throws.
+  void construct_range(size_t first, size_t last, size_t& constructed)
+  {
+    if constexpr (std::is_trivial<T>::value)
+    {
+      // Only what we left behind the last time the vector shrank needs zeroing, the rest is still zero from being committed
+      size_t dirty_end = std::min(std::max(high_water, first), last);
+      if (dirty_end > first)
+        memset(data() + first, 0, (dirty_end - first) * sizeof(T));
+
+      int err = pinned_prefault(first * sizeof(T), (last - first) * sizeof(T), &allocation);
+      if (err != 0)
+        throw std::system_error(err, std::system_category());
+      constructed = last - first;
+    }
+    else
+    {
+      for (size_t i = first; i < last; i++, constructed++)
+        new (&data()[i]) T();
+    }
+  }
+
+  void shrink_count(size_t new_count)
+  {
+    if constexpr (!std::is_trivially_destructible<T>::value)
     {
       for (size_type i = new_count; i < count; i++)
         data()[i].~T();
-      count = new_count;
     }
+
+    high_water = std::max(high_water, count);
+    count = new_count;
   }
 
-  void swap(pinned_vec& other) noexcept
+  // Copy to_add_count elements from first into the gap insert() just opened up at index
+  template<class InputIt>
+  void copy_into_gap(size_t index, size_t to_add_count, InputIt first)
+  {
+    T* destination = data() + index;
+
+    if constexpr (std::is_pointer<InputIt>::value && std::is_same<typename std::remove_cv<typename std::remove_pointer<InputIt>::type>::type, T>::value)
+    {
+      const T* source = first;
+
+      std::less<const T*> less;
+      if (!less(source, data()) && less(source, data() + count))
+      {
+        // Inserting part of ourselves. Everything from index on has just been shifted up by to_add_count,
+        // so copy whatever was before the gap as-is, and the rest from where it moved to.
+        size_t source_index = size_t(source - data());
+        size_t before_gap = source_index < index ? std::min(to_add_count, index - source_index) : 0;
+
+        memmove(destination, data() + source_index, before_gap * sizeof(T));
+        memcpy(destination + before_gap, data() + std::max(source_index, index) + to_add_count, (to_add_count - before_gap) * sizeof(T));
+      }
+      else
+      {
+        memcpy(destination, source, to_add_count * sizeof(T));
+      }
+    }
+    else
+    {
+      for (size_t i = 0; i < to_add_count; ++i, ++first)
+        new (&destination[i]) T(*first);
+    }
+  }
+
+  pinned_alloc_info allocation = {};
+  size_t count = 0;
+
+  // The biggest count has been since the memory was committed. Everything past max(count, high_water) is still zero.
+  size_t high_water = 0;
+
+  relocate_callback relocate_handler = nullptr;
+  void* relocate_user = nullptr;
+};
+
+// Read-only view of a shared pinned_vec owned by another process, see pinned_attach()
+template <typename T>
+class pinned_shared_view
+{
+public:
+  using value_type = T;
+  using size_type = size_t;
+  using const_reference = const T&;
+  using const_pointer = const T*;
+  using const_iterator = const T*;
+
+  static_assert(std::is_trivially_copyable<T>::value, "shared pinned_vecs can only hold trivially copyable types");
+
+  // Takes ownership of fd
+  explicit pinned_shared_view(int fd)
+  {
+    int err = pinned_attach(fd, &allocation);
+    if (err != 0)
+      throw std::system_error(err, std::system_category());
+  }
+
+  pinned_shared_view(const pinned_shared_view&) = delete;
+  pinned_shared_view& operator=(const pinned_shared_view&) = delete;
+
+  ~pinned_shared_view()
+  {
+    pinned_free(&allocation);
+  }
+
+  // Picks up whatever the owner has published since the last call. Elements that were already visible never move.
+  size_type refresh()
+  {
+    size_t length = pinned_get_length(&allocation);
+    if (length > allocation.size)
+    {
+      int err = pinned_refresh(&allocation);
+      if (err != 0)
+        throw std::system_error(err, std::system_category());
+    }
+
+    count = std::min(length, allocation.size) / sizeof(T);
+    return count;
+  }
+
+  const_reference operator[](size_type pos) const { return data()[pos]; }
+  const_pointer data() const noexcept { return reinterpret_cast<const T*>(allocation.data); }
+
+  const_iterator begin() const noexcept { return data(); }
+  const_iterator end() const noexcept { return data() + count; }
+
+  bool empty() const noexcept { return count == 0; }
+  size_type size() const noexcept { return count; }
+
+private:
+  pinned_alloc_info allocation = {};
+  size_t count = 0;
+};
+
+// A snapshot of a pinned_vec, from pinned_vec::snapshot(). It can be moved to another thread, to serialise it in the
+// background say, and it stays valid after the vector is destroyed.
+template <typename T>
+class pinned_snapshot_view
+{
+public:
+  using value_type = T;
+  using size_type = size_t;
+  using const_reference = const T&;
+  using const_pointer = const T*;
+  using const_iterator = const T*;
+
+  // Takes ownership of a snapshot from pinned_snapshot(), of which the first count elements are in use
+  pinned_snapshot_view(const pinned_alloc_info& snapshot, size_t count) : allocation(snapshot), count(count) {}
+
+  pinned_snapshot_view(pinned_snapshot_view&& other) noexcept : allocation(other.allocation), count(other.count)
+  {
+    other.allocation.data = nullptr;
+    other.count = 0;
+  }
+
+  pinned_snapshot_view& operator=(pinned_snapshot_view&& other) noexcept
   {
     std::swap(allocation, other.allocation);
     std::swap(count, other.count);
+    return *this;
+  }
+
+  pinned_snapshot_view(const pinned_snapshot_view&) = delete;
+  pinned_snapshot_view& operator=(const pinned_snapshot_view&) = delete;
+
+  ~pinned_snapshot_view()
+  {
+    if (allocation.data)
+      pinned_free(&allocation);
   }
 
+  const_reference operator[](size_type pos) const { return data()[pos]; }
+  const_pointer data() const noexcept { return reinterpret_cast<const T*>(allocation.data); }
+
+  const_iterator begin() const noexcept { return data(); }
+  const_iterator end() const noexcept { return data() + count; }
+
+  bool empty() const noexcept { return count == 0; }
+  size_type size() const noexcept { return count; }
+
 private:
   pinned_alloc_info allocation = {};
   size_t count = 0;
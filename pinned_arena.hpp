@@ -0,0 +1,179 @@
+#pragma once
+#include "pinned.h"
+#include <cstdint>
+#include <memory_resource>
+
+// A bump allocator on a pinned allocation, for scratch memory that all goes away at once (per request, per frame, etc).
+// Allocating is a pointer bump, plus a pinned_realloc() now and then to commit more pages, and since the memory never
+// moves, nothing allocated from it is ever invalidated by later allocations. There's no freeing individual allocations:
+// instead you take a mark() and rewind() to it later, which throws away everything allocated since in O(1).
+//
+//  pinned_arena arena;
+//
+//  void handle(request& r)
+//  {
+//    pinned_arena::scope scope(arena); // rewinds when it goes out of scope
+//    char* buffer = (char*)arena.allocate(r.size);
+//    ...
+//  }
+//
+// Rewinding keeps the pages committed by default, so the next request doesn't fault them in again. If the occasional
+// huge request shouldn't leave the process holding onto its memory forever, pass a retain_bytes limit to the
+// constructor, and anything committed above that is given back to the OS whenever the arena rewinds below it.
+//
+// pinned_arena_resource adapts an arena to std::pmr::memory_resource, so std::pmr containers can allocate from it.
+// Deallocating through it does nothing, the memory comes back when the arena is rewound. Like the rest of pinned_vec,
+// none of this is thread safe.
+
+class pinned_arena
+{
+public:
+  struct marker
+  {
+    size_t offset = 0;
+  };
+
+  // Takes a mark() when it's created, and rewinds to it when it's destroyed
+  class scope
+  {
+  public:
+    explicit scope(pinned_arena& arena) : arena(arena), start(arena.mark()) {}
+    scope(const scope&) = delete;
+    scope& operator=(const scope&) = delete;
+    ~scope() { arena.rewind(start); }
+
+  private:
+    pinned_arena& arena;
+    marker start;
+  };
+
+  explicit pinned_arena(size_t max_size = PINNED_MAXSIZE_NORMAL, size_t retain_bytes = SIZE_MAX) : retain_bytes(retain_bytes)
+  {
+    if (pinned_alloc(0, max_size, &allocation) != 0)
+      throw std::bad_alloc();
+  }
+
+  pinned_arena(const pinned_arena&) = delete;
+  pinned_arena& operator=(const pinned_arena&) = delete;
+
+  ~pinned_arena()
+  {
+    pinned_free(&allocation);
+  }
+
+  // alignment has to be a power of 2, and no bigger than the page size
+  void* allocate(size_t bytes, size_t alignment = alignof(std::max_align_t))
+  {
+    size_t start = (position + alignment - 1) & ~(alignment - 1);
+    if (bytes > allocation.max_size - std::min(start, allocation.max_size))
+      throw std::bad_alloc();
+
+    size_t end = start + bytes;
+    if (end > allocation.size)
+      commit(end);
+
+    position = end;
+    high_water = std::max(high_water, end);
+    return static_cast<char*>(allocation.data) + start;
+  }
+
+  // Uninitialised space for count Ts
+  template <typename T>
+  T* allocate_array(size_t count)
+  {
+    if (count > allocation.max_size / sizeof(T))
+      throw std::bad_alloc();
+    return static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+  }
+
+  // Nothing calls the destructor, so this is for trivially destructible types, or ones you destroy yourself
+  template <typename T, class... Args>
+  T* create(Args&&... args)
+  {
+    return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args) ...);
+  }
+
+  marker mark() const noexcept
+  {
+    marker result;
+    result.offset = position;
+    return result;
+  }
+
+  // Throw away everything allocated since the mark was taken
+  void rewind(marker to) noexcept
+  {
+    position = to.offset;
+    if (allocation.size > retain_bytes && position <= retain_bytes)
+      decommit_above(retain_bytes);
+  }
+
+  void reset() noexcept
+  {
+    rewind(marker());
+  }
+
+  // Give back every committed page that isn't holding a live allocation right now
+  void trim() noexcept
+  {
+    decommit_above(position);
+  }
+
+  // Bytes currently allocated (including alignment padding)
+  size_t used() const noexcept { return position; }
+  // Bytes of pages committed
+  size_t committed() const noexcept { return allocation.size; }
+  // Most bytes that were ever allocated at once
+  size_t peak() const noexcept { return high_water; }
+  size_t max_size() const noexcept { return allocation.max_size; }
+
+private:
+  void commit(size_t needed)
+  {
+    // Grow by doubling (at least 64KiB), so we don't call into the OS on every page
+    size_t new_size = std::max(needed, std::max<size_t>(allocation.size * 2, 64 * 1024));
+    new_size = std::min(new_size, allocation.max_size);
+
+    if (pinned_realloc(new_size, &allocation) != 0)
+      throw std::bad_alloc();
+  }
+
+  void decommit_above(size_t offset) noexcept
+  {
+    // If shrinking fails, the pages just stay committed (and allocation.size with them) until the next try
+    if (offset < allocation.size)
+      pinned_realloc(offset, &allocation);
+  }
+
+  pinned_alloc_info allocation = {};
+  size_t position = 0;
+  size_t high_water = 0;
+  size_t retain_bytes;
+};
+
+class pinned_arena_resource : public std::pmr::memory_resource
+{
+public:
+  explicit pinned_arena_resource(pinned_arena& arena) noexcept : arena(arena) {}
+
+  pinned_arena& get_arena() const noexcept { return arena; }
+
+private:
+  void* do_allocate(size_t bytes, size_t alignment) override
+  {
+    return arena.allocate(bytes, alignment);
+  }
+
+  void do_deallocate(void*, size_t, size_t) override
+  {
+    // Nothing to do, it's all freed when the arena rewinds
+  }
+
+  bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+  {
+    const pinned_arena_resource* other_arena = dynamic_cast<const pinned_arena_resource*>(&other);
+    return other_arena && &other_arena->arena == &arena;
+  }
+
+  pinned_arena& arena;
+};
@@ -0,0 +1,608 @@
+#pragma once
+#include "pinned.h"
+#include <cstdint>
+#include <tuple>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# define PINNED_HASH_MAP_SSE2
+# include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+# include <intrin.h>
+#endif
+
+// A hash map for really big tables, where std::unordered_map's allocation per node and a flat table's stop-the-world
+// rehash (which has to allocate a second table and copy everything) both hurt.
+//
+// The entries live in a pinned reservation of their own, and are never moved once they're inserted, so pointers and
+// references to them (and iterators) stay valid until that entry is erased, no matter how much the map grows. Erased
+// entries are reused by later inserts.
+//
+// Finding entries goes through a separate index, a flat open addressing table of entry numbers, with a byte of control
+// data per bucket holding 7 bits of the hash, probed 16 buckets at a time (with SSE2 where we have it). When the index
+// fills up, a bigger one is started in a second reservation, and every insert after that moves a slice of the old index
+// over into it, so the cost of rehashing is spread over the inserts instead of landing on one of them. Lookups check both
+// indices until the move is done. The two index reservations take turns, so after the first few inserts nothing here
+// ever calls mmap(), just pinned_realloc().
+//
+//  pinned_hash_map<uint64_t, record> map;
+//  record& r = map[key];
+//  map.insert({ other_key, other_record }); // r is still valid
+//
+// Iteration order is the order of entries in the entry reservation, which is insertion order until something is erased.
+
+template <typename K, typename V, typename Hash = std::hash<K>, typename KeyEqual = std::equal_to<K>>
+class pinned_hash_map
+{
+public:
+  using key_type = K;
+  using mapped_type = V;
+  using value_type = std::pair<const K, V>;
+  using size_type = size_t;
+  using difference_type = ptrdiff_t;
+  using hasher = Hash;
+  using key_equal = KeyEqual;
+  using reference = value_type&;
+  using const_reference = const value_type&;
+  using pointer = value_type*;
+  using const_pointer = const value_type*;
+
+  template <bool Const>
+  class iterator_t
+  {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = pinned_hash_map::value_type;
+    using difference_type = ptrdiff_t;
+    using pointer = typename std::conditional<Const, const value_type*, value_type*>::type;
+    using reference = typename std::conditional<Const, const value_type&, value_type&>::type;
+    using map_pointer = typename std::conditional<Const, const pinned_hash_map*, pinned_hash_map*>::type;
+
+    iterator_t() = default;
+    template <bool OtherConst, typename = typename std::enable_if<Const && !OtherConst>::type>
+    iterator_t(const iterator_t<OtherConst>& other) : map(other.map), index(other.index) {}
+
+    reference operator*() const { return map->entries()[index]; }
+    pointer operator->() const { return &map->entries()[index]; }
+
+    iterator_t& operator++()
+    {
+      index++;
+      skip_erased();
+      return *this;
+    }
+
+    iterator_t operator++(int)
+    {
+      iterator_t old = *this;
+      ++*this;
+      return old;
+    }
+
+    bool operator==(const iterator_t& other) const { return index == other.index; }
+    bool operator!=(const iterator_t& other) const { return index != other.index; }
+
+  private:
+    friend class pinned_hash_map;
+    template <bool> friend class iterator_t;
+
+    iterator_t(map_pointer map, size_t index) : map(map), index(index)
+    {
+      skip_erased();
+    }
+
+    void skip_erased()
+    {
+      while (index < map->entry_count && !map->is_live(index))
+        index++;
+    }
+
+    map_pointer map = nullptr;
+    size_t index = 0;
+  };
+
+  using iterator = iterator_t<false>;
+  using const_iterator = iterator_t<true>;
+
+  explicit pinned_hash_map(size_t max_size = PINNED_MAXSIZE_NORMAL)
+  {
+    size_t max_entries = max_size / sizeof(value_type);
+    max_buckets = bucket_count_for(max_entries * 2);
+
+    bool ok = pinned_alloc(0, max_entries * sizeof(value_type), &entries_alloc) == 0;
+    ok = ok && pinned_alloc(0, max_entries * sizeof(uint64_t), &hashes_alloc) == 0;
+    for (index_table& table : tables)
+    {
+      ok = ok && pinned_alloc(0, max_buckets, &table.control) == 0;
+      ok = ok && pinned_alloc(0, max_buckets * sizeof(size_t), &table.slots) == 0;
+    }
+
+    if (!ok)
+    {
+      free_allocations();
+      throw std::bad_alloc();
+    }
+  }
+
+  pinned_hash_map(const pinned_hash_map&) = delete;
+  pinned_hash_map& operator=(const pinned_hash_map&) = delete;
+
+  ~pinned_hash_map()
+  {
+    clear();
+    free_allocations();
+  }
+
+  iterator begin() noexcept { return iterator(this, 0); }
+  const_iterator begin() const noexcept { return const_iterator(this, 0); }
+  const_iterator cbegin() const noexcept { return begin(); }
+
+  iterator end() noexcept { return iterator(this, entry_count); }
+  const_iterator end() const noexcept { return const_iterator(this, entry_count); }
+  const_iterator cend() const noexcept { return end(); }
+
+  bool empty() const noexcept { return live_count == 0; }
+  size_type size() const noexcept { return live_count; }
+  size_type max_size() const noexcept { return entries_alloc.max_size / sizeof(value_type); }
+
+  // Buckets in the index new entries go into
+  size_type bucket_count() const noexcept { return tables[current].bucket_count; }
+
+  // True while entries are still being moved from an old index to a bigger one
+  bool is_rehashing() const noexcept { return rehashing; }
+
+  iterator find(const K& key)
+  {
+    return iterator(this, find_entry(key, hash_of(key)));
+  }
+
+  const_iterator find(const K& key) const
+  {
+    return const_iterator(this, find_entry(key, hash_of(key)));
+  }
+
+  size_type count(const K& key) const { return find_entry(key, hash_of(key)) != entry_count ? 1 : 0; }
+  bool contains(const K& key) const { return count(key) != 0; }
+
+  V& at(const K& key)
+  {
+    size_t entry = find_entry(key, hash_of(key));
+    if (entry == entry_count)
+      throw std::out_of_range("key not found");
+    return entries()[entry].second;
+  }
+
+  const V& at(const K& key) const
+  {
+    size_t entry = find_entry(key, hash_of(key));
+    if (entry == entry_count)
+      throw std::out_of_range("key not found");
+    return entries()[entry].second;
+  }
+
+  V& operator[](const K& key) { return try_emplace(key).first->second; }
+  V& operator[](K&& key) { return try_emplace(std::move(key)).first->second; }
+
+  template<class... Args>
+  std::pair<iterator, bool> try_emplace(const K& key, Args&&... args)
+  {
+    return emplace_key(key, std::forward<Args>(args) ...);
+  }
+
+  template<class... Args>
+  std::pair<iterator, bool> try_emplace(K&& key, Args&&... args)
+  {
+    return emplace_key(std::move(key), std::forward<Args>(args) ...);
+  }
+
+  std::pair<iterator, bool> insert(const value_type& value)
+  {
+    return emplace_key(value.first, value.second);
+  }
+
+  template <class M>
+  std::pair<iterator, bool> insert_or_assign(const K& key, M&& value)
+  {
+    std::pair<iterator, bool> result = emplace_key(key, std::forward<M>(value));
+    if (!result.second)
+      result.first->second = std::forward<M>(value);
+    return result;
+  }
+
+  size_type erase(const K& key)
+  {
+    uint64_t hash = hash_of(key);
+    index_table* table = &tables[current];
+    size_t bucket = find_bucket(*table, key, hash);
+    if (bucket == no_bucket && rehashing)
+    {
+      table = &tables[1 - current];
+      bucket = find_bucket(*table, key, hash);
+    }
+    if (bucket == no_bucket)
+      return 0;
+
+    size_t entry = slots(*table)[bucket];
+    erase_bucket(*table, bucket);
+    entries()[entry].~value_type();
+    free_entry(entry);
+    live_count--;
+    return 1;
+  }
+
+  // Entries don't move, so the iterator after pos is still valid
+  iterator erase(const_iterator pos)
+  {
+    size_t index = pos.index;
+    erase(entries()[index].first);
+    return iterator(this, index + 1);
+  }
+
+  void clear() noexcept
+  {
+    for (size_t i = 0; i < entry_count; i++)
+    {
+      if (is_live(i))
+        entries()[i].~value_type();
+    }
+
+    entry_count = 0;
+    live_count = 0;
+    free_head = no_entry;
+
+    if (rehashing)
+      release_table(tables[1 - current]);
+    rehashing = false;
+
+    index_table& table = tables[current];
+    memset(table.control.data, control_empty, table.bucket_count);
+    table.used = 0;
+  }
+
+  // Makes room for count entries up front, including the index, so inserting that many never has to rehash
+  void reserve(size_type count)
+  {
+    if (count > max_size())
+      throw std::bad_alloc();
+
+    if (count > entry_capacity())
+      grow_entries(count);
+
+    if (count > max_load(tables[current]))
+    {
+      start_rehash(count);
+      if (rehashing)
+        rehash_step(SIZE_MAX);
+    }
+  }
+
+private:
+  static constexpr size_t group_size = 16;
+  // Empty is 0 so that freshly committed pages are an empty index, and starting a new one doesn't have to touch it all
+  static constexpr uint8_t control_empty = 0x00;
+  static constexpr uint8_t control_erased = 0x01;
+  static constexpr uint8_t control_full = 0x80; // | the low 7 bits of the entry's hash
+
+  // Entries that aren't in use have this set in their hash, and the rest of it is the next entry in the free list
+  static constexpr uint64_t erased_bit = 1ULL << 63;
+  static constexpr size_t no_entry = size_t(~erased_bit);
+  static constexpr size_t no_bucket = SIZE_MAX;
+
+  struct index_table
+  {
+    pinned_alloc_info control = {};
+    pinned_alloc_info slots = {}; // entry number for each full bucket
+    size_t bucket_count = 0;
+    size_t used = 0; // full and erased buckets, as both make probe sequences longer
+  };
+
+  value_type* entries() noexcept { return reinterpret_cast<value_type*>(entries_alloc.data); }
+  const value_type* entries() const noexcept { return reinterpret_cast<const value_type*>(entries_alloc.data); }
+  uint64_t* hashes() noexcept { return reinterpret_cast<uint64_t*>(hashes_alloc.data); }
+  const uint64_t* hashes() const noexcept { return reinterpret_cast<const uint64_t*>(hashes_alloc.data); }
+
+  static uint8_t* control(index_table& table) noexcept { return reinterpret_cast<uint8_t*>(table.control.data); }
+  static const uint8_t* control(const index_table& table) noexcept { return reinterpret_cast<const uint8_t*>(table.control.data); }
+  static size_t* slots(index_table& table) noexcept { return reinterpret_cast<size_t*>(table.slots.data); }
+  static const size_t* slots(const index_table& table) noexcept { return reinterpret_cast<const size_t*>(table.slots.data); }
+
+  static uint8_t full_control(uint64_t hash) noexcept { return uint8_t(control_full | (hash & 0x7F)); }
+
+  bool is_live(size_t entry) const noexcept { return (hashes()[entry] & erased_bit) == 0; }
+
+  size_t entry_capacity() const noexcept
+  {
+    return std::min(entries_alloc.size / sizeof(value_type), hashes_alloc.size / sizeof(uint64_t));
+  }
+
+  static size_t max_load(const index_table& table) noexcept { return table.bucket_count / 8 * 7; }
+
+  static size_t bucket_count_for(size_t entry_count) noexcept
+  {
+    size_t count = group_size;
+    while (count / 8 * 7 < entry_count)
+      count *= 2;
+    return count;
+  }
+
+  uint64_t hash_of(const K& key) const
+  {
+    // std::hash is the identity for integers on most standard libraries, so mix it up a bit before we take bits off
+    // both ends of it
+    uint64_t hash = uint64_t(hash_function(key)) * 0x9E3779B97F4A7C15ULL;
+    hash ^= hash >> 32;
+    return hash & ~erased_bit;
+  }
+
+  // Bitmask of the buckets in the group at group_control with the control byte value
+  static uint32_t match(const uint8_t* group_control, uint8_t value) noexcept
+  {
+#ifdef PINNED_HASH_MAP_SSE2
+    __m128i group = _mm_load_si128(reinterpret_cast<const __m128i*>(group_control));
+    return uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(char(value)))));
+#else
+    uint32_t result = 0;
+    for (size_t i = 0; i < group_size; i++)
+      result |= uint32_t(group_control[i] == value) << i;
+    return result;
+#endif
+  }
+
+  static size_t lowest_bit(uint32_t mask) noexcept
+  {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return index;
+#else
+    return size_t(__builtin_ctz(mask));
+#endif
+  }
+
+  // Probe sequence over whole groups. Triangular steps visit every group, since the group count is a power of 2.
+  template <typename Func>
+  static void probe(const index_table& table, uint64_t hash, Func&& func)
+  {
+    size_t group_mask = table.bucket_count / group_size - 1;
+    size_t group = size_t(hash >> 7) & group_mask;
+    for (size_t step = 1; !func(group * group_size); step++)
+      group = (group + step) & group_mask;
+  }
+
+  size_t find_bucket(const index_table& table, const K& key, uint64_t hash) const
+  {
+    if (table.bucket_count == 0)
+      return no_bucket;
+
+    size_t result = no_bucket;
+    probe(table, hash, [&](size_t group_start)
+    {
+      const uint8_t* group_control = control(table) + group_start;
+      for (uint32_t matches = match(group_control, full_control(hash)); matches != 0; matches &= matches - 1)
+      {
+        size_t bucket = group_start + lowest_bit(matches);
+        size_t entry = slots(table)[bucket];
+        if (hashes()[entry] == hash && key_eq(entries()[entry].first, key))
+        {
+          result = bucket;
+          return true;
+        }
+      }
+
+      // An empty bucket means the key would have gone in this group, so it's not anywhere further on either
+      return match(group_control, control_empty) != 0;
+    });
+
+    return result;
+  }
+
+  // Returns entry_count if it's not there
+  size_t find_entry(const K& key, uint64_t hash) const
+  {
+    size_t bucket = find_bucket(tables[current], key, hash);
+    if (bucket != no_bucket)
+      return slots(tables[current])[bucket];
+
+    if (rehashing)
+    {
+      bucket = find_bucket(tables[1 - current], key, hash);
+      if (bucket != no_bucket)
+        return slots(tables[1 - current])[bucket];
+    }
+
+    return entry_count;
+  }
+
+  // The caller makes sure the entry isn't in there already, and that there's room
+  static void insert_bucket(index_table& table, uint64_t hash, size_t entry) noexcept
+  {
+    probe(table, hash, [&](size_t group_start)
+    {
+      uint8_t* group_control = control(table) + group_start;
+      uint32_t available = match(group_control, control_empty) | match(group_control, control_erased);
+      if (available == 0)
+        return false;
+
+      size_t bucket = group_start + lowest_bit(available);
+      if (control(table)[bucket] == control_empty)
+        table.used++;
+
+      control(table)[bucket] = full_control(hash);
+      slots(table)[bucket] = entry;
+      return true;
+    });
+  }
+
+  static void erase_bucket(index_table& table, size_t bucket) noexcept
+  {
+    // If the group still has an empty bucket, no probe sequence ever went past it, so this one can go straight back to
+    // empty instead of leaving a marker behind
+    uint8_t* group_control = control(table) + (bucket / group_size) * group_size;
+    if (match(group_control, control_empty) != 0)
+    {
+      control(table)[bucket] = control_empty;
+      table.used--;
+    }
+    else
+    {
+      control(table)[bucket] = control_erased;
+    }
+  }
+
+  template <class KeyArg, class... Args>
+  std::pair<iterator, bool> emplace_key(KeyArg&& key, Args&&... args)
+  {
+    uint64_t hash = hash_of(key);
+    size_t existing = find_entry(key, hash);
+    if (existing != entry_count)
+      return { iterator(this, existing), false };
+
+    if (rehashing)
+      rehash_step(rehash_budget);
+
+    if (tables[current].used + 1 > max_load(tables[current]))
+      start_rehash((live_count + 1) * 2);
+
+    size_t entry = allocate_entry();
+    try
+    {
+      new (&entries()[entry]) value_type(std::piecewise_construct, std::forward_as_tuple(std::forward<KeyArg>(key)),
+                                         std::forward_as_tuple(std::forward<Args>(args) ...));
+    }
+    catch (...)
+    {
+      free_entry(entry);
+      throw;
+    }
+
+    hashes()[entry] = hash;
+    insert_bucket(tables[current], hash, entry);
+    live_count++;
+
+    return { iterator(this, entry), true };
+  }
+
+  size_t allocate_entry()
+  {
+    if (free_head != no_entry)
+    {
+      size_t entry = free_head;
+      free_head = size_t(hashes()[entry] & ~erased_bit);
+      return entry;
+    }
+
+    if (entry_count == entry_capacity())
+      grow_entries(std::max<size_t>(entry_count * 2, 1));
+
+    return entry_count++;
+  }
+
+  void free_entry(size_t entry) noexcept
+  {
+    hashes()[entry] = erased_bit | free_head;
+    free_head = entry;
+  }
+
+  void grow_entries(size_t new_cap)
+  {
+    new_cap = std::min(new_cap, max_size());
+    if (new_cap <= entry_count ||
+        pinned_realloc(new_cap * sizeof(value_type), &entries_alloc) != 0 ||
+        pinned_realloc(new_cap * sizeof(uint64_t), &hashes_alloc) != 0)
+    {
+      throw std::bad_alloc();
+    }
+  }
+
+  // Switch to a new index big enough for entry_count entries, which the old one is moved into a bit at a time
+  void start_rehash(size_t entry_count)
+  {
+    if (rehashing)
+      rehash_step(SIZE_MAX);
+
+    size_t new_bucket_count = bucket_count_for(entry_count);
+    index_table& next = tables[1 - current];
+    if (new_bucket_count > max_buckets ||
+        pinned_realloc(new_bucket_count, &next.control) != 0 ||
+        pinned_realloc(new_bucket_count * sizeof(size_t), &next.slots) != 0)
+    {
+      throw std::bad_alloc();
+    }
+
+    // next was released when the last rehash finished, so it's already zeroed, which is empty
+    next.bucket_count = new_bucket_count;
+    next.used = 0;
+
+    index_table& old = tables[current];
+    current = 1 - current;
+    rehashing = old.bucket_count != 0;
+    rehash_position = 0;
+
+    // Move enough buckets per insert to be done by the time half of the new index's spare room is used up, so it
+    // can never fill up before the old one is empty
+    size_t spare_room = max_load(next) - live_count;
+    rehash_budget = std::max<size_t>(group_size * 4, old.bucket_count / std::max<size_t>(spare_room / 2, 1) + 1);
+  }
+
+  void rehash_step(size_t bucket_budget) noexcept
+  {
+    index_table& old = tables[1 - current];
+    size_t end = bucket_budget >= old.bucket_count - rehash_position ? old.bucket_count : rehash_position + bucket_budget;
+
+    for (; rehash_position < end; rehash_position++)
+    {
+      uint8_t& bucket_control = control(old)[rehash_position];
+      if (bucket_control & control_full)
+      {
+        size_t entry = slots(old)[rehash_position];
+        insert_bucket(tables[current], hashes()[entry], entry);
+        bucket_control = control_erased; // lookups still probe the old index, so don't cut their sequences short
+      }
+    }
+
+    if (rehash_position == old.bucket_count)
+    {
+      release_table(old);
+      rehashing = false;
+    }
+  }
+
+  // Shrinking to nothing can't fail, it just decommits
+  static void release_table(index_table& table) noexcept
+  {
+    pinned_realloc(0, &table.control);
+    pinned_realloc(0, &table.slots);
+    table.bucket_count = 0;
+    table.used = 0;
+  }
+
+  void free_allocations() noexcept
+  {
+    pinned_alloc_info* allocations[] = { &entries_alloc, &hashes_alloc,
+                                         &tables[0].control, &tables[0].slots, &tables[1].control, &tables[1].slots };
+    for (pinned_alloc_info* allocation : allocations)
+    {
+      if (allocation->data)
+        pinned_free(allocation);
+    }
+  }
+
+  pinned_alloc_info entries_alloc = {};
+  pinned_alloc_info hashes_alloc = {}; // hash of each entry, or erased_bit and the next free entry
+  size_t entry_count = 0; // entries ever used, live or not
+  size_t live_count = 0;
+  size_t free_head = no_entry;
+
+  index_table tables[2];
+  size_t current = 0;
+  size_t max_buckets = 0;
+
+  bool rehashing = false;
+  size_t rehash_position = 0; // buckets of the old index below this have been moved
+  size_t rehash_budget = 0;
+
+  Hash hash_function;
+  KeyEqual key_eq;
+};
@@ -0,0 +1,251 @@
+#pragma once
+#include "pinned.h"
+#include <cstdint>
+#include <initializer_list>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// A growable byte buffer for reading files and sockets into, with no bounce buffer in between. Reading into a
+// pinned_vec<char> means either reading into a scratch buffer and appending it (a copy), or resize()ing first (zeroing
+// memory that's about to be overwritten anyway). pinned_io_buffer instead commits just enough pages past the end of the
+// data for the next read, and has the kernel read straight into them. Since the buffer never moves, everything read so
+// far stays where it is, and pointers into it stay valid while more comes in.
+//
+//  pinned_io_buffer buffer;
+//  buffer.read_all(fd);                      // a whole file, in as few read() calls as possible
+//  while (buffer.read_from(socket) > 0) {}   // or as much of a stream as there is
+//
+// write_span() / commit_write() are there for anything else that writes into memory (recv(), io_uring, decompressors),
+// the same way as on pinned_ring, and readv_from() scatters one read over several buffers, eg fixed size headers into
+// one and payloads into another.
+//
+// map_file() doesn't read the file at all: it maps it over the front of the buffer (see pinned_map_file()), so the
+// file's pages come in from the page cache as they're touched, and anything appended afterwards goes in the pages
+// straight after it. Changes to a mapped file stay in the buffer, the file itself is never written.
+//
+// Not supported on windows.
+
+class pinned_io_buffer
+{
+public:
+  struct span
+  {
+    char* data = nullptr;
+    size_t size = 0;
+  };
+
+  // One buffer to read into with readv_from(), and how much to put in it at most
+  struct read_target
+  {
+    pinned_io_buffer* buffer;
+    size_t max_bytes;
+  };
+
+  static constexpr size_t default_read_size = 64 * 1024;
+  static constexpr size_t max_read_targets = 16;
+
+  explicit pinned_io_buffer(size_t max_size = PINNED_MAXSIZE_NORMAL)
+  {
+    if (pinned_alloc(0, max_size, &allocation) != 0)
+      throw std::bad_alloc();
+  }
+
+  pinned_io_buffer(const pinned_io_buffer&) = delete;
+  pinned_io_buffer& operator=(const pinned_io_buffer&) = delete;
+
+  ~pinned_io_buffer()
+  {
+    pinned_free(&allocation);
+  }
+
+  // Commits at least min_bytes past the end of the data, and returns all the committed space there
+  span write_span(size_t min_bytes)
+  {
+    if (min_bytes > allocation.max_size - length)
+      throw std::bad_alloc();
+
+    size_t needed = length + min_bytes;
+    if (needed > allocation.size)
+    {
+      size_t new_size = std::min<size_t>(pinned_growth_chunked<>::next_size(allocation.size, needed), allocation.max_size);
+      if (pinned_realloc(new_size, &allocation) != 0)
+        throw std::bad_alloc();
+    }
+
+    span result;
+    result.data = data() + length;
+    result.size = allocation.size - length;
+    return result;
+  }
+
+  // Add the first n bytes of the last write_span() to the data
+  void commit_write(size_t n) noexcept
+  {
+    length += n;
+  }
+
+  // One read() of up to max_bytes, straight onto the end of the data. Returns the number of bytes read, 0 at the end of
+  // the file (or when a socket is closed), or -1 if fd is non-blocking and has nothing to read right now. Throws
+  // std::system_error for anything else read() fails with.
+  ptrdiff_t read_from(int fd, size_t max_bytes = default_read_size)
+  {
+    span space = write_span(max_bytes);
+
+    ssize_t result;
+    do
+    {
+      result = read(fd, space.data, max_bytes);
+    } while (result < 0 && errno == EINTR);
+
+    return finish_read(result, this);
+  }
+
+  // Reads until the end of the file. For regular files, everything left in the file is committed up front, so it
+  // normally comes in with a single read(). Returns the number of bytes read.
+  size_t read_all(int fd)
+  {
+    size_t remaining = 0;
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) == 0 && S_ISREG(file_stat.st_mode))
+    {
+      off_t position = lseek(fd, 0, SEEK_CUR);
+      if (position >= 0 && file_stat.st_size > position)
+        remaining = size_t(file_stat.st_size - position);
+    }
+
+    size_t total = 0;
+    for (;;)
+    {
+      ptrdiff_t n = read_from(fd, remaining > total ? remaining - total : default_read_size);
+      if (n == 0)
+        return total;
+      if (n < 0)
+        throw std::system_error(EAGAIN, std::system_category());
+      total += size_t(n);
+    }
+  }
+
+  // Like readv(): one read(), filling each target up to its max_bytes before moving on to the next. Returns the total
+  // number of bytes read, like read_from(). Each target has to be a different buffer, as they're all read into at
+  // their current end.
+  static ptrdiff_t readv_from(int fd, std::initializer_list<read_target> targets)
+  {
+    if (targets.size() > max_read_targets)
+      throw std::system_error(EINVAL, std::system_category());
+
+    for (const read_target* target = targets.begin(); target != targets.end(); ++target)
+    {
+      for (const read_target* other = targets.begin(); other != target; ++other)
+      {
+        if (other->buffer == target->buffer)
+          throw std::system_error(EINVAL, std::system_category());
+      }
+    }
+
+    iovec vectors[max_read_targets];
+    int vector_count = 0;
+    for (const read_target& target : targets)
+    {
+      vectors[vector_count].iov_base = target.buffer->write_span(target.max_bytes).data;
+      vectors[vector_count].iov_len = target.max_bytes;
+      vector_count++;
+    }
+
+    ssize_t result;
+    do
+    {
+      result = readv(fd, vectors, vector_count);
+    } while (result < 0 && errno == EINTR);
+
+    if (result <= 0)
+      return finish_read(result, nullptr);
+
+    size_t left = size_t(result);
+    for (const read_target& target : targets)
+    {
+      size_t n = std::min(left, target.max_bytes);
+      target.buffer->commit_write(n);
+      left -= n;
+    }
+    return ptrdiff_t(result);
+  }
+
+  // Replace the contents of the buffer with the whole of a file, mapped in rather than read, see pinned_map_file()
+  void map_file(int fd)
+  {
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0)
+      throw std::system_error(errno, std::system_category());
+
+    int err = pinned_map_file(fd, size_t(file_stat.st_size), &allocation);
+    if (err != 0)
+      throw std::system_error(err, std::system_category());
+    length = size_t(file_stat.st_size);
+  }
+
+  void map_file(const char* path)
+  {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+      throw std::system_error(errno, std::system_category());
+
+    try
+    {
+      map_file(fd);
+    }
+    catch (...)
+    {
+      close(fd);
+      throw;
+    }
+    close(fd);
+  }
+
+  // Empties the buffer, keeping its pages committed for the next reads
+  void clear() noexcept
+  {
+    length = 0;
+  }
+
+  void shrink_to_fit()
+  {
+    if (pinned_realloc(length, &allocation) != 0)
+      throw std::bad_alloc();
+  }
+
+  char* data() noexcept { return static_cast<char*>(allocation.data); }
+  const char* data() const noexcept { return static_cast<const char*>(allocation.data); }
+  size_t size() const noexcept { return length; }
+  bool empty() const noexcept { return length == 0; }
+
+  // Bytes committed, including the data
+  size_t capacity() const noexcept { return allocation.size; }
+  size_t max_size() const noexcept { return allocation.max_size; }
+  const pinned_alloc_info& allocation_info() const noexcept { return allocation; }
+
+private:
+  // Turns what read() / readv() returned into our return value, committing it to buffer for a single read
+  static ptrdiff_t finish_read(ssize_t result, pinned_io_buffer* buffer)
+  {
+    if (result < 0)
+    {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return -1;
+      throw std::system_error(errno, std::system_category());
+    }
+
+    if (buffer)
+      buffer->commit_write(size_t(result));
+    return ptrdiff_t(result);
+  }
+
+  pinned_alloc_info allocation = {};
+  size_t length = 0;
+};
+
+#endif // _WIN32
@@ -0,0 +1,230 @@
+#pragma once
+#include "pinned.h"
+#include <atomic>
+#include <cstdint>
+
+// An append-only log with one writer and any number of readers. Records never move once they're written, so readers
+// don't need locks: they take a snapshot, which is just the range of records published so far, and read it while the
+// writer keeps appending after the end of it. Taking a snapshot is wait-free, a handful of atomic loads and stores.
+//
+// The writer appends records and then publishes them in batches with publish(), and can drop a prefix of the log with
+// truncate_front(). Dropped records are gone from new snapshots straight away, but their memory is only given back to the
+// OS (with pinned_discard()) once no reader still has a snapshot that started before them. Indices are absolute, they
+// don't shift down when the front is truncated, and the log can hold max_size records in total over its lifetime
+// (truncating frees the memory, but not the address space).
+//
+//  pinned_log<event> log;
+//
+//  // writer thread
+//  log.append(e1);
+//  log.append(e2);
+//  log.publish();
+//  log.truncate_front(1000); // drop everything before index 1000
+//
+//  // reader threads
+//  pinned_log<event>::reader reader(log);
+//  pinned_log<event>::snapshot snapshot = reader.take_snapshot();
+//  for (const event& e : snapshot)
+//    analyse(e);
+//
+// Each reader takes one of MaxReaders slots for as long as it exists, and a snapshot stays valid until its reader takes
+// the next one, calls release(), or is destroyed. Only the writer thread can call the non-const member functions of the
+// log itself.
+
+template <typename T, size_t MaxReaders = 64>
+class pinned_log
+{
+public:
+  static_assert(std::is_trivially_copyable<T>::value, "pinned_log records have to be trivially copyable, as truncated ones are just thrown away");
+
+  struct snapshot
+  {
+    const T* first = nullptr;
+    const T* last = nullptr;
+    size_t first_index = 0; // index of *first in the log
+
+    const T* begin() const noexcept { return first; }
+    const T* end() const noexcept { return last; }
+    size_t size() const noexcept { return size_t(last - first); }
+    bool empty() const noexcept { return first == last; }
+    const T& operator[](size_t pos) const { return first[pos]; }
+  };
+
+  class reader
+  {
+  public:
+    explicit reader(pinned_log& log) : log(log)
+    {
+      for (slot_index = 0; slot_index < MaxReaders; slot_index++)
+      {
+        bool expected = false;
+        if (log.slots[slot_index].in_use.compare_exchange_strong(expected, true, std::memory_order_acquire))
+          return;
+      }
+
+      throw std::runtime_error("pinned_log has no free reader slots");
+    }
+
+    reader(const reader&) = delete;
+    reader& operator=(const reader&) = delete;
+
+    ~reader()
+    {
+      release();
+      log.slots[slot_index].in_use.store(false, std::memory_order_release);
+    }
+
+    // Everything published up to now, from the current front of the log
+    snapshot take_snapshot() noexcept
+    {
+      std::atomic<size_t>& pin = log.slots[slot_index].pin;
+
+      // Pin the front we see, then read it again and start from there. If the writer's scan of the pins saw ours, it
+      // didn't release anything at or after it. If it didn't, the scan happened before our pin was stored, so the writer
+      // had already moved the front to where our second read finds it (or further), and only released pages before that.
+      size_t front = log.head.load(std::memory_order_seq_cst);
+      pin.store(front, std::memory_order_seq_cst);
+      front = log.head.load(std::memory_order_seq_cst);
+      pin.store(front, std::memory_order_relaxed);
+
+      snapshot result;
+      result.first_index = front;
+      result.first = log.records() + front;
+      result.last = log.records() + std::max(front, log.published.load(std::memory_order_acquire));
+      return result;
+    }
+
+    // Let the writer reclaim everything, until the next take_snapshot()
+    void release() noexcept
+    {
+      log.slots[slot_index].pin.store(no_pin, std::memory_order_release);
+    }
+
+  private:
+    pinned_log& log;
+    size_t slot_index = 0;
+  };
+
+  explicit pinned_log(size_t max_size = PINNED_MAXSIZE_NORMAL)
+  {
+    if (pinned_alloc(0, max_size, &allocation) != 0)
+      throw std::bad_alloc();
+  }
+
+  pinned_log(const pinned_log&) = delete;
+  pinned_log& operator=(const pinned_log&) = delete;
+
+  ~pinned_log()
+  {
+    pinned_free(&allocation);
+  }
+
+  // Not visible to readers until the next publish()
+  void append(const T& record)
+  {
+    if (written == capacity())
+      reserve(std::max(std::min(written * 2, max_size()), written + 1));
+
+    records()[written] = record;
+    written++;
+  }
+
+  template<class InputIt>
+  void append(InputIt first, InputIt last)
+  {
+    size_t to_add_count = size_t(std::distance(first, last));
+    if (written + to_add_count > capacity())
+      reserve(std::max(std::min(written * 2, max_size()), written + to_add_count));
+
+    std::copy(first, last, records() + written);
+    written += to_add_count;
+  }
+
+  // Make everything appended so far visible to new snapshots
+  void publish() noexcept
+  {
+    published.store(written, std::memory_order_release);
+  }
+
+  // Drop every record before new_front from the log, and give back the memory of any of them that readers are done with.
+  // Memory that readers are still looking at (or that couldn't be given back) is given back by a later truncate_front()
+  // or reclaim() call.
+  void truncate_front(size_t new_front) noexcept
+  {
+    new_front = std::min(new_front, published.load(std::memory_order_relaxed));
+    if (new_front <= head.load(std::memory_order_relaxed))
+      return;
+
+    // The records are dropped either way, so there's nothing to report if the memory can't be given back yet
+    head.store(new_front, std::memory_order_seq_cst);
+    release_pages();
+  }
+
+  // Give back the memory of truncated records that no reader's snapshot includes any more. Throws std::system_error if
+  // pinned_discard() fails.
+  void reclaim()
+  {
+    int err = release_pages();
+    if (err != 0)
+      throw std::system_error(err, std::system_category());
+  }
+
+  void reserve(size_t new_cap)
+  {
+    if (new_cap > capacity() && pinned_realloc(new_cap * sizeof(T), &allocation) != 0)
+      throw std::bad_alloc();
+  }
+
+  // Index of the first record that hasn't been truncated
+  size_t front() const noexcept { return head.load(std::memory_order_acquire); }
+
+  // Index one past the last published / appended record
+  size_t published_size() const noexcept { return published.load(std::memory_order_acquire); }
+  size_t written_size() const noexcept { return written; }
+
+  size_t capacity() const noexcept { return allocation.size / sizeof(T); }
+  size_t max_size() const noexcept { return allocation.max_size / sizeof(T); }
+
+  const T* data() const noexcept { return reinterpret_cast<const T*>(allocation.data); }
+
+private:
+  T* records() noexcept { return reinterpret_cast<T*>(allocation.data); }
+
+  // What reclaim() does, returning pinned_discard()'s error instead of throwing it
+  int release_pages() noexcept
+  {
+    size_t limit = head.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < MaxReaders; i++)
+      limit = std::min(limit, slots[i].pin.load(std::memory_order_seq_cst));
+
+    // Only whole pages, and remember where we got to so we never discard the same page twice
+    size_t page_size = pinned_page_size();
+    size_t end = ((limit * sizeof(T)) / page_size) * page_size;
+    if (end > released_bytes)
+    {
+      int err = pinned_discard(released_bytes, end - released_bytes, &allocation);
+      if (err != 0)
+        return err;
+      released_bytes = end;
+    }
+    return 0;
+  }
+
+  static constexpr size_t no_pin = SIZE_MAX;
+
+  struct alignas(64) reader_slot
+  {
+    std::atomic<bool> in_use{false};
+    std::atomic<size_t> pin{no_pin}; // first index the reader's snapshot might look at
+  };
+
+  // Writer only
+  pinned_alloc_info allocation = {};
+  size_t written = 0;
+  size_t released_bytes = 0;
+
+  alignas(64) std::atomic<size_t> published{0};
+  alignas(64) std::atomic<size_t> head{0};
+
+  reader_slot slots[MaxReaders];
+};
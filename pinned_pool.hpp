@@ -0,0 +1,338 @@
+#pragma once
+#include "pinned.h"
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// A pool of fixed size slots for lots of objects of one type, like tree or graph nodes. All the slots are in one pinned
+// allocation that grows with pinned_realloc(), so objects never move, there are no slabs to keep track of, and freed
+// slots can be reused for anything without fragmenting. Allocating and freeing are constant time and lock-free: freed
+// slots go on a free list, and slots that have never been used are handed out with an atomic increment. A mutex is only
+// taken to commit more pages.
+//
+//  pinned_pool<node> pool;
+//  node* n = pool.create(args);
+//  pool.destroy(n);
+//
+// Every thread hitting the same free list gets slow with enough threads, so threads doing lots of allocation should go
+// through a cache, which keeps a small free list of its own and only touches the shared one a batch at a time:
+//
+//  pinned_pool<node>::cache cache(pool); // one per thread
+//  node* n = cache.create(args);
+//  cache.destroy(n); // objects can be freed through any cache, or the pool itself
+//
+// Free list links are kept in a separate array instead of inside the free slots, so trim() can give the pages of
+// completely free runs of slots back to the OS without losing track of them. trim() can't run concurrently with anything
+// else, and it can't see the slots sitting in caches, so a page with any of those on it is kept.
+//
+// The pool doesn't know which slots are in use, so it doesn't destroy anything left in it when it's destroyed.
+// A pool holds at most 2^32 - 1 slots.
+
+template <typename T>
+class pinned_pool
+{
+public:
+  class cache
+  {
+  public:
+    explicit cache(pinned_pool& pool) : pool(pool) {}
+    cache(const cache&) = delete;
+    cache& operator=(const cache&) = delete;
+
+    ~cache()
+    {
+      if (count != 0)
+        pool.push_chain(head, tail);
+    }
+
+    void* allocate()
+    {
+      if (count == 0)
+        refill();
+
+      uint32_t index = head;
+      head = pool.links()[index].load(std::memory_order_relaxed);
+      count--;
+      return pool.slot(index);
+    }
+
+    void deallocate(void* pointer) noexcept
+    {
+      uint32_t index = pool.index_of(pointer);
+      pool.links()[index].store(head, std::memory_order_relaxed);
+      if (count == 0)
+        tail = index;
+      head = index;
+      count++;
+
+      if (count >= batch_size * 2)
+        flush(batch_size);
+    }
+
+    template <class... Args>
+    T* create(Args&&... args)
+    {
+      void* memory = allocate();
+      try
+      {
+        return new (memory) T(std::forward<Args>(args) ...);
+      }
+      catch (...)
+      {
+        deallocate(memory);
+        throw;
+      }
+    }
+
+    void destroy(T* object) noexcept
+    {
+      object->~T();
+      deallocate(object);
+    }
+
+  private:
+    static constexpr uint32_t batch_size = 64;
+
+    void refill()
+    {
+      // Reuse freed slots first, then take a batch of fresh ones in one go
+      for (; count < batch_size; count++)
+      {
+        uint32_t index = pool.pop();
+        if (index == no_slot)
+          break;
+        pool.links()[index].store(head, std::memory_order_relaxed);
+        if (count == 0)
+          tail = index;
+        head = index;
+      }
+
+      if (count == 0)
+      {
+        size_t first = pool.claim_fresh(batch_size);
+        size_t last = std::min<size_t>(first + batch_size, pool.max_slots());
+        for (size_t i = last; i-- > first;)
+        {
+          pool.links()[i].store(head, std::memory_order_relaxed);
+          if (count == 0)
+            tail = uint32_t(i);
+          head = uint32_t(i);
+          count++;
+        }
+      }
+    }
+
+    // Give the oldest n slots back to the pool
+    void flush(uint32_t n) noexcept
+    {
+      uint32_t keep = count - n;
+      uint32_t last_kept = head;
+      for (uint32_t i = 1; i < keep; i++)
+        last_kept = pool.links()[last_kept].load(std::memory_order_relaxed);
+
+      uint32_t first_given = pool.links()[last_kept].load(std::memory_order_relaxed);
+      pool.push_chain(first_given, tail);
+      tail = last_kept;
+      count = keep;
+    }
+
+    pinned_pool& pool;
+    uint32_t head = no_slot;
+    uint32_t tail = no_slot;
+    uint32_t count = 0;
+  };
+
+  explicit pinned_pool(size_t max_size = PINNED_MAXSIZE_NORMAL)
+  {
+    slot_limit = std::min<size_t>(max_size / slot_size, no_slot);
+
+    if (pinned_alloc(0, slot_limit * slot_size, &allocation) != 0)
+      throw std::bad_alloc();
+
+    if (pinned_alloc(0, slot_limit * sizeof(uint32_t), &link_allocation) != 0)
+    {
+      pinned_free(&allocation);
+      throw std::bad_alloc();
+    }
+  }
+
+  pinned_pool(const pinned_pool&) = delete;
+  pinned_pool& operator=(const pinned_pool&) = delete;
+
+  ~pinned_pool()
+  {
+    pinned_free(&link_allocation);
+    pinned_free(&allocation);
+  }
+
+  void* allocate()
+  {
+    uint32_t index = pop();
+    if (index == no_slot)
+      index = uint32_t(claim_fresh(1));
+    return slot(index);
+  }
+
+  void deallocate(void* pointer) noexcept
+  {
+    uint32_t index = index_of(pointer);
+    push_chain(index, index);
+  }
+
+  template <class... Args>
+  T* create(Args&&... args)
+  {
+    void* memory = allocate();
+    try
+    {
+      return new (memory) T(std::forward<Args>(args) ...);
+    }
+    catch (...)
+    {
+      deallocate(memory);
+      throw;
+    }
+  }
+
+  void destroy(T* object) noexcept
+  {
+    object->~T();
+    deallocate(object);
+  }
+
+  // Give back the memory behind pages whose slots are all on the pool's free list. Returns how many bytes that was.
+  // Pages that can't be given back (pinned_discard() fails) just stay committed, and aren't counted. Not thread safe.
+  size_t trim()
+  {
+    size_t used_slots = std::min(fresh.load(std::memory_order_relaxed), committed.load(std::memory_order_relaxed));
+    std::vector<bool> is_free(used_slots, false);
+    for (uint32_t index = uint32_t(head.load(std::memory_order_relaxed)); index != no_slot;
+         index = links()[index].load(std::memory_order_relaxed))
+    {
+      is_free[index] = true;
+    }
+
+    size_t page_size = pinned_page_size();
+    size_t page_count = (used_slots * slot_size) / page_size; // a partial page at the end always has unused slots
+    size_t released = 0;
+    size_t run_start = 0;
+    size_t run_length = 0;
+
+    for (size_t page = 0; page <= page_count; page++)
+    {
+      bool page_free = page < page_count;
+      if (page_free)
+      {
+        // Every slot that overlaps the page
+        size_t first = (page * page_size) / slot_size;
+        size_t last = ((page + 1) * page_size + slot_size - 1) / slot_size;
+        for (size_t i = first; i < last && i < used_slots && page_free; i++)
+          page_free = is_free[i];
+      }
+
+      if (page_free)
+      {
+        if (run_length == 0)
+          run_start = page;
+        run_length++;
+      }
+      else if (run_length != 0)
+      {
+        if (pinned_discard(run_start * page_size, run_length * page_size, &allocation) == 0)
+          released += run_length * page_size;
+        run_length = 0;
+      }
+    }
+
+    return released;
+  }
+
+  // Slots that have been handed out at some point, whether they're in use or free now
+  size_t slots_touched() const noexcept { return std::min(fresh.load(std::memory_order_relaxed), max_slots()); }
+  size_t capacity() const noexcept { return committed.load(std::memory_order_acquire); }
+  size_t max_slots() const noexcept { return slot_limit; }
+
+private:
+  static constexpr uint32_t no_slot = UINT32_MAX;
+
+  static constexpr size_t slot_size = sizeof(T);
+
+  void* slot(uint32_t index) noexcept { return static_cast<char*>(allocation.data) + size_t(index) * slot_size; }
+  uint32_t index_of(void* pointer) const noexcept
+  {
+    return uint32_t((static_cast<char*>(pointer) - static_cast<char*>(allocation.data)) / slot_size);
+  }
+
+  // Zero-initialised memory is a valid std::atomic<uint32_t> holding 0, same as in concurrent_pinned_vec
+  std::atomic<uint32_t>* links() noexcept { return reinterpret_cast<std::atomic<uint32_t>*>(link_allocation.data); }
+
+  // The free list head is a slot index in the low 32 bits, and a counter in the high 32 that changes on every update,
+  // so a pop that read a stale next link can't succeed after the slot has been popped and pushed back in the meantime
+  uint32_t pop() noexcept
+  {
+    uint64_t current = head.load(std::memory_order_acquire);
+    for (;;)
+    {
+      uint32_t index = uint32_t(current);
+      if (index == no_slot)
+        return no_slot;
+
+      uint64_t next = ((current >> 32) + 1) << 32 | links()[index].load(std::memory_order_relaxed);
+      if (head.compare_exchange_weak(current, next, std::memory_order_acquire, std::memory_order_acquire))
+        return index;
+    }
+  }
+
+  // Push a chain of slots that are already linked together, from first to last
+  void push_chain(uint32_t first, uint32_t last) noexcept
+  {
+    uint64_t current = head.load(std::memory_order_relaxed);
+    for (;;)
+    {
+      links()[last].store(uint32_t(current), std::memory_order_relaxed);
+      uint64_t next = ((current >> 32) + 1) << 32 | first;
+      if (head.compare_exchange_weak(current, next, std::memory_order_release, std::memory_order_relaxed))
+        return;
+    }
+  }
+
+  // Claim count never used slots, and returns the first one
+  size_t claim_fresh(size_t count)
+  {
+    size_t first = fresh.fetch_add(count, std::memory_order_relaxed);
+    if (first >= max_slots())
+      throw std::bad_alloc();
+
+    size_t end = std::min(first + count, max_slots());
+    if (end > committed.load(std::memory_order_acquire))
+    {
+      std::lock_guard<std::mutex> lock(commit_mutex);
+      size_t current = committed.load(std::memory_order_relaxed);
+      if (end > current)
+      {
+        // Double, but at least 64KiB at a time
+        size_t minimum = std::max<size_t>(1, (64 * 1024) / slot_size);
+        size_t new_count = std::min(std::max({ end, current * 2, minimum }), max_slots());
+        if (pinned_realloc(new_count * slot_size, &allocation) != 0 ||
+            pinned_realloc(new_count * sizeof(uint32_t), &link_allocation) != 0)
+        {
+          throw std::bad_alloc();
+        }
+
+        committed.store(std::min(allocation.size / slot_size, link_allocation.size / sizeof(uint32_t)), std::memory_order_release);
+      }
+    }
+
+    return first;
+  }
+
+  pinned_alloc_info allocation = {};
+  pinned_alloc_info link_allocation = {}; // next free slot for each free slot
+  std::mutex commit_mutex;
+  size_t slot_limit = 0;
+
+  alignas(64) std::atomic<uint64_t> head{no_slot};
+  alignas(64) std::atomic<size_t> fresh{0}; // slots below this have been handed out before
+  alignas(64) std::atomic<size_t> committed{0};
+};
@@ -0,0 +1,127 @@
+#pragma once
+#include "pinned.h"
+#include <atomic>
+#include <cstdint>
+
+// A single producer, single consumer byte ring buffer, built on pinned_ring_alloc(). Because the ring's memory is mapped
+// twice back to back, the free space and the unread data are always one contiguous span, even when they wrap around the
+// end, so the producer can write straight into the buffer and the consumer can parse straight out of it, with no copies
+// to stitch wrapped data together and no modulo on every access.
+//
+//  pinned_ring ring(64 * 1024);
+//
+//  // producer thread
+//  pinned_ring::span space = ring.write_span();
+//  size_t n = read(socket, space.data, space.size);
+//  ring.commit_write(n);
+//
+//  // consumer thread
+//  pinned_ring::span input = ring.read_span();
+//  size_t used = parse(input.data, input.size);
+//  ring.consume(used);
+//
+// The producer and consumer offsets count every byte that has gone through the ring, so they never wrap (not for a few
+// hundred years anyway). resize() keeps both of them, and the unread data, as they were, but must not run concurrently
+// with the producer or the consumer. Spans are invalidated by resize().
+
+class pinned_ring
+{
+public:
+  struct span
+  {
+    char* data = nullptr;
+    size_t size = 0;
+  };
+
+  explicit pinned_ring(size_t capacity, size_t max_capacity = PINNED_MAXSIZE_NORMAL)
+  {
+    if (pinned_ring_alloc(capacity, max_capacity, &ring) != 0)
+      throw std::bad_alloc();
+  }
+
+  pinned_ring(const pinned_ring&) = delete;
+  pinned_ring& operator=(const pinned_ring&) = delete;
+
+  ~pinned_ring()
+  {
+    pinned_ring_free(&ring);
+  }
+
+  // Producer side. The free space, as one contiguous block.
+  span write_span() noexcept
+  {
+    uint64_t read_offset = read_total.load(std::memory_order_acquire);
+    span result;
+    result.data = buffer() + write_position;
+    result.size = ring.capacity - size_t(write_offset - read_offset);
+    return result;
+  }
+
+  // Make the first n bytes of the last write_span() visible to the consumer
+  void commit_write(size_t n) noexcept
+  {
+    write_offset += n;
+    write_position += n;
+    if (write_position >= ring.capacity)
+      write_position -= ring.capacity;
+    write_total.store(write_offset, std::memory_order_release);
+  }
+
+  // Consumer side. Everything written and not consumed yet, as one contiguous block.
+  span read_span() noexcept
+  {
+    uint64_t written = write_total.load(std::memory_order_acquire);
+    span result;
+    result.data = buffer() + read_position;
+    result.size = size_t(written - read_offset);
+    return result;
+  }
+
+  // Give the first n bytes of the last read_span() back to the producer
+  void consume(size_t n) noexcept
+  {
+    read_offset += n;
+    read_position += n;
+    if (read_position >= ring.capacity)
+      read_position -= ring.capacity;
+    read_total.store(read_offset, std::memory_order_release);
+  }
+
+  // Not thread safe. new_capacity is rounded up to a multiple of the page size, and has to fit the unread data.
+  void resize(size_t new_capacity)
+  {
+    if (pinned_ring_resize(new_capacity, read_offset, write_offset, &ring) != 0)
+      throw std::bad_alloc();
+
+    write_position = size_t(write_offset % ring.capacity);
+    read_position = size_t(read_offset % ring.capacity);
+  }
+
+  // Total bytes ever written / consumed
+  uint64_t producer_offset() const noexcept { return write_total.load(std::memory_order_acquire); }
+  uint64_t consumer_offset() const noexcept { return read_total.load(std::memory_order_acquire); }
+
+  // Unread bytes. Only exact when called from the producer or consumer thread.
+  size_t size() const noexcept { return size_t(producer_offset() - consumer_offset()); }
+  bool empty() const noexcept { return size() == 0; }
+
+  size_t capacity() const noexcept { return ring.capacity; }
+  size_t max_capacity() const noexcept { return ring.max_capacity; }
+
+private:
+  char* buffer() noexcept { return reinterpret_cast<char*>(ring.data); }
+
+  pinned_ring_info ring = {};
+
+  // Producer only
+  alignas(64) uint64_t write_offset = 0;
+  size_t write_position = 0;
+
+  // Consumer only
+  alignas(64) uint64_t read_offset = 0;
+  size_t read_position = 0;
+
+  // Shared, on their own cache lines so the two sides don't keep stealing each other's
+  alignas(64) std::atomic<uint64_t> write_total{0};
+  alignas(64) std::atomic<uint64_t> read_total{0};
+};
@@ -0,0 +1,324 @@
+#pragma once
+#include "pinned.h"
+
+// A pinned_vec variant for when you have lots of vectors that are usually tiny. A plain pinned_vec reserves its whole
+// max_size of address space (with an mmap() call) as soon as it's constructed, and commits a whole page for the first
+// element, which is a lot of syscalls and memory if most of your vectors only ever hold a handful of things.
+// pinned_small_vec instead keeps the first N elements inside the object itself, and only creates a pinned reservation
+// once it grows past that.
+//
+// The catch is that the no-invalidation guarantee only starts once the elements live in the pinned reservation:
+//
+//  pinned_small_vec<int, 4> vec;
+//  vec.push_back(1);
+//  int* p = &vec[0];       // points into the object itself
+//  for (int i = 0; i < 4; i++)
+//    vec.push_back(i);     // moves to a pinned reservation, p is now invalid
+//  p = &vec[0];
+//  vec.push_back(5);       // from here on it works just like pinned_vec, p stays valid
+//
+// is_pinned() tells you which side of that line you're on, and reserve() with anything bigger than N moves to a
+// reservation up front if you need stable pointers from the start. Pointers into the inline storage are also
+// invalidated by swap().
+
+template <typename T, size_t N, size_t MaxSize = PINNED_MAXSIZE_NORMAL>
+class pinned_small_vec
+{
+public:
+  using value_type = T;
+  using size_type = size_t;
+  using difference_type = ptrdiff_t;
+  using reference = T&;
+  using const_reference = const T&;
+  using pointer = T*;
+  using const_pointer = const T*;
+  using iterator = T*;
+  using const_iterator = const T*;
+  using reverse_iterator = std::reverse_iterator<iterator>;
+  using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+  static_assert(N > 0, "use pinned_vec if you don't want any inline storage");
+
+  pinned_small_vec() noexcept : elements(inline_data()) {}
+
+  explicit pinned_small_vec(size_t count) : pinned_small_vec()
+  {
+    resize(count);
+  }
+
+  pinned_small_vec(size_type count, const T& value) : pinned_small_vec()
+  {
+    resize(count, value);
+  }
+
+  pinned_small_vec(const pinned_small_vec&) = delete;
+  pinned_small_vec& operator=(const pinned_small_vec&) = delete;
+
+  // A pinned other just hands over its reservation, an inline one has its elements moved over one by one. Either way,
+  // other is left empty and inline.
+  pinned_small_vec(pinned_small_vec&& other) noexcept(std::is_nothrow_move_constructible<T>::value) : pinned_small_vec()
+  {
+    take(other);
+  }
+
+  pinned_small_vec& operator=(pinned_small_vec&& other) noexcept(std::is_nothrow_move_constructible<T>::value)
+  {
+    if (this != &other)
+    {
+      release();
+      take(other);
+    }
+    return *this;
+  }
+
+  ~pinned_small_vec()
+  {
+    release();
+  }
+
+  reference at(size_type pos)
+  {
+    if (pos >= size())
+      throw std::out_of_range("out of range");
+    return elements[pos];
+  }
+
+  const_reference at(size_type pos) const
+  {
+    if (pos >= size())
+      throw std::out_of_range("out of range");
+    return elements[pos];
+  }
+
+  reference operator[](size_type pos) { return elements[pos]; }
+  const_reference operator[](size_type pos) const { return elements[pos]; }
+
+  reference front() { return elements[0]; }
+  const_reference front() const { return elements[0]; }
+
+  reference back() { return elements[count-1]; }
+  const_reference back() const { return elements[count-1]; }
+
+  pointer data() noexcept { return elements; }
+  const_pointer data() const noexcept { return elements; }
+
+  iterator begin() noexcept { return elements; }
+  const_iterator begin() const noexcept { return elements; }
+  const_iterator cbegin() const noexcept { return elements; }
+
+  iterator end() noexcept { return elements + count; }
+  const_iterator end() const noexcept { return elements + count; }
+  const_iterator cend() const noexcept { return elements + count; }
+
+  reverse_iterator rbegin() noexcept { return reverse_iterator(end()); }
+  const_reverse_iterator rbegin() const noexcept { return const_reverse_iterator(end()); }
+  const_reverse_iterator crbegin() const noexcept { return const_reverse_iterator(cend()); }
+
+  reverse_iterator rend() noexcept { return reverse_iterator(begin()); }
+  const_reverse_iterator rend() const noexcept { return const_reverse_iterator(begin()); }
+  const_reverse_iterator crend() const noexcept { return const_reverse_iterator(cbegin()); }
+
+  bool empty() const noexcept { return count == 0; }
+  size_type size() const noexcept { return count; }
+  size_type max_size() const noexcept { return MaxSize / sizeof(T); }
+  size_type capacity() const noexcept { return is_pinned() ? storage.allocation.size / sizeof(T) : N; }
+
+  // True once the elements have moved out of the object and into a pinned reservation, after which pointers and
+  // iterators are no longer invalidated by growing the vector
+  bool is_pinned() const noexcept { return elements != inline_data(); }
+
+  void reserve(size_type new_cap)
+  {
+    if (new_cap <= capacity())
+      return;
+
+    if (is_pinned())
+    {
+      if (pinned_realloc(new_cap * sizeof(T), &storage.allocation) != 0)
+        throw std::bad_alloc();
+      return;
+    }
+
+    // Move out of the inline storage. The allocation info shares space with the inline elements, so build it on the side.
+    pinned_alloc_info allocation;
+    if (pinned_alloc(new_cap * sizeof(T), MaxSize, &allocation) != 0)
+      throw std::bad_alloc();
+
+    // Like std::vector, copy rather than move when moving could throw, so the inline elements are untouched if it does
+    T* new_elements = reinterpret_cast<T*>(allocation.data);
+    size_t constructed = 0;
+    try
+    {
+      for (; constructed < count; constructed++)
+        new (&new_elements[constructed]) T(std::move_if_noexcept(elements[constructed]));
+    }
+    catch (...)
+    {
+      for (size_t i = 0; i < constructed; i++)
+        new_elements[i].~T();
+      pinned_free(&allocation);
+      throw;
+    }
+
+    for (size_t i = 0; i < count; i++)
+      elements[i].~T();
+
+    storage.allocation = allocation;
+    elements = new_elements;
+  }
+
+  void clear() noexcept
+  {
+    resize(0);
+  }
+
+  template<class... Args>
+  reference emplace_back(Args&&... args)
+  {
+    if (count == capacity())
+    {
+      if (!is_pinned())
+      {
+        // args might refer to one of our inline elements, which are about to move
+        T value(std::forward<Args>(args) ...);
+        reserve(grown_capacity());
+        return emplace_back(std::move(value));
+      }
+
+      reserve(grown_capacity());
+    }
+
+    new (&elements[count]) T(std::forward<Args>(args) ...);
+    reference retval = elements[count];
+    count++;
+    return retval;
+  }
+
+  void push_back(const T& value)
+  {
+    emplace_back(value);
+  }
+
+  void push_back(T&& value)
+  {
+    emplace_back(std::move(value));
+  }
+
+  void pop_back()
+  {
+    elements[count-1].~T();
+    count--;
+  }
+
+  void resize(size_type new_count)
+  {
+    if (new_count > count)
+    {
+      reserve(new_count);
+      for (size_type i = count; i < new_count; i++)
+        new (&elements[i]) T();
+      count = new_count;
+    }
+    else if (new_count < count)
+    {
+      for (size_type i = new_count; i < count; i++)
+        elements[i].~T();
+      count = new_count;
+    }
+  }
+
+  void resize(size_type new_count, const value_type& value)
+  {
+    if (new_count > capacity() && !is_pinned())
+    {
+      // value might be one of our inline elements, which are about to move
+      T copy(value);
+      reserve(new_count);
+      resize(new_count, copy);
+    }
+    else if (new_count > count)
+    {
+      reserve(new_count);
+      for (size_type i = count; i < new_count; i++)
+        new (&elements[i]) T(value);
+      count = new_count;
+    }
+    else if (new_count < count)
+    {
+      for (size_type i = new_count; i < count; i++)
+        elements[i].~T();
+      count = new_count;
+    }
+  }
+
+  void swap(pinned_small_vec& other)
+  {
+    if (is_pinned() && other.is_pinned())
+    {
+      std::swap(storage.allocation, other.storage.allocation);
+      std::swap(elements, other.elements);
+      std::swap(count, other.count);
+      return;
+    }
+
+    // At least one side is inline, so go through a temporary. A pinned side just hands over its reservation.
+    pinned_small_vec temp;
+    temp.take(*this);
+    take(other);
+    other.take(temp);
+  }
+
+private:
+  T* inline_data() noexcept { return reinterpret_cast<T*>(storage.inline_elements); }
+
+  // Double, but only up to max_size(), and once it's full ask for one more so reserve() throws
+  size_type grown_capacity() const noexcept
+  {
+    return std::max(std::min(count * 2, max_size()), count + 1);
+  }
+
+  // Destroy everything and go back to empty and inline
+  void release() noexcept
+  {
+    resize(0);
+    if (is_pinned())
+    {
+      pinned_free(&storage.allocation);
+      elements = inline_data();
+    }
+  }
+  const T* inline_data() const noexcept { return reinterpret_cast<const T*>(storage.inline_elements); }
+
+  // Moves everything from other (which is left empty and inline) into this, which has to be empty and inline
+  void take(pinned_small_vec& other)
+  {
+    if (other.is_pinned())
+    {
+      storage.allocation = other.storage.allocation;
+      elements = other.elements;
+      other.elements = other.inline_data();
+    }
+    else
+    {
+      for (size_t i = 0; i < other.count; i++)
+      {
+        new (&elements[i]) T(std::move(other.elements[i]));
+        other.elements[i].~T();
+      }
+    }
+
+    count = other.count;
+    other.count = 0;
+  }
+
+  union storage_t
+  {
+    storage_t() noexcept {}
+
+    alignas(T) unsigned char inline_elements[N * sizeof(T)];
+    pinned_alloc_info allocation; // once is_pinned()
+  } storage;
+
+  T* elements;
+  size_t count = 0;
+};
@@ -0,0 +1,273 @@
+#pragma once
+#include "pinned.h"
+#include <tuple>
+#include <utility>
+
+// A struct-of-arrays container: pinned_soa<float, float, uint32_t> is like a pinned_vec of { float, float, uint32_t }
+// records, except that each field (column) is stored in its own pinned reservation. Loops that only look at one or two
+// fields of each record then only pull those fields through the cache, and can be vectorised.
+//
+// All the columns are grown together and share one size(). Since each column is pinned, the pointer to a column's data
+// never changes, so hot loops can grab it once and keep using it while rows are appended:
+//
+//  pinned_soa<float, float, uint32_t> particles;
+//  particles.push_back(x, y, id);
+//
+//  float* xs = particles.column_data<0>(); // valid forever
+//  for (float x : particles.column<0>())
+//    ...
+//
+//  auto [x, y, id] = particles[i]; // a tuple of references into each column
+//  x += 1.0f;
+
+template <typename... Ts>
+class pinned_soa
+{
+public:
+  static_assert(sizeof...(Ts) > 0, "pinned_soa needs at least one column");
+
+  static constexpr size_t column_count = sizeof...(Ts);
+
+  template <size_t I>
+  using column_type = typename std::tuple_element<I, std::tuple<Ts...>>::type;
+
+  using row_reference = std::tuple<Ts&...>;
+  using const_row_reference = std::tuple<const Ts&...>;
+  using size_type = size_t;
+
+  // A contiguous run of one column
+  template <typename T>
+  struct span
+  {
+    T* first = nullptr;
+    size_t count = 0;
+
+    T* data() const noexcept { return first; }
+    size_t size() const noexcept { return count; }
+    bool empty() const noexcept { return count == 0; }
+    T* begin() const noexcept { return first; }
+    T* end() const noexcept { return first + count; }
+    T& operator[](size_t pos) const { return first[pos]; }
+  };
+
+  // Iterates rows, dereferencing to a row_reference / const_row_reference
+  template <bool Const>
+  class row_iterator
+  {
+  public:
+    using soa_pointer = typename std::conditional<Const, const pinned_soa*, pinned_soa*>::type;
+    using reference = typename std::conditional<Const, const_row_reference, row_reference>::type;
+
+    row_iterator(soa_pointer soa, size_t index) : soa(soa), index(index) {}
+
+    reference operator*() const { return (*soa)[index]; }
+    row_iterator& operator++() { index++; return *this; }
+    row_iterator operator++(int) { row_iterator old = *this; index++; return old; }
+    bool operator==(const row_iterator& other) const { return index == other.index; }
+    bool operator!=(const row_iterator& other) const { return index != other.index; }
+
+  private:
+    soa_pointer soa;
+    size_t index;
+  };
+
+  using iterator = row_iterator<false>;
+  using const_iterator = row_iterator<true>;
+
+  // max_size is in bytes, for the widest column. The others reserve the same number of rows.
+  explicit pinned_soa(size_t max_size = PINNED_MAXSIZE_NORMAL)
+  {
+    size_t max_rows = max_size / std::max({ sizeof(Ts)... });
+    size_t column_sizes[] = { (max_rows * sizeof(Ts))... };
+
+    for (size_t i = 0; i < column_count; i++)
+    {
+      if (pinned_alloc(0, column_sizes[i], &columns[i]) != 0)
+      {
+        for (size_t j = 0; j < i; j++)
+          pinned_free(&columns[j]);
+        throw std::bad_alloc();
+      }
+    }
+
+    row_limit = max_rows;
+  }
+
+  pinned_soa(const pinned_soa&) = delete;
+  pinned_soa& operator=(const pinned_soa&) = delete;
+
+  ~pinned_soa()
+  {
+    clear();
+    for (pinned_alloc_info& column : columns)
+      pinned_free(&column);
+  }
+
+  template <size_t I>
+  column_type<I>* column_data() noexcept { return reinterpret_cast<column_type<I>*>(columns[I].data); }
+  template <size_t I>
+  const column_type<I>* column_data() const noexcept { return reinterpret_cast<const column_type<I>*>(columns[I].data); }
+
+  template <size_t I>
+  span<column_type<I>> column() noexcept { return { column_data<I>(), count }; }
+  template <size_t I>
+  span<const column_type<I>> column() const noexcept { return { column_data<I>(), count }; }
+
+  template <size_t I>
+  column_type<I>& get(size_type row) { return column_data<I>()[row]; }
+  template <size_t I>
+  const column_type<I>& get(size_type row) const { return column_data<I>()[row]; }
+
+  row_reference operator[](size_type row) { return make_row(row, std::index_sequence_for<Ts...>()); }
+  const_row_reference operator[](size_type row) const { return make_row(row, std::index_sequence_for<Ts...>()); }
+
+  row_reference at(size_type row)
+  {
+    if (row >= count)
+      throw std::out_of_range("out of range");
+    return (*this)[row];
+  }
+
+  const_row_reference at(size_type row) const
+  {
+    if (row >= count)
+      throw std::out_of_range("out of range");
+    return (*this)[row];
+  }
+
+  row_reference front() { return (*this)[0]; }
+  const_row_reference front() const { return (*this)[0]; }
+  row_reference back() { return (*this)[count-1]; }
+  const_row_reference back() const { return (*this)[count-1]; }
+
+  iterator begin() noexcept { return iterator(this, 0); }
+  const_iterator begin() const noexcept { return const_iterator(this, 0); }
+  iterator end() noexcept { return iterator(this, count); }
+  const_iterator end() const noexcept { return const_iterator(this, count); }
+
+  bool empty() const noexcept { return count == 0; }
+  size_type size() const noexcept { return count; }
+  size_type max_size() const noexcept { return row_limit; }
+
+  size_type capacity() const noexcept
+  {
+    return capacity(std::index_sequence_for<Ts...>());
+  }
+
+  void reserve(size_type new_cap)
+  {
+    if (new_cap <= capacity())
+      return;
+
+    if (new_cap > max_size())
+      throw std::bad_alloc();
+
+    size_t column_sizes[] = { (new_cap * sizeof(Ts))... };
+    for (size_t i = 0; i < column_count; i++)
+    {
+      // If a later column fails, the earlier ones just have some extra capacity, which is harmless
+      if (pinned_realloc(column_sizes[i], &columns[i]) != 0)
+        throw std::bad_alloc();
+    }
+  }
+
+  // One argument per column
+  template <class... Args>
+  row_reference emplace_back(Args&&... args)
+  {
+    static_assert(sizeof...(Args) == column_count, "emplace_back takes one value per column");
+
+    if (count == capacity())
+      reserve(std::max<size_t>(std::min(count * 2, max_size()), count + 1)); // throws once it's full
+
+    construct_row(count, std::index_sequence_for<Ts...>(), std::forward<Args>(args) ...);
+    count++;
+    return (*this)[count-1];
+  }
+
+  void push_back(const Ts&... values)
+  {
+    emplace_back(values...);
+  }
+
+  void pop_back()
+  {
+    count--;
+    destroy_row(count, column_count);
+  }
+
+  // New rows are value-initialised
+  void resize(size_type new_count)
+  {
+    if (new_count > count)
+    {
+      reserve(new_count);
+      for (; count < new_count; count++)
+        construct_row(count, std::index_sequence_for<Ts...>(), Ts()...);
+    }
+    else
+    {
+      while (count > new_count)
+        pop_back();
+    }
+  }
+
+  void clear() noexcept
+  {
+    while (count > 0)
+    {
+      count--;
+      destroy_row(count, column_count);
+    }
+  }
+
+private:
+  template <size_t... Is>
+  row_reference make_row(size_t row, std::index_sequence<Is...>)
+  {
+    return row_reference(column_data<Is>()[row]...);
+  }
+
+  template <size_t... Is>
+  const_row_reference make_row(size_t row, std::index_sequence<Is...>) const
+  {
+    return const_row_reference(column_data<Is>()[row]...);
+  }
+
+  template <size_t... Is>
+  size_t capacity(std::index_sequence<Is...>) const noexcept
+  {
+    return std::min({ (columns[Is].size / sizeof(Ts))... });
+  }
+
+  template <size_t... Is, class... Args>
+  void construct_row(size_t row, std::index_sequence<Is...>, Args&&... args)
+  {
+    size_t constructed = 0;
+    try
+    {
+      ((new (&column_data<Is>()[row]) column_type<Is>(std::forward<Args>(args)), constructed++), ...);
+    }
+    catch (...)
+    {
+      destroy_row(row, constructed);
+      throw;
+    }
+  }
+
+  // Destroy the first column_limit columns of a row
+  void destroy_row(size_t row, size_t column_limit) noexcept
+  {
+    destroy_row(row, column_limit, std::index_sequence_for<Ts...>());
+  }
+
+  template <size_t... Is>
+  void destroy_row(size_t row, size_t column_limit, std::index_sequence<Is...>) noexcept
+  {
+    ((Is < column_limit ? std::destroy_at(&column_data<Is>()[row]) : void()), ...);
+  }
+
+  pinned_alloc_info columns[column_count] = {};
+  size_t count = 0;
+  size_t row_limit = 0;
+};
@@ -0,0 +1,308 @@
+#pragma once
+#include "pinned.h"
+#include <cstdint>
+
+#ifdef _MSC_VER
+# include <intrin.h>
+#endif
+
+// A flat array indexed directly by key, for key spaces (32 or 40 bit ids, say) that are too big to allocate an array
+// for, but where the keys in use are clustered enough that most pages of such an array would be empty. The whole
+// array is reserved up front, and pages are only committed when something non-zero is first written to them, so it
+// costs about as much memory as the pages actually holding values, while lookups are still just an index.
+//
+//  pinned_sparse_array<uint64_t> parents(uint64_t(1) << 40); // 8 TiB of address space, nothing committed yet
+//  parents.set(id, parent);
+//  uint64_t p = parents[other_id]; // 0 if nothing was ever stored there
+//
+// Which pages are committed is kept in a bitmap (a bit per page, so 1/32768th of the array's size with 4 KiB pages),
+// which reads check before touching the array, so reading a key on a page that was never written returns 0 without
+// faulting anything in. Iterating skips uncommitted pages a whole bitmap word (64 pages) at a time.
+//
+// Unset slots hold all zero bytes, which is what T() is for numbers, pointers and structs of them, so T has to be
+// trivially copyable. When set() or reset() leave a whole page zero again, the page is decommitted, which means
+// scanning that page, so storing zeros is more expensive than storing anything else. Writes through ref() or an
+// iterator don't do that, call trim() afterwards to give back pages they zeroed. sizeof(T) has to be a power of 2 (up
+// to 4 KiB), so that no element straddles two pages. Like pinned_vec, none of this is thread safe.
+
+template <typename T>
+class pinned_sparse_array
+{
+public:
+  using key_type = uint64_t;
+  using value_type = T;
+
+  static_assert(std::is_trivially_copyable<T>::value, "pinned_sparse_array can only hold trivially copyable types");
+  static_assert(sizeof(T) <= 4096 && (sizeof(T) & (sizeof(T) - 1)) == 0, "sizeof(T) has to be a power of 2, up to 4 KiB");
+
+  // What iterators point to: a key, and the value stored for it
+  template <bool Const>
+  struct entry_t
+  {
+    key_type key;
+    typename std::conditional<Const, const T&, T&>::type value;
+  };
+
+  // Visits the keys with non-zero values, in key order
+  template <bool Const>
+  class iterator_t
+  {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using array_pointer = typename std::conditional<Const, const pinned_sparse_array*, pinned_sparse_array*>::type;
+    using value_type = entry_t<Const>;
+    using reference = entry_t<Const>;
+    using difference_type = ptrdiff_t;
+
+    iterator_t() = default;
+    iterator_t(array_pointer array, key_type key) : array(array), key(key) {}
+
+    reference operator*() const { return { key, array->data()[key] }; }
+    iterator_t& operator++() { key = array->next_in_use(key + 1); return *this; }
+    iterator_t operator++(int) { iterator_t old = *this; ++*this; return old; }
+    bool operator==(const iterator_t& other) const { return key == other.key; }
+    bool operator!=(const iterator_t& other) const { return key != other.key; }
+
+  private:
+    array_pointer array = nullptr;
+    key_type key = 0;
+  };
+
+  using iterator = iterator_t<false>;
+  using const_iterator = iterator_t<true>;
+
+  explicit pinned_sparse_array(key_type key_count, pinned_placement placement = {}) : key_count(key_count)
+  {
+    page_size = pinned_page_size();
+    while ((size_t(1) << page_shift) < page_size)
+      page_shift++;
+
+    if (key_count > SIZE_MAX / sizeof(T) - page_size)
+      throw std::bad_alloc();
+
+    size_t bytes = ((size_t(key_count) * sizeof(T) + page_size - 1) >> page_shift) << page_shift;
+    page_count = bytes >> page_shift;
+    if (pinned_alloc_placed(0, std::max(bytes, page_size), placement, &allocation) != 0)
+      throw std::bad_alloc();
+
+    size_t bitmap_bytes = std::max<size_t>((page_count + 63) / 64, 1) * sizeof(uint64_t);
+    if (pinned_alloc(bitmap_bytes, bitmap_bytes, &bitmap_allocation) != 0)
+    {
+      pinned_free(&allocation);
+      throw std::bad_alloc();
+    }
+  }
+
+  pinned_sparse_array(const pinned_sparse_array&) = delete;
+  pinned_sparse_array& operator=(const pinned_sparse_array&) = delete;
+
+  ~pinned_sparse_array()
+  {
+    pinned_free(&bitmap_allocation);
+    pinned_free(&allocation);
+  }
+
+  // 0 (all zero bytes) for keys that were never set
+  const T& operator[](key_type key) const
+  {
+    return page_committed(page_of(key)) ? data()[key] : zero_value();
+  }
+
+  const T& at(key_type key) const
+  {
+    if (key >= key_count)
+      throw std::out_of_range("out of range");
+    return (*this)[key];
+  }
+
+  // A reference to a key's slot, committing its page if it isn't already
+  T& ref(key_type key)
+  {
+    size_t page = page_of(key);
+    if (!page_committed(page))
+      commit_page(page);
+    return data()[key];
+  }
+
+  void set(key_type key, const T& value)
+  {
+    if (!is_zero(&value, sizeof(T)))
+    {
+      ref(key) = value;
+      return;
+    }
+
+    size_t page = page_of(key);
+    if (!page_committed(page))
+      return;
+
+    data()[key] = value;
+    release_if_zero(page);
+  }
+
+  void reset(key_type key)
+  {
+    set(key, zero_value());
+  }
+
+  // Whether the page holding key is committed, ie whether anything near it was ever set
+  bool is_committed(key_type key) const noexcept { return page_committed(page_of(key)); }
+
+  // Decommit every page that is all zeros, returns how many there were
+  size_t trim()
+  {
+    size_t released = 0;
+    for (size_t page = next_committed_page(0); page < page_count; page = next_committed_page(page + 1))
+    {
+      if (release_if_zero(page))
+        released++;
+    }
+    return released;
+  }
+
+  // Sets every key back to 0, decommitting everything
+  void clear()
+  {
+    for (size_t page = next_committed_page(0); page < page_count; page = next_committed_page(page + 1))
+      decommit_page(page);
+  }
+
+  iterator begin() noexcept { return iterator(this, next_in_use(0)); }
+  const_iterator begin() const noexcept { return const_iterator(this, next_in_use(0)); }
+  iterator end() noexcept { return iterator(this, key_count); }
+  const_iterator end() const noexcept { return const_iterator(this, key_count); }
+
+  // The number of keys, whether they're set or not
+  key_type size() const noexcept { return key_count; }
+
+  size_t committed_pages() const noexcept { return pages_in_use; }
+  size_t committed_bytes() const noexcept { return pages_in_use << page_shift; }
+  const pinned_alloc_info& allocation_info() const noexcept { return allocation; }
+
+private:
+  T* data() noexcept { return reinterpret_cast<T*>(allocation.data); }
+  const T* data() const noexcept { return reinterpret_cast<const T*>(allocation.data); }
+  uint64_t* bitmap() noexcept { return reinterpret_cast<uint64_t*>(bitmap_allocation.data); }
+  const uint64_t* bitmap() const noexcept { return reinterpret_cast<const uint64_t*>(bitmap_allocation.data); }
+
+  static const T& zero_value() noexcept
+  {
+    alignas(T) static const unsigned char zeros[sizeof(T)] = {};
+    return *reinterpret_cast<const T*>(zeros);
+  }
+
+  static bool is_zero(const void* memory, size_t size) noexcept
+  {
+    const unsigned char* bytes = static_cast<const unsigned char*>(memory);
+    for (size_t i = 0; i < size; i++)
+    {
+      if (bytes[i] != 0)
+        return false;
+    }
+    return true;
+  }
+
+  // Pages are a multiple of 8 bytes, so check them a word at a time
+  bool page_is_zero(size_t page) const noexcept
+  {
+    const uint64_t* words = reinterpret_cast<const uint64_t*>(static_cast<const char*>(allocation.data) + (page << page_shift));
+    for (size_t i = 0; i < page_size / sizeof(uint64_t); i++)
+    {
+      if (words[i] != 0)
+        return false;
+    }
+    return true;
+  }
+
+  size_t page_of(key_type key) const noexcept { return size_t(key * sizeof(T)) >> page_shift; }
+
+  bool page_committed(size_t page) const noexcept { return (bitmap()[page / 64] >> (page % 64)) & 1; }
+
+  static unsigned lowest_bit(uint64_t word) noexcept
+  {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, word);
+    return unsigned(index);
+#else
+    return unsigned(__builtin_ctzll(word));
+#endif
+  }
+
+  // The first committed page from page on, or page_count if there isn't one
+  size_t next_committed_page(size_t page) const noexcept
+  {
+    if (page >= page_count)
+      return page_count;
+
+    size_t word_index = page / 64;
+    uint64_t word = bitmap()[word_index] & (~uint64_t(0) << (page % 64));
+    size_t word_count = (page_count + 63) / 64;
+    while (word == 0)
+    {
+      if (++word_index == word_count)
+        return page_count;
+      word = bitmap()[word_index];
+    }
+    return std::min(word_index * 64 + lowest_bit(word), page_count);
+  }
+
+  // The first key from key on with a non-zero value, or key_count if there isn't one
+  key_type next_in_use(key_type key) const noexcept
+  {
+    const key_type keys_per_page = page_size / sizeof(T);
+    while (key < key_count)
+    {
+      size_t page = page_of(key);
+      if (!page_committed(page))
+      {
+        page = next_committed_page(page);
+        if (page == page_count)
+          return key_count;
+        key = key_type(page) * keys_per_page;
+      }
+
+      key_type page_end = std::min(key_type(page + 1) * keys_per_page, key_count);
+      for (; key < page_end; key++)
+      {
+        if (!is_zero(&data()[key], sizeof(T)))
+          return key;
+      }
+    }
+    return key_count;
+  }
+
+  void commit_page(size_t page)
+  {
+    int err = pinned_commit_range(page << page_shift, page_size, &allocation);
+    if (err != 0)
+      throw std::system_error(err, std::system_category());
+    bitmap()[page / 64] |= uint64_t(1) << (page % 64);
+    pages_in_use++;
+  }
+
+  void decommit_page(size_t page)
+  {
+    int err = pinned_decommit_range(page << page_shift, page_size, &allocation);
+    if (err != 0)
+      throw std::system_error(err, std::system_category());
+    bitmap()[page / 64] &= ~(uint64_t(1) << (page % 64));
+    pages_in_use--;
+  }
+
+  bool release_if_zero(size_t page)
+  {
+    if (!page_is_zero(page))
+      return false;
+    decommit_page(page);
+    return true;
+  }
+
+  pinned_alloc_info allocation = {};
+  pinned_alloc_info bitmap_allocation = {}; // a bit per page, set if it's committed
+  key_type key_count = 0;
+  size_t page_count = 0;
+  size_t page_size = 0;
+  unsigned page_shift = 0;
+  size_t pages_in_use = 0;
+};
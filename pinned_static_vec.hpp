@@ -0,0 +1,287 @@
+#pragma once
+#include "pinned.h"
+#include <cstdint>
+
+// A pinned_vec with its max size and page size fixed at compile time, for when there are lots of vectors and the size of
+// each one, and the cost of push_back(), matter. A pinned_vec carries a whole pinned_alloc_info around (max size, NUMA
+// placement, file backing, ...), and works out its capacity by dividing the committed size by sizeof(T). This one only
+// keeps a pointer, the size and capacity in elements (as 32 bit numbers when max_size() fits in them), and the
+// allocation's slot in the residency registry, so it's 24 bytes instead of 96, and push_back() is a compare and a store
+// unless it has to commit more pages. Page rounding is done with masks on the compile-time PageSize.
+//
+//  pinned_static_vec<edge, 1024 * 1024> edges; // at most 1 MiB of edges
+//
+// Nothing is reserved until the first element goes in, so empty vectors cost no syscalls at all. The reservation is
+// always anonymous memory with the default placement. PageSize has to be a multiple of pinned_page_size(), which the
+// constructor checks when the vector first reserves, and MaxBytes a multiple of PageSize.
+
+#ifdef _WIN32
+# define PINNED_STATIC_PAGE_SIZE (64 * 1024) // pinned_page_size() is the allocation granularity on windows
+#else
+# define PINNED_STATIC_PAGE_SIZE 4096
+#endif
+
+template <typename T, size_t MaxBytes, size_t PageSize = PINNED_STATIC_PAGE_SIZE, typename Growth = pinned_growth_chunked<>>
+class pinned_static_vec
+{
+public:
+  using value_type = T;
+  using size_type = size_t;
+  using difference_type = ptrdiff_t;
+  using reference = T&;
+  using const_reference = const T&;
+  using pointer = T*;
+  using const_pointer = const T*;
+  using iterator = T*;
+  using const_iterator = const T*;
+  using reverse_iterator = std::reverse_iterator<iterator>;
+  using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+  static_assert(PageSize != 0 && (PageSize & (PageSize - 1)) == 0, "PageSize has to be a power of 2");
+  static_assert(MaxBytes != 0 && MaxBytes % PageSize == 0, "MaxBytes has to be a multiple of PageSize");
+  static_assert(MaxBytes >= sizeof(T), "MaxBytes has to fit at least one element");
+
+  static constexpr size_t element_limit = MaxBytes / sizeof(T);
+
+  pinned_static_vec() noexcept = default;
+
+  explicit pinned_static_vec(size_t count)
+  {
+    resize(count);
+  }
+
+  pinned_static_vec(size_type count, const T& value)
+  {
+    resize(count, value);
+  }
+
+  pinned_static_vec(const pinned_static_vec&) = delete;
+  pinned_static_vec& operator=(const pinned_static_vec&) = delete;
+
+  // The moved from vector is left empty, with nothing reserved
+  pinned_static_vec(pinned_static_vec&& other) noexcept
+  {
+    swap(other);
+  }
+
+  pinned_static_vec& operator=(pinned_static_vec&& other) noexcept
+  {
+    pinned_static_vec taken(std::move(other));
+    swap(taken);
+    return *this;
+  }
+
+  ~pinned_static_vec()
+  {
+    if (!elements)
+      return;
+
+    resize(0);
+    pinned_alloc_info allocation = allocation_info();
+    pinned_free(&allocation);
+  }
+
+  reference at(size_type pos)
+  {
+    if (pos >= size())
+      throw std::out_of_range("out of range");
+    return elements[pos];
+  }
+
+  const_reference at(size_type pos) const
+  {
+    if (pos >= size())
+      throw std::out_of_range("out of range");
+    return elements[pos];
+  }
+
+  reference operator[](size_type pos) { return elements[pos]; }
+  const_reference operator[](size_type pos) const { return elements[pos]; }
+
+  reference front() { return elements[0]; }
+  const_reference front() const { return elements[0]; }
+
+  reference back() { return elements[count-1]; }
+  const_reference back() const { return elements[count-1]; }
+
+  pointer data() noexcept { return elements; }
+  const_pointer data() const noexcept { return elements; }
+
+  iterator begin() noexcept { return elements; }
+  const_iterator begin() const noexcept { return elements; }
+  const_iterator cbegin() const noexcept { return elements; }
+
+  iterator end() noexcept { return elements + count; }
+  const_iterator end() const noexcept { return elements + count; }
+  const_iterator cend() const noexcept { return elements + count; }
+
+  reverse_iterator rbegin() noexcept { return reverse_iterator(end()); }
+  const_reverse_iterator rbegin() const noexcept { return const_reverse_iterator(end()); }
+  const_reverse_iterator crbegin() const noexcept { return const_reverse_iterator(cend()); }
+
+  reverse_iterator rend() noexcept { return reverse_iterator(begin()); }
+  const_reverse_iterator rend() const noexcept { return const_reverse_iterator(begin()); }
+  const_reverse_iterator crend() const noexcept { return const_reverse_iterator(cbegin()); }
+
+  bool empty() const noexcept { return count == 0; }
+  size_type size() const noexcept { return count; }
+  static constexpr size_type max_size() noexcept { return element_limit; }
+  size_type capacity() const noexcept { return element_capacity; }
+
+  // What the C functions need to see this vector's memory, eg for pinned_get_residency(). Made up on the spot, so
+  // resizing it with pinned_realloc() won't be seen by the vector.
+  pinned_alloc_info allocation_info() const noexcept
+  {
+    pinned_alloc_info allocation = {};
+    allocation.data = elements;
+    allocation.size = committed_bytes(element_capacity);
+    allocation.max_size = elements ? MaxBytes : 0;
+    allocation.registry_slot = registry_slot;
+#ifndef _WIN32
+    allocation.fd = -1;
+#endif
+    return allocation;
+  }
+
+  // Commits exactly enough pages for new_cap elements
+  void reserve(size_type new_cap)
+  {
+    if (new_cap <= capacity())
+      return;
+
+    if (new_cap > max_size())
+      throw std::bad_alloc();
+
+    pinned_alloc_info allocation = allocation_info();
+    if (!elements)
+    {
+      if (PageSize % pinned_page_size() != 0)
+        throw std::system_error(std::make_error_code(std::errc::invalid_argument));
+      if (pinned_alloc(committed_bytes(new_cap), MaxBytes, &allocation) != 0)
+        throw std::bad_alloc();
+    }
+    else if (pinned_realloc(committed_bytes(new_cap), &allocation) != 0)
+    {
+      throw std::bad_alloc();
+    }
+
+    // Capacity is what was asked for rather than everything that fits in the pages, so the committed size can always
+    // be worked out from it
+    elements = reinterpret_cast<T*>(allocation.data);
+    element_capacity = index_type(new_cap);
+    registry_slot = allocation.registry_slot;
+  }
+
+  void shrink_to_fit()
+  {
+    if (!elements || committed_bytes(count) == committed_bytes(element_capacity))
+      return;
+
+    pinned_alloc_info allocation = allocation_info();
+    if (pinned_realloc(committed_bytes(count), &allocation) != 0)
+      throw std::bad_alloc();
+    element_capacity = count;
+  }
+
+  void clear() noexcept
+  {
+    resize(0);
+  }
+
+  template<class... Args>
+  reference emplace_back(Args&&... args)
+  {
+    if (count == element_capacity)
+      grow();
+
+    new (&elements[count]) T(std::forward<Args>(args) ...);
+    count++;
+    return elements[count-1];
+  }
+
+  void push_back(const T& value)
+  {
+    if (count == element_capacity)
+      grow();
+
+    new (&elements[count]) T(value);
+    count++;
+  }
+
+  void push_back(T&& value)
+  {
+    if (count == element_capacity)
+      grow();
+
+    new (&elements[count]) T(std::move(value));
+    count++;
+  }
+
+  void pop_back()
+  {
+    count--;
+    elements[count].~T();
+  }
+
+  // New elements are value-initialised
+  void resize(size_type new_count)
+  {
+    if (new_count > count)
+    {
+      reserve(new_count);
+      for (; count < new_count; count++)
+        new (&elements[count]) T();
+    }
+    else
+    {
+      while (count > new_count)
+        pop_back();
+    }
+  }
+
+  void resize(size_type new_count, const value_type& value)
+  {
+    if (new_count > count)
+    {
+      // Growing never moves anything, so value stays valid even if it's one of ours
+      reserve(new_count);
+      for (; count < new_count; count++)
+        new (&elements[count]) T(value);
+    }
+    else
+    {
+      while (count > new_count)
+        pop_back();
+    }
+  }
+
+  void swap(pinned_static_vec& other) noexcept
+  {
+    std::swap(elements, other.elements);
+    std::swap(count, other.count);
+    std::swap(element_capacity, other.element_capacity);
+    std::swap(registry_slot, other.registry_slot);
+  }
+
+private:
+  using index_type = typename std::conditional<(element_limit <= UINT32_MAX), uint32_t, size_t>::type;
+
+  static constexpr size_t page_mask = PageSize - 1;
+
+  static constexpr size_t committed_bytes(size_t element_count) noexcept
+  {
+    return (element_count * sizeof(T) + page_mask) & ~page_mask;
+  }
+
+  // Kept out of push_back(), so that the common case stays small enough to inline
+  void grow()
+  {
+    size_t bytes = std::min<size_t>(Growth::next_size(committed_bytes(element_capacity), (size_t(count) + 1) * sizeof(T)), MaxBytes);
+    reserve(std::max<size_t>(bytes / sizeof(T), size_t(count) + 1));
+  }
+
+  T* elements = nullptr;
+  index_type count = 0;
+  index_type element_capacity = 0;
+  size_t registry_slot = PINNED_NO_REGISTRY_SLOT;
+};
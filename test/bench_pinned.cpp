@@ -1,10 +1,244 @@
 #include <vector>
+#include <array>
 #include <chrono>
+#include <cstring>
 #include <cassert>
+#include <cmath>
+#include <string>
 #include "../pinned.h"
+#include "../pinned_small_vec.hpp"
+#include "../pinned_static_vec.hpp"
+#include "../concurrent_pinned_vec.hpp"
+#include "../pinned_hash_map.hpp"
+#include "../pinned_arena.hpp"
+#include "../pinned_pool.hpp"
+#include "../pinned_soa.hpp"
+#include "../pinned_io_buffer.hpp"
+#include "../pinned_sparse_array.hpp"
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#ifdef _WIN32
+# define WIN32_LEAN_AND_MEAN
+# include <Windows.h>
+# include <psapi.h>
+#else
+# include <sys/resource.h>
+#endif
+
+// Every case runs a number of times, and we report the mean, spread and so on of those runs, plus the page faults and
+// pinned syscalls (from pinned_get_stats) they caused, and the peak RSS of the process so far. Results are printed as
+// they come, or as one JSON document at the end with --json, for tracking regressions:
+//
+//  bench_pinned [--json] [--repetitions N] [--filter TEXT] [--large]
+//
+// --filter only runs cases whose group or variant name contains TEXT, and --large adds the cases that need several GiB
+// of RAM or lots of cores.
+
+struct benchOptions
+{
+  int repetitions = 5;
+  bool json = false;
+  bool large = false;
+  const char* filter = nullptr;
+};
+
+static benchOptions options;
+
+struct processCounters
+{
+  long long minorFaults = 0;
+  long long majorFaults = 0;
+  long long peakRssKiB = 0;
+  unsigned long long pinnedSyscalls = 0;
+};
+
+static processCounters readCounters()
+{
+  processCounters counters;
+#ifdef _WIN32
+  // Windows doesn't split faults into minor and major
+  PROCESS_MEMORY_COUNTERS memory;
+  if (GetProcessMemoryInfo(GetCurrentProcess(), &memory, sizeof(memory)))
+  {
+    counters.minorFaults = memory.PageFaultCount;
+    counters.peakRssKiB = (long long)(memory.PeakWorkingSetSize / 1024);
+  }
+#else
+  rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0)
+  {
+    counters.minorFaults = usage.ru_minflt;
+    counters.majorFaults = usage.ru_majflt;
+    counters.peakRssKiB = usage.ru_maxrss;
+  }
+#endif
+
+  pinned_stats stats;
+  pinned_get_stats(&stats);
+  counters.pinnedSyscalls = stats.mmap_calls + stats.mprotect_calls + stats.munmap_calls;
+  return counters;
+}
+
+struct benchResult
+{
+  std::string group;
+  std::string variant;
+  std::string unit;
+  std::vector<double> samples;
+
+  double mean = 0;
+  double stddev = 0;
+  double min = 0;
+  double median = 0;
+  double max = 0;
+
+  // Per repetition
+  double minorFaults = 0;
+  double majorFaults = 0;
+  double pinnedSyscalls = 0;
+
+  // The peak over the whole process so far, the OS can't reset it between cases
+  long long peakRssKiB = 0;
+};
+
+static std::vector<benchResult> results;
+
+static void summarize(benchResult& result)
+{
+  std::vector<double> sorted = result.samples;
+  std::sort(sorted.begin(), sorted.end());
+  size_t n = sorted.size();
+
+  double sum = 0;
+  for (double sample : sorted)
+    sum += sample;
+  result.mean = sum / double(n);
+
+  double squares = 0;
+  for (double sample : sorted)
+    squares += (sample - result.mean) * (sample - result.mean);
+  result.stddev = n > 1 ? std::sqrt(squares / double(n - 1)) : 0;
+
+  result.min = sorted.front();
+  result.max = sorted.back();
+  result.median = n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+}
+
+static void printResult(const benchResult& result)
+{
+  static std::string lastGroup;
+  if (result.group != lastGroup)
+  {
+    if (!lastGroup.empty())
+      puts("");
+    printf("# %s\n", result.group.c_str());
+    lastGroup = result.group;
+  }
+
+  double spread = result.mean != 0 ? 100.0 * result.stddev / result.mean : 0;
+  printf("%-22s %10.2f %-22s +-%5.1f%%  %10.0f faults  %8.0f syscalls\n", (result.variant + ":").c_str(), result.mean,
+         result.unit.c_str(), spread, result.minorFaults + result.majorFaults, result.pinnedSyscalls);
+}
+
+// Runs one repetition() per repetition, each returning the number to report (in unit)
+template <typename Func>
+void measure(const std::string& group, const char* variant, const char* unit, Func repetition)
+{
+  if (options.filter && (group + " " + variant).find(options.filter) == std::string::npos)
+    return;
+
+  benchResult result;
+  result.group = group;
+  result.variant = variant;
+  result.unit = unit;
+
+  processCounters before = readCounters();
+  for (int i = 0; i < options.repetitions; i++)
+    result.samples.push_back(repetition());
+  processCounters after = readCounters();
+
+  summarize(result);
+  result.minorFaults = double(after.minorFaults - before.minorFaults) / options.repetitions;
+  result.majorFaults = double(after.majorFaults - before.majorFaults) / options.repetitions;
+  result.pinnedSyscalls = double(after.pinnedSyscalls - before.pinnedSyscalls) / options.repetitions;
+  result.peakRssKiB = after.peakRssKiB;
+
+  if (!options.json)
+    printResult(result);
+  results.push_back(std::move(result));
+}
+
+static void printJsonString(const std::string& text)
+{
+  putchar('"');
+  for (char c : text)
+  {
+    if (c == '"' || c == '\\')
+      putchar('\\');
+    putchar(c);
+  }
+  putchar('"');
+}
+
+static void printJson()
+{
+  printf("{\n  \"repetitions\": %d,\n  \"results\": [", options.repetitions);
+  for (size_t i = 0; i < results.size(); i++)
+  {
+    const benchResult& result = results[i];
+    printf("%s\n    { \"group\": ", i ? "," : "");
+    printJsonString(result.group);
+    printf(", \"variant\": ");
+    printJsonString(result.variant);
+    printf(", \"unit\": ");
+    printJsonString(result.unit);
+    printf(", \"mean\": %.6g, \"stddev\": %.6g, \"min\": %.6g, \"median\": %.6g, \"max\": %.6g, \"samples\": [",
+           result.mean, result.stddev, result.min, result.median, result.max);
+    for (size_t j = 0; j < result.samples.size(); j++)
+      printf("%s%.6g", j ? ", " : "", result.samples[j]);
+    printf("], \"minor_faults\": %.1f, \"major_faults\": %.1f, \"pinned_syscalls\": %.1f, \"peak_rss_kib\": %lld }",
+           result.minorFaults, result.majorFaults, result.pinnedSyscalls, result.peakRssKiB);
+  }
+  printf("\n  ]\n}\n");
+}
+
+template <typename Duration>
+double nanoseconds(Duration duration)
+{
+  return double(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count());
+}
+
+template <typename Duration>
+double milliseconds(Duration duration)
+{
+  return nanoseconds(duration) / 1e6;
+}
+
+template <typename... Args>
+std::string format(const char* pattern, Args... args)
+{
+  char buffer[256];
+  snprintf(buffer, sizeof(buffer), pattern, args...);
+  return buffer;
+}
+
+// Different sizes of element, and one that isn't trivial
+struct benchBlob
+{
+  uint64_t words[8];
+};
+
+template <typename T> T makeValue(uint32_t i);
+template <> uint8_t makeValue<uint8_t>(uint32_t i) { return uint8_t(i); }
+template <> uint32_t makeValue<uint32_t>(uint32_t i) { return i; }
+template <> uint64_t makeValue<uint64_t>(uint32_t i) { return i; }
+template <> benchBlob makeValue<benchBlob>(uint32_t i) { return benchBlob{ { i, i, i, i, i, i, i, i } }; }
+template <> std::string makeValue<std::string>(uint32_t i) { return std::to_string(i); }
 
 template <typename Vec>
-auto bench(size_t initialCapacity, uint64_t iterations)
+double benchReserveDoubling(size_t initialCapacity, uint64_t iterations)
 {
   auto start = std::chrono::high_resolution_clock::now();
 
@@ -23,47 +257,848 @@ auto bench(size_t initialCapacity, uint64_t iterations)
     }
   }
 
+  return nanoseconds(std::chrono::high_resolution_clock::now() - start) / double(iterations);
+}
+
+// push_back, reserving twice the capacity every time it fills up
+void benchPushBackBytes(size_t initialCapacity, size_t bytes)
+{
+  std::string group = bytes >= 1024 * 1024 ? format("push_back uint32_t, %zu MiB", bytes / (1024 * 1024))
+                                           : format("push_back uint32_t, %zu KiB", bytes / 1024);
+  uint64_t iterations = bytes / sizeof(uint32_t);
+
+  measure(group, "std::vector", "ns per element", [&]() { return benchReserveDoubling<std::vector<uint32_t>>(initialCapacity, iterations); });
+  measure(group, "pinned_vec", "ns per element", [&]() { return benchReserveDoubling<pinned_vec<uint32_t>>(initialCapacity, iterations); });
+}
+
+template <typename Vec>
+double benchPushBack(uint32_t elements)
+{
+  using T = typename Vec::value_type;
+  auto start = std::chrono::high_resolution_clock::now();
+
+  {
+    Vec v;
+    for (uint32_t i = 0; i < elements; i++)
+      v.push_back(makeValue<T>(i));
+  }
+
+  return nanoseconds(std::chrono::high_resolution_clock::now() - start) / elements;
+}
+
+// Plain push_back (and destruction), letting the vector grow however it likes
+template <typename T>
+void benchPushBackType(const char* typeName, uint32_t elements)
+{
+  std::string group = format("push_back %u %s", elements, typeName);
+  measure(group, "std::vector", "ns per element", [&]() { return benchPushBack<std::vector<T>>(elements); });
+  measure(group, "pinned_vec", "ns per element", [&]() { return benchPushBack<pinned_vec<T>>(elements); });
+}
+
+template <typename Vec>
+double benchChurn(uint32_t vectors, uint32_t elements)
+{
+  auto start = std::chrono::high_resolution_clock::now();
+
+  uint64_t sum = 0;
+  for (uint32_t i = 0; i < vectors; i++)
+  {
+    Vec v;
+    for (uint32_t j = 0; j < elements; j++)
+      v.push_back(j);
+    sum += v.size();
+  }
+
+  auto duration = std::chrono::high_resolution_clock::now() - start;
+  assert(sum == uint64_t(vectors) * elements);
+  (void)sum;
+  return nanoseconds(duration) / vectors;
+}
+
+// Construct, fill and destroy lots of small vectors
+void benchSmallVectors(uint32_t elements)
+{
+  constexpr uint32_t vectors = 20000;
+
+  std::string group = format("%u vectors of %u elements", vectors, elements);
+  measure(group, "std::vector", "ns per vector", [&]() { return benchChurn<std::vector<uint32_t>>(vectors, elements); });
+  measure(group, "pinned_vec", "ns per vector", [&]() { return benchChurn<pinned_vec<uint32_t>>(vectors, elements); });
+  measure(group, "pinned_small_vec<8>", "ns per vector", [&]() { return benchChurn<pinned_small_vec<uint32_t, 8>>(vectors, elements); });
+  measure(group, "pinned_static_vec", "ns per vector", [&]() { return benchChurn<pinned_static_vec<uint32_t, 1024 * 1024>>(vectors, elements); });
+}
+
+// Lots of vectors alive at once, appended to round robin, so every push_back touches a different vector
+template <typename Vec>
+double benchRoundRobin(uint32_t vectors, uint32_t elements)
+{
+  std::vector<Vec> all(vectors);
+  auto start = std::chrono::high_resolution_clock::now();
+
+  for (uint32_t j = 0; j < elements; j++)
+  {
+    for (Vec& v : all)
+      v.push_back(j);
+  }
+
+  return nanoseconds(std::chrono::high_resolution_clock::now() - start) / (double(vectors) * elements);
+}
+
+void benchManyVectors(uint32_t vectors, uint32_t elements)
+{
+  std::string group = format("%u live vectors, %u push_backs each, round robin", vectors, elements);
+  measure(group, "pinned_vec", "ns per push", [&]() { return benchRoundRobin<pinned_vec<uint32_t>>(vectors, elements); });
+  measure(group, "pinned_static_vec", "ns per push", [&]() { return benchRoundRobin<pinned_static_vec<uint32_t, 1024 * 1024>>(vectors, elements); });
+  measure(group, "pinned_small_vec<8>", "ns per push", [&]() { return benchRoundRobin<pinned_small_vec<uint32_t, 8>>(vectors, elements); });
+}
+
+enum class position { front, middle, back, random };
+
+template <typename Vec>
+double benchInsertErase(uint32_t elements, uint32_t operations, position where)
+{
+  Vec v;
+  for (uint32_t i = 0; i < elements; i++)
+    v.push_back(i);
+
+  uint32_t seed = 1;
+  auto start = std::chrono::high_resolution_clock::now();
+
+  for (uint32_t i = 0; i < operations; i++)
+  {
+    size_t pos = 0;
+    switch (where)
+    {
+      case position::front: pos = 0; break;
+      case position::middle: pos = v.size() / 2; break;
+      case position::back: pos = v.size() - 1; break;
+      case position::random:
+        seed = seed * 1664525 + 1013904223;
+        pos = (seed >> 8) % v.size();
+        break;
+    }
+
+    if (i % 2 == 0)
+      v.insert(v.begin() + pos, i);
+    else
+      v.erase(v.begin() + pos);
+  }
+
+  return nanoseconds(std::chrono::high_resolution_clock::now() - start) / operations;
+}
+
+// Alternating inserts and erases, on a vector that stays about the same size
+void benchInsertEraseElements(uint32_t elements, position where)
+{
+  constexpr uint32_t operations = 20000;
+  const char* names[] = { "front", "middle", "back", "random positions" };
+
+  std::string group = format("insert / erase at %s in %u elements", names[int(where)], elements);
+  measure(group, "std::vector", "ns per operation", [&]() { return benchInsertErase<std::vector<uint32_t>>(elements, operations, where); });
+  measure(group, "pinned_vec", "ns per operation", [&]() { return benchInsertErase<pinned_vec<uint32_t>>(elements, operations, where); });
+}
+
+template <typename Vec>
+double benchResizeCycles(uint32_t elements, uint32_t cycles)
+{
+  Vec v;
+  auto start = std::chrono::high_resolution_clock::now();
+
+  for (uint32_t i = 0; i < cycles; i++)
+  {
+    v.resize(elements);
+    v.resize(0);
+  }
+
+  return nanoseconds(std::chrono::high_resolution_clock::now() - start) / (double(elements) * cycles);
+}
+
+// Growing to a size and back down to nothing, over and over, which is where committing and zeroing pages shows up
+template <typename T>
+void benchResize(const char* typeName, uint32_t elements)
+{
+  constexpr uint32_t cycles = 20;
+
+  std::string group = format("resize 0 -> %u -> 0 %s", elements, typeName);
+  measure(group, "std::vector", "ns per element", [&]() { return benchResizeCycles<std::vector<T>>(elements, cycles); });
+  measure(group, "pinned_vec", "ns per element", [&]() { return benchResizeCycles<pinned_vec<T>>(elements, cycles); });
+}
+
+template <typename T>
+double benchFreshResize(size_t elements, bool parallel)
+{
+  auto start = std::chrono::high_resolution_clock::now();
+
+  pinned_vec<T> v(pinned_placement{}, PINNED_MAXSIZE_LARGE);
+  if (parallel)
+    v.resize(elements, pinned_parallel);
+  else
+    v.resize(elements);
+
+  // Touch every page, so the serial version pays for its page faults too
+  for (size_t i = 0; i < elements; i += pinned_page_size() / sizeof(T))
+    v[i] = T();
+
+  return milliseconds(std::chrono::high_resolution_clock::now() - start);
+}
+
+// Resizing a new vector and touching all of it, which is mostly page faults
+void benchParallelResize(size_t bytes)
+{
+  std::string group = format("resize a new pinned_vec to %zu MiB and touch it, %u cores", bytes / (1024 * 1024), std::thread::hardware_concurrency());
+  measure(group, "uint64_t resize()", "ms", [&]() { return benchFreshResize<uint64_t>(bytes / sizeof(uint64_t), false); });
+  measure(group, "uint64_t parallel", "ms", [&]() { return benchFreshResize<uint64_t>(bytes / sizeof(uint64_t), true); });
+  measure(group, "std::string resize()", "ms", [&]() { return benchFreshResize<std::string>(bytes / sizeof(std::string), false); });
+  measure(group, "std::string parallel", "ms", [&]() { return benchFreshResize<std::string>(bytes / sizeof(std::string), true); });
+}
+
+// Taking a consistent copy of a big vector, and then writing to some of it
+void benchSnapshot(size_t bytes)
+{
+  constexpr size_t writes = 1000;
+  size_t elements = bytes / sizeof(uint64_t);
+
+  pinned_vec<uint64_t> v(pinned_shared);
+  v.resize(elements, 1);
+
+  auto writeSome = [&]()
+  {
+    for (size_t i = 0; i < writes; i++)
+      v[(i * 7919 * 512) % elements]++;
+  };
+
+  std::string group = format("copy of %zu MiB, then %zu scattered writes", bytes / (1024 * 1024), writes);
+  measure(group, "pinned_vec copy", "ms", [&]()
+  {
+    auto start = std::chrono::high_resolution_clock::now();
+    pinned_vec<uint64_t> copy;
+    copy.append(v.begin(), v.end());
+    writeSome();
+    return milliseconds(std::chrono::high_resolution_clock::now() - start);
+  });
+  measure(group, "snapshot()", "ms", [&]()
+  {
+    auto start = std::chrono::high_resolution_clock::now();
+    pinned_snapshot_view<uint64_t> snapshot = v.snapshot();
+    writeSome();
+    return milliseconds(std::chrono::high_resolution_clock::now() - start);
+  });
+}
+
+// push_back throughput with a growth policy. Returns the bytes committed at the end.
+template <typename Growth>
+size_t benchGrowthPolicy(const std::string& group, const char* policyName, size_t bytes)
+{
+  size_t elements = bytes / sizeof(uint64_t);
+  size_t committed = 0;
+
+  measure(group, policyName, "ns/element", [&]()
+  {
+    auto start = std::chrono::high_resolution_clock::now();
+    pinned_vec<uint64_t, Growth> v;
+    for (size_t i = 0; i < elements; i++)
+      v.push_back(i);
+    double result = nanoseconds(std::chrono::high_resolution_clock::now() - start) / double(elements);
+    committed = v.allocation_info().size;
+    return result;
+  });
+  return committed;
+}
+
+// What each growth policy costs in push_back throughput, and how much it leaves committed (which is what counts against
+// the commit limit, and what the vector can fill without another syscall)
+void benchGrowthPolicies(size_t bytes)
+{
+  std::string group = format("push_back of %zu MiB, per growth policy", bytes / (1024 * 1024));
+  const char* names[] = { "doubling", "step 2 MiB", "chunked 25% (default)", "chunked 10%, 1 MiB" };
+  size_t committed[] =
+  {
+    benchGrowthPolicy<pinned_growth_doubling>(group, names[0], bytes),
+    benchGrowthPolicy<pinned_growth_step<>>(group, names[1], bytes),
+    benchGrowthPolicy<pinned_growth_chunked<>>(group, names[2], bytes),
+    benchGrowthPolicy<pinned_growth_chunked<10, 1024 * 1024>>(group, names[3], bytes),
+  };
+
+  group = format("committed after push_back of %zu MiB, per growth policy", bytes / (1024 * 1024));
+  for (size_t i = 0; i < 4; i++)
+    measure(group, names[i], "MiB", [&]() { return double(committed[i]) / (1024 * 1024); });
+}
+
+// push_back past a small max_size, relocating with pinned_relocate() each time it's reached, against reserving enough
+// address space up front, and std::vector (which copies every time it grows)
+void benchRelocate(size_t bytes)
+{
+  size_t elements = bytes / sizeof(uint64_t);
+  std::string group = format("push_back of %zu MiB, growing the reservation", bytes / (1024 * 1024));
+
+  measure(group, "std::vector", "ns/element", [&]()
+  {
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<uint64_t> v;
+    for (size_t i = 0; i < elements; i++)
+      v.push_back(i);
+    return nanoseconds(std::chrono::high_resolution_clock::now() - start) / double(elements);
+  });
+  measure(group, "max_size up front", "ns/element", [&]()
+  {
+    auto start = std::chrono::high_resolution_clock::now();
+    pinned_vec<uint64_t> v(pinned_placement(), PINNED_MAXSIZE_HUGE);
+    for (size_t i = 0; i < elements; i++)
+      v.push_back(i);
+    return nanoseconds(std::chrono::high_resolution_clock::now() - start) / double(elements);
+  });
+  measure(group, "relocate from 64 KiB", "ns/element", [&]()
+  {
+    auto start = std::chrono::high_resolution_clock::now();
+    pinned_vec<uint64_t> v(pinned_placement(), 64 * 1024);
+    v.on_relocate([](uint64_t*, uint64_t*, void*) {});
+    for (size_t i = 0; i < elements; i++)
+      v.push_back(i);
+    return nanoseconds(std::chrono::high_resolution_clock::now() - start) / double(elements);
+  });
+}
+
+void benchSplice(size_t bytes)
+{
+  size_t elements = bytes / sizeof(uint64_t);
+
+  std::string group = format("concatenating two %zu MiB vectors", bytes / (1024 * 1024));
+  measure(group, "append()", "ms", [&]()
+  {
+    pinned_vec<uint64_t> a(elements);
+    pinned_vec<uint64_t> b(elements);
+    std::fill(a.begin(), a.end(), 1);
+    std::fill(b.begin(), b.end(), 2);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    a.append(b.begin(), b.end());
+    b.clear();
+    return milliseconds(std::chrono::high_resolution_clock::now() - start);
+  });
+  measure(group, "splice()", "ms", [&]()
+  {
+    pinned_vec<uint64_t> a(elements);
+    pinned_vec<uint64_t> b(elements);
+    std::fill(a.begin(), a.end(), 1);
+    std::fill(b.begin(), b.end(), 2);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    a.splice(b);
+    return milliseconds(std::chrono::high_resolution_clock::now() - start);
+  });
+}
+
+#ifndef _WIN32
+// Sum the file's bytes as 64 bit words, so every variant has to actually get the whole file into memory
+static uint64_t sumWords(const char* data, size_t size)
+{
+  uint64_t sum = 0;
+  for (size_t i = 0; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+  {
+    uint64_t word;
+    memcpy(&word, data + i, sizeof(word));
+    sum += word;
+  }
+  return sum;
+}
+
+// A big vector where only 1/16th is in use, with and without the cold page tier. Returns ns per access, and fills in
+// what's resident at the end.
+double benchSkewedAccess(size_t bytes, bool cold, size_t& residentBytes)
+{
+  size_t elements = bytes / sizeof(uint64_t);
+  pinned_vec<uint64_t> v;
+  v.resize_uninitialized(elements);
+  for (size_t i = 0; i < elements; i++)
+    v[i] = i / 512;
+  if (cold)
+    v.enable_cold_pages();
+
+  const size_t accesses = 4000000;
+  uint64_t seed = 1, sum = 0;
+  auto start = std::chrono::high_resolution_clock::now();
+  for (int round = 0; round < 4; round++)
+  {
+    for (size_t i = 0; i < accesses / 4; i++)
+    {
+      seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+      sum += v[size_t(seed >> 33) % (elements / 16)];
+    }
+    if (cold)
+      v.sweep_cold_pages();
+  }
+  double result = nanoseconds(std::chrono::high_resolution_clock::now() - start) / double(accesses);
+
+  residentBytes = v.residency().resident_bytes;
+  assert(sum != 0);
+  (void)sum;
+  return result;
+}
+
+void benchColdPages(size_t bytes)
+{
+  std::string group = format("random reads from 1/16th of a %zu MiB vector", bytes / (1024 * 1024));
+  size_t resident[2] = {};
+  measure(group, "cold tier off", "ns per read", [&]() { return benchSkewedAccess(bytes, false, resident[0]); });
+  measure(group, "cold tier on", "ns per read", [&]() { return benchSkewedAccess(bytes, true, resident[1]); });
+
+  group = format("resident after reads from 1/16th of a %zu MiB vector", bytes / (1024 * 1024));
+  measure(group, "cold tier off", "MiB", [&]() { return double(resident[0]) / (1024 * 1024); });
+  measure(group, "cold tier on", "MiB", [&]() { return double(resident[1]) / (1024 * 1024); });
+}
+
+// Keeping a copy of a big vector up to date while a few of its pages change between copies
+void benchDirtyReplication(size_t bytes, size_t writes)
+{
+  size_t elements = bytes / sizeof(uint64_t);
+  pinned_vec<uint64_t> v(elements);
+  std::vector<uint64_t> replica(elements);
+
+  auto writeSome = [&](uint64_t& seed)
+  {
+    for (size_t i = 0; i < writes; i++)
+    {
+      seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+      v[size_t(seed >> 33) % elements] = seed;
+    }
+  };
+
+  std::string group = format("%zu random writes, then updating a copy of a %zu MiB vector", writes, bytes / (1024 * 1024));
+  measure(group, "copy everything", "ms", [&]()
+  {
+    uint64_t seed = 1;
+    auto start = std::chrono::high_resolution_clock::now();
+    writeSome(seed);
+    memcpy(replica.data(), v.data(), bytes);
+    return milliseconds(std::chrono::high_resolution_clock::now() - start);
+  });
+  v.enable_dirty_tracking();
+  measure(group, "copy dirty pages", "ms", [&]()
+  {
+    uint64_t seed = 1;
+    auto start = std::chrono::high_resolution_clock::now();
+    writeSome(seed);
+    v.checkpoint_dirty([&](size_t offset, size_t length)
+    {
+      memcpy(reinterpret_cast<char*>(replica.data()) + offset, reinterpret_cast<const char*>(v.data()) + offset, length);
+    });
+    return milliseconds(std::chrono::high_resolution_clock::now() - start);
+  });
+  v.disable_dirty_tracking();
+}
+
+// Loading a whole file and making one pass over it
+void benchFileIngest(size_t bytes)
+{
+  const char* path = "bench_pinned_ingest.bin";
+  {
+    std::vector<char> contents(bytes);
+    for (size_t i = 0; i < bytes; i++)
+      contents[i] = char(i * 7);
+    FILE* file = fopen(path, "wb");
+    fwrite(contents.data(), 1, bytes, file);
+    fclose(file);
+  }
+
+  uint64_t expected = 0;
+  std::string group = format("reading and summing a %zu MiB file (in the page cache)", bytes / (1024 * 1024));
+  measure(group, "read + append", "ms", [&]()
+  {
+    auto start = std::chrono::high_resolution_clock::now();
+    pinned_vec<char> v;
+    std::vector<char> scratch(64 * 1024);
+    int fd = open(path, O_RDONLY);
+    ssize_t n;
+    while ((n = read(fd, scratch.data(), scratch.size())) > 0)
+      v.append(scratch.data(), scratch.data() + n);
+    close(fd);
+    expected = sumWords(v.data(), v.size());
+    return milliseconds(std::chrono::high_resolution_clock::now() - start);
+  });
+  measure(group, "io_buffer read_all", "ms", [&]()
+  {
+    auto start = std::chrono::high_resolution_clock::now();
+    pinned_io_buffer buffer;
+    int fd = open(path, O_RDONLY);
+    buffer.read_all(fd);
+    close(fd);
+    uint64_t sum = sumWords(buffer.data(), buffer.size());
+    assert(sum == expected);
+    (void)sum;
+    return milliseconds(std::chrono::high_resolution_clock::now() - start);
+  });
+  measure(group, "io_buffer map_file", "ms", [&]()
+  {
+    auto start = std::chrono::high_resolution_clock::now();
+    pinned_io_buffer buffer;
+    buffer.map_file(path);
+    uint64_t sum = sumWords(buffer.data(), buffer.size());
+    assert(sum == expected);
+    (void)sum;
+    return milliseconds(std::chrono::high_resolution_clock::now() - start);
+  });
+
+  remove(path);
+}
+#endif
+
+template <typename Vec>
+double benchRandomReads(const Vec& v, uint32_t reads)
+{
+  uint32_t seed = 1;
+  uint64_t sum = 0;
+  auto start = std::chrono::high_resolution_clock::now();
+
+  for (uint32_t i = 0; i < reads; i++)
+  {
+    seed = seed * 1664525 + 1013904223;
+    sum += v[seed % v.size()];
+  }
+
+  auto duration = std::chrono::high_resolution_clock::now() - start;
+  volatile uint64_t sink = sum;
+  (void)sink;
+  return nanoseconds(duration) / reads;
+}
+
+// Reads from all over a vector too big for the caches, which mostly measures the TLB
+void benchRandomAccess(uint32_t elements)
+{
+  constexpr uint32_t reads = 10000000;
+
+  std::string group = format("random reads from %u uint32_t", elements);
+  {
+    std::vector<uint32_t> v(elements, 1);
+    measure(group, "std::vector", "ns per read", [&]() { return benchRandomReads(v, reads); });
+  }
+  {
+    pinned_vec<uint32_t> v;
+    v.resize(elements, 1);
+    measure(group, "pinned_vec", "ns per read", [&]() { return benchRandomReads(v, reads); });
+  }
+}
+
+template <typename PushFunc>
+auto benchThreads(uint32_t threadCount, uint32_t perThread, PushFunc push)
+{
+  auto start = std::chrono::high_resolution_clock::now();
+
+  std::vector<std::thread> threads;
+  for (uint32_t t = 0; t < threadCount; t++)
+  {
+    threads.emplace_back([&]()
+    {
+      for (uint32_t i = 0; i < perThread; i++)
+        push(i);
+    });
+  }
+  for (std::thread& thread : threads)
+    thread.join();
+
+  return std::chrono::high_resolution_clock::now() - start;
+}
+
+// Each thread building and throwing away its own vectors. Nothing is shared, except the process's address space: every
+// mmap / mprotect / page fault takes the kernel's mmap lock, so this shows how much the threads get in each other's way.
+template <typename Vec>
+double benchIndependentVectors(uint32_t threadCount, uint32_t vectorsPerThread, uint32_t elements)
+{
+  auto duration = benchThreads(threadCount, vectorsPerThread, [&](uint32_t)
+  {
+    Vec v;
+    for (uint32_t i = 0; i < elements; i++)
+      v.push_back(i);
+  });
+
+  return milliseconds(duration);
+}
+
+void benchIndependentThreads(uint32_t threadCount)
+{
+  constexpr uint32_t vectorsPerThread = 20;
+  constexpr uint32_t elements = 1000000;
+
+  std::string group = format("%u threads each filling %u vectors of %u elements", threadCount, vectorsPerThread, elements);
+  measure(group, "std::vector", "ms", [&]() { return benchIndependentVectors<std::vector<uint32_t>>(threadCount, vectorsPerThread, elements); });
+  measure(group, "pinned_vec", "ms", [&]() { return benchIndependentVectors<pinned_vec<uint32_t>>(threadCount, vectorsPerThread, elements); });
+}
+
+// Many threads appending to one vector
+void benchConcurrentAppend(uint32_t threadCount)
+{
+  constexpr uint32_t perThread = 1000000;
+
+  std::string group = format("%u threads appending %u elements each to one vector", threadCount, perThread);
+  measure(group, "mutex + pinned_vec", "ms", [&]()
+  {
+    std::mutex mutex;
+    pinned_vec<uint32_t> v;
+    return milliseconds(benchThreads(threadCount, perThread, [&](uint32_t i)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      v.push_back(i);
+    }));
+  });
+  measure(group, "concurrent_pinned_vec", "ms", [&]()
+  {
+    concurrent_pinned_vec<uint32_t> v;
+    return milliseconds(benchThreads(threadCount, perThread, [&](uint32_t i) { v.push_back(i); }));
+  });
+}
+
+struct mapInsertTimes
+{
+  double perInsert;
+  double slowest;
+};
+
+template <typename Map>
+mapInsertTimes benchMapInserts(uint32_t elements)
+{
+  Map map;
+  double worst = 0;
+  auto start = std::chrono::high_resolution_clock::now();
+
+  for (uint32_t i = 0; i < elements; i++)
+  {
+    auto before = std::chrono::high_resolution_clock::now();
+    map[uint64_t(i) * 7919] = i;
+    worst = std::max(worst, nanoseconds(std::chrono::high_resolution_clock::now() - before));
+  }
+
+  return { nanoseconds(std::chrono::high_resolution_clock::now() - start) / elements, worst };
+}
+
+// The slowest insert is where a table that rehashes all at once stalls
+void benchHashMapInserts(uint32_t elements)
+{
+  std::string group = format("inserting %u keys into a hash map", elements);
+  measure(group, "std::unordered_map", "ns per insert", [&]() { return benchMapInserts<std::unordered_map<uint64_t, uint64_t>>(elements).perInsert; });
+  measure(group, "pinned_hash_map", "ns per insert", [&]() { return benchMapInserts<pinned_hash_map<uint64_t, uint64_t>>(elements).perInsert; });
+
+  group = format("slowest of %u inserts into a hash map", elements);
+  measure(group, "std::unordered_map", "us", [&]() { return benchMapInserts<std::unordered_map<uint64_t, uint64_t>>(elements).slowest / 1000; });
+  measure(group, "pinned_hash_map", "us", [&]() { return benchMapInserts<pinned_hash_map<uint64_t, uint64_t>>(elements).slowest / 1000; });
+}
+
+template <typename AllocFunc, typename EndRequestFunc>
+double benchRequests(uint32_t requests, uint32_t allocationsPerRequest, AllocFunc alloc, EndRequestFunc endRequest)
+{
+  uint32_t seed = 1;
+  auto start = std::chrono::high_resolution_clock::now();
+
+  for (uint32_t r = 0; r < requests; r++)
+  {
+    for (uint32_t i = 0; i < allocationsPerRequest; i++)
+    {
+      seed = seed * 1664525 + 1013904223;
+      size_t size = 16 + (seed >> 8) % 512;
+      memset(alloc(size), 0, size);
+    }
+    endRequest();
+  }
+
+  return nanoseconds(std::chrono::high_resolution_clock::now() - start) / (double(requests) * allocationsPerRequest);
+}
+
+// Keys from a 40 bit space, in clusters of 256 consecutive ids spread all over it
+template <typename Map, typename SetFunc, typename GetFunc>
+double benchSparseKeys(Map& map, uint32_t keys, SetFunc set, GetFunc get)
+{
+  auto start = std::chrono::high_resolution_clock::now();
+  uint64_t seed = 1;
+  for (uint32_t i = 0; i < keys; i += 256)
+  {
+    seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+    uint64_t base = (seed >> 24) & ((uint64_t(1) << 40) - 256);
+    for (uint32_t j = 0; j < 256; j++)
+      set(map, base + j, uint64_t(i + j + 1));
+  }
+
+  uint64_t sum = 0;
+  seed = 1;
+  for (uint32_t i = 0; i < keys; i += 256)
+  {
+    seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+    uint64_t base = (seed >> 24) & ((uint64_t(1) << 40) - 256);
+    for (uint32_t j = 0; j < 256; j++)
+      sum += get(map, base + j);
+  }
+  assert(sum == uint64_t(keys) * (keys + 1) / 2);
+  (void)sum;
+
+  return nanoseconds(std::chrono::high_resolution_clock::now() - start) / (2.0 * keys);
+}
+
+void benchSparseArray(uint32_t keys)
+{
+  using hash_map = std::unordered_map<uint64_t, uint64_t>;
+  using sparse_array = pinned_sparse_array<uint64_t>;
+
+  std::string group = format("setting and getting %u clustered 40 bit keys", keys);
+  measure(group, "std::unordered_map", "ns per op", [&]()
+  {
+    hash_map map;
+    return benchSparseKeys(map, keys, [](hash_map& m, uint64_t k, uint64_t v) { m[k] = v; }, [](hash_map& m, uint64_t k) { return m.find(k)->second; });
+  });
+  measure(group, "pinned_sparse_array", "ns per op", [&]()
+  {
+    sparse_array array(uint64_t(1) << 40);
+    return benchSparseKeys(array, keys, [](sparse_array& a, uint64_t k, uint64_t v) { a.set(k, v); }, [](sparse_array& a, uint64_t k) { return a[k]; });
+  });
+}
+
+// Lots of small allocations per request, all thrown away at the end of it
+void benchArenaRequests(uint32_t allocationsPerRequest)
+{
+  constexpr uint32_t requests = 2000;
+
+  std::string group = format("%u allocations per request", allocationsPerRequest);
+  measure(group, "malloc / free", "ns per allocation", [&]()
+  {
+    std::vector<void*> blocks;
+    return benchRequests(requests, allocationsPerRequest,
+      [&](size_t size) { blocks.push_back(malloc(size)); return blocks.back(); },
+      [&]() { for (void* block : blocks) free(block); blocks.clear(); });
+  });
+  measure(group, "pinned_arena", "ns per allocation", [&]()
+  {
+    pinned_arena arena;
+    return benchRequests(requests, allocationsPerRequest,
+      [&](size_t size) { return arena.allocate(size); },
+      [&]() { arena.reset(); });
+  });
+}
+
+struct benchNode
+{
+  uint64_t value;
+  benchNode* left;
+  benchNode* right;
+};
+
+template <typename CreateFunc, typename DestroyFunc>
+double benchNodes(uint32_t liveNodes, uint32_t operations, CreateFunc create, DestroyFunc destroy)
+{
+  std::vector<benchNode*> nodes;
+  for (uint32_t i = 0; i < liveNodes; i++)
+    nodes.push_back(create());
+
+  uint32_t seed = 1;
+  auto start = std::chrono::high_resolution_clock::now();
+
+  // Free a random node and allocate a new one in its place
+  for (uint32_t i = 0; i < operations; i++)
+  {
+    seed = seed * 1664525 + 1013904223;
+    size_t pos = (seed >> 8) % nodes.size();
+    destroy(nodes[pos]);
+    nodes[pos] = create();
+    nodes[pos]->value = i;
+  }
+
   auto duration = std::chrono::high_resolution_clock::now() - start;
-  return duration;
+  for (benchNode* node : nodes)
+    destroy(node);
+  return nanoseconds(duration) / operations;
 }
 
-void benchMegabytes(size_t initialCapacity, uint32_t megabytes)
+// Random frees and allocations of same-sized nodes
+void benchPoolNodes(uint32_t liveNodes)
 {
-  constexpr uint64_t megabyte = 1024 * 1024;
+  constexpr uint32_t operations = 2000000;
 
-  printf("# %u MiB\n", megabytes);
-  printf("std::vector: %lld ms\n", (long long)std::chrono::duration_cast<std::chrono::milliseconds>(bench<std::vector<uint32_t>>(initialCapacity, (megabyte * megabytes) / sizeof(uint32_t))).count());
-  printf("pinned_vec:  %lld ms\n", (long long)std::chrono::duration_cast<std::chrono::milliseconds>(bench<pinned_vec<uint32_t>>(initialCapacity, (megabyte * megabytes) / sizeof(uint32_t))).count());
-  puts("");
+  std::string group = format("node churn with %u live nodes", liveNodes);
+  measure(group, "new / delete", "ns per free + allocate", [&]()
+  {
+    return benchNodes(liveNodes, operations, []() { return new benchNode(); }, [](benchNode* node) { delete node; });
+  });
+  measure(group, "pinned_pool", "ns per free + allocate", [&]()
+  {
+    pinned_pool<benchNode> pool;
+    return benchNodes(liveNodes, operations, [&]() { return pool.create(); }, [&](benchNode* node) { pool.destroy(node); });
+  });
+  measure(group, "pinned_pool::cache", "ns per free + allocate", [&]()
+  {
+    pinned_pool<benchNode> pool;
+    pinned_pool<benchNode>::cache cache(pool);
+    return benchNodes(liveNodes, operations, [&]() { return cache.create(); }, [&](benchNode* node) { cache.destroy(node); });
+  });
 }
 
-void benchKilobytes(size_t initialCapacity, int32_t kilobytes)
+struct benchRecord
 {
-  constexpr int32_t kilobyte = 1024;
+  uint64_t id;
+  double price;
+  double quantity;
+  uint64_t timestamp;
+  char name[32];
+};
 
-  double stdVecVal = 0;
-  double pinnedVecVal = 0;
+// Summing one field of wide records, stored as records or as columns
+void benchColumnScan(uint32_t rows)
+{
+  constexpr int passes = 5;
 
-  int32_t iterations = 20;
-  for (int32_t i = 0; i < iterations; i++)
+  std::string group = format("summing one field of %u rows", rows);
+  double sum = 0;
   {
-    stdVecVal += (double)std::chrono::duration_cast<std::chrono::nanoseconds>(bench<std::vector<uint32_t>>(initialCapacity, (kilobyte * kilobytes) / sizeof(uint32_t))).count();
-    pinnedVecVal += (double)std::chrono::duration_cast<std::chrono::nanoseconds>(bench<pinned_vec<uint32_t>>(initialCapacity, (kilobyte * kilobytes) / sizeof(uint32_t))).count();
+    pinned_vec<benchRecord> records;
+    for (uint32_t i = 0; i < rows; i++)
+      records.push_back(benchRecord{ i, double(i), 1.0, i, {} });
+
+    measure(group, "pinned_vec<record>", "ns per row", [&]()
+    {
+      auto start = std::chrono::high_resolution_clock::now();
+      for (int pass = 0; pass < passes; pass++)
+        for (const benchRecord& record : records)
+          sum += record.price;
+      return nanoseconds(std::chrono::high_resolution_clock::now() - start) / (double(rows) * passes);
+    });
   }
+  {
+    pinned_soa<uint64_t, double, double, uint64_t, std::array<char, 32>> records;
+    for (uint32_t i = 0; i < rows; i++)
+      records.push_back(i, double(i), 1.0, i, {});
 
-  stdVecVal /= iterations;
-  pinnedVecVal /= iterations;
+    measure(group, "pinned_soa", "ns per row", [&]()
+    {
+      auto start = std::chrono::high_resolution_clock::now();
+      for (int pass = 0; pass < passes; pass++)
+        for (double price : records.column<1>())
+          sum += price;
+      return nanoseconds(std::chrono::high_resolution_clock::now() - start) / (double(rows) * passes);
+    });
+  }
 
-  printf("# %dKiB\n", kilobytes);
-  printf("std::vector: %lld ns\n", (long long)stdVecVal);
-  printf("pinned_vec:  %lld ns\n", (long long)pinnedVecVal);
-  puts("");
+  volatile double sink = sum;
+  (void)sink;
+}
+
+static bool parseOptions(int argc, char** argv)
+{
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--json") == 0)
+      options.json = true;
+    else if (strcmp(argv[i], "--large") == 0)
+      options.large = true;
+    else if (strcmp(argv[i], "--repetitions") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+      options.repetitions = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+      options.filter = argv[++i];
+    else
+      return false;
+  }
+  return true;
 }
 
-int main(int, char**)
+int main(int argc, char** argv)
 {
-  std::vector<uint8_t> a;
-  a.reserve(PINNED_MAXSIZE_NORMAL);
+  if (!parseOptions(argc, argv))
+  {
+    fprintf(stderr, "usage: %s [--json] [--repetitions N] [--filter TEXT] [--large]\n", argv[0]);
+    return 1;
+  }
 
   // pinned_vec capacity is always page-aligned, so use the same start for std::vector to be fair
   size_t initialCapacity = 0;
@@ -73,16 +1108,88 @@ int main(int, char**)
     initialCapacity = temp.capacity();
   }
 
-  benchMegabytes(initialCapacity, 4096);
-  benchMegabytes(initialCapacity, 1024);
-  benchMegabytes(initialCapacity, 512);
-  benchMegabytes(initialCapacity, 16);
+  constexpr size_t kilobyte = 1024;
+  constexpr size_t megabyte = 1024 * 1024;
+
+  if (options.large)
+  {
+    benchPushBackBytes(initialCapacity, 4096 * megabyte);
+    benchPushBackBytes(initialCapacity, 1024 * megabyte);
+  }
+  benchPushBackBytes(initialCapacity, 512 * megabyte);
+  benchPushBackBytes(initialCapacity, 16 * megabyte);
+  benchPushBackBytes(initialCapacity, 2048 * kilobyte);
+  benchPushBackBytes(initialCapacity, 512 * kilobyte);
+  benchPushBackBytes(initialCapacity, 16 * kilobyte);
+  benchPushBackBytes(initialCapacity, 1 * kilobyte);
+
+  benchPushBackType<uint8_t>("uint8_t", 10000000);
+  benchPushBackType<uint64_t>("uint64_t", 10000000);
+  benchPushBackType<benchBlob>("64 byte structs", 1000000);
+  benchPushBackType<std::string>("std::string", 1000000);
+
+  benchSmallVectors(0);
+  benchSmallVectors(4);
+  benchSmallVectors(8);
+  benchSmallVectors(64);
+  benchManyVectors(2000, 1024);
+
+  benchInsertEraseElements(100000, position::front);
+  benchInsertEraseElements(100000, position::middle);
+  benchInsertEraseElements(100000, position::back);
+  benchInsertEraseElements(1000, position::random);
+  benchInsertEraseElements(100000, position::random);
+
+  benchResize<uint32_t>("uint32_t", 1000000);
+  benchResize<std::string>("std::string", 100000);
+
+  benchRandomAccess(64 * 1024 * 1024);
+
+  benchParallelResize(256 * megabyte);
+
+#ifndef _WIN32
+  benchSnapshot(256 * megabyte);
+  benchFileIngest(256 * megabyte);
+  benchColdPages(256 * megabyte);
+  benchDirtyReplication(256 * megabyte, 100);
+#endif
+  benchSplice(256 * megabyte);
+  benchRelocate(256 * megabyte);
+
+  benchGrowthPolicies(288 * megabyte);
+  if (options.large)
+    benchGrowthPolicies(9 * 1024 * megabyte);
+  if (options.large)
+    benchParallelResize(8192 * megabyte);
+
+  benchIndependentThreads(1);
+  benchIndependentThreads(4);
+  if (options.large)
+    benchIndependentThreads(std::max(4u, std::thread::hardware_concurrency()));
+
+  benchConcurrentAppend(1);
+  benchConcurrentAppend(4);
+  if (options.large)
+    benchConcurrentAppend(16);
+
+  benchHashMapInserts(100000);
+  if (options.large)
+    benchHashMapInserts(10000000);
+
+  benchSparseArray(1 << 20);
+
+  benchArenaRequests(100);
+  benchArenaRequests(10000);
+
+  benchPoolNodes(1000);
+  benchPoolNodes(1000000);
+
+  benchColumnScan(10000000);
 
-  benchKilobytes(initialCapacity, 2048);
-  benchKilobytes(initialCapacity, 1024);
-  benchKilobytes(initialCapacity, 512);
-  benchKilobytes(initialCapacity, 16);
-  benchKilobytes(initialCapacity, 1);
+  if (options.json)
+    printJson();
+  else
+    puts("");
 
   return 0;
 }
\ No newline at end of file
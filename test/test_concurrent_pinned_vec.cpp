@@ -0,0 +1,118 @@
+#include "test.h"
+#include "../concurrent_pinned_vec.hpp"
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+struct entry
+{
+  uint32_t thread;
+  uint32_t sequence;
+  uint64_t check;
+};
+
+static uint64_t check_value(uint32_t thread, uint32_t sequence)
+{
+  return (uint64_t(thread) << 32 | sequence) * 0x9E3779B97F4A7C15ULL;
+}
+
+void test_concurrent_basic()
+{
+  concurrent_pinned_vec<uint64_t> vec;
+  CHECK(vec.empty());
+
+  for (uint64_t i = 0; i < 100000; i++)
+    CHECK(vec.push_back(i) == i);
+
+  CHECK(vec.size() == 100000);
+  CHECK(vec.capacity() >= 100000);
+  for (uint64_t i = 0; i < 100000; i++)
+    CHECK(vec[i] == i);
+
+  vec.clear();
+  CHECK(vec.empty());
+  CHECK(vec.push_back(5) == 0);
+}
+
+void test_concurrent_appends()
+{
+  constexpr uint32_t thread_count = 8;
+  constexpr uint32_t per_thread = 50000;
+
+  concurrent_pinned_vec<entry> vec;
+  std::atomic<bool> done{false};
+
+  // Reader checking that everything it can see is fully written, and that pointers stay put
+  std::thread reader([&]()
+  {
+    const entry* first = nullptr;
+    while (!done.load())
+    {
+      size_t size = vec.size();
+      if (size > 0 && !first)
+        first = &vec[0];
+      if (first)
+        CHECK(first == &vec[0]);
+
+      for (size_t i = size > 1000 ? size - 1000 : 0; i < size; i++)
+        CHECK(vec[i].check == check_value(vec[i].thread, vec[i].sequence));
+    }
+  });
+
+  std::vector<std::thread> writers;
+  for (uint32_t t = 0; t < thread_count; t++)
+  {
+    writers.emplace_back([&vec, t]()
+    {
+      for (uint32_t i = 0; i < per_thread; i++)
+        vec.push_back(entry{ t, i, check_value(t, i) });
+    });
+  }
+
+  for (std::thread& writer : writers)
+    writer.join();
+  done = true;
+  reader.join();
+
+  CHECK(vec.size() == thread_count * per_thread);
+
+  // Every element exactly once, and each thread's elements in the order it pushed them
+  std::vector<uint32_t> next(thread_count, 0);
+  for (size_t i = 0; i < vec.size(); i++)
+  {
+    const entry& e = vec[i];
+    CHECK(e.thread < thread_count);
+    CHECK(e.sequence == next[e.thread]);
+    CHECK(e.check == check_value(e.thread, e.sequence));
+    next[e.thread]++;
+  }
+}
+
+void test_concurrent_max_size()
+{
+  concurrent_pinned_vec<uint64_t> vec(64 * 1024);
+
+  bool threw = false;
+  try
+  {
+    for (size_t i = 0; i < vec.max_size() + 1; i++)
+      vec.push_back(i);
+  }
+  catch (const std::bad_alloc&)
+  {
+    threw = true;
+  }
+
+  CHECK(threw);
+  CHECK(vec.size() == vec.max_size());
+}
+
+int main()
+{
+  test_concurrent_basic();
+  test_concurrent_appends();
+  test_concurrent_max_size();
+
+  fputs("All tests passed!\n", stderr);
+  return 0;
+}
@@ -1,5 +1,13 @@
 #include "test.h"
 #include "../pinned.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 void test_c_pinned_basic()
 {
@@ -60,7 +68,659 @@ void test_c_shrink()
   for (size_t i = 0; i < allocation.size; i++)
     CHECK(((char*)allocation.data)[i] == (char)(i % 256));
 
+  // Decommitted pages come back zeroed
+  size_t shrunk_size = allocation.size;
+  CHECK(pinned_realloc(shrunk_size * 2, &allocation) == 0);
+  for (size_t i = shrunk_size; i < allocation.size; i++)
+    CHECK(((char*)allocation.data)[i] == 0);
+
+  pinned_free(&allocation);
+}
+
+void test_c_discard()
+{
+  pinned_alloc_info allocation;
+  CHECK(pinned_alloc(pinned_page_size() * 4, PINNED_MAXSIZE_NORMAL, &allocation) == 0);
+
+  for (size_t i = 0; i < allocation.size; i++)
+    ((char*)allocation.data)[i] = 1;
+
+  // Only the pages entirely inside the range go
+  size_t page = pinned_page_size();
+  CHECK(pinned_discard(page / 2, page * 2, &allocation) == 0);
+  CHECK(allocation.size == page * 4);
+
+  for (size_t i = 0; i < allocation.size; i++)
+    CHECK(((char*)allocation.data)[i] == (i >= page && i < page * 2 ? 0 : 1));
+
+  CHECK(pinned_discard(0, allocation.size + 1, &allocation) != 0);
+
+  pinned_free(&allocation);
+}
+
+void test_c_placement()
+{
+  pinned_numa_policy policies[] = { PINNED_NUMA_FIRST_TOUCH, PINNED_NUMA_LOCAL, PINNED_NUMA_BIND, PINNED_NUMA_INTERLEAVE };
+
+  for (size_t p = 0; p < sizeof(policies) / sizeof(policies[0]); p++)
+  {
+    pinned_placement placement = { policies[p], policies[p] == PINNED_NUMA_BIND ? PINNED_NUMA_NODE(0) : 0 };
+
+    pinned_alloc_info allocation;
+    CHECK(pinned_alloc_placed(512, PINNED_MAXSIZE_NORMAL, placement, &allocation) == 0);
+    CHECK(allocation.placement.policy == policies[p]);
+
+    CHECK(pinned_realloc(allocation.size * 4, &allocation) == 0);
+
+    for (size_t i = 0; i < allocation.size; i++)
+      ((char*)allocation.data)[i] = (char)(i % 256);
+    for (size_t i = 0; i < allocation.size; i++)
+      CHECK(((char*)allocation.data)[i] == (char)(i % 256));
+
+    pinned_free(&allocation);
+  }
+
+  pinned_placement invalid = { (pinned_numa_policy)42, 0 };
+  pinned_alloc_info allocation;
+  CHECK(pinned_alloc_placed(512, PINNED_MAXSIZE_NORMAL, invalid, &allocation) != 0);
+}
+
+void test_c_move_pages()
+{
+  size_t page = pinned_page_size();
+  pinned_alloc_info source, destination;
+  CHECK(pinned_alloc(page * 4, PINNED_MAXSIZE_NORMAL, &source) == 0);
+  CHECK(pinned_alloc(page * 4, PINNED_MAXSIZE_NORMAL, &destination) == 0);
+
+  for (size_t i = 0; i < source.size; i++)
+    ((char*)source.data)[i] = (char)(i % 251);
+  memset(destination.data, 1, destination.size);
+
+  CHECK(pinned_move_pages(&destination, page, &source, page * 2, page * 2) == 0);
+  for (size_t i = 0; i < page * 4; i++)
+  {
+    CHECK(((char*)source.data)[i] == (i < page * 2 ? (char)(i % 251) : 0));
+    CHECK(((char*)destination.data)[i] == (i >= page && i < page * 3 ? (char)((i + page) % 251) : 1));
+  }
+
+  // The source range is still committed and writable
+  memset((char*)source.data + page * 2, 2, page * 2);
+
+  // This takes in the pages moved in above and some that were there before
+  CHECK(pinned_move_pages(&source, page * 2, &destination, 0, page * 2) == 0);
+  for (size_t i = 0; i < page; i++)
+  {
+    CHECK(((char*)source.data)[page * 2 + i] == 1);
+    CHECK(((char*)source.data)[page * 3 + i] == (char)((page * 2 + i) % 251));
+  }
+  for (size_t i = 0; i < page * 2; i++)
+    CHECK(((char*)destination.data)[i] == 0);
+
+  CHECK(pinned_move_pages(&destination, 0, &source, page / 2, page) != 0);
+  CHECK(pinned_move_pages(&destination, page * 2, &source, 0, page * 4) != 0);
+  CHECK(pinned_move_pages(&source, 0, &source, page, page) != 0);
+
+  pinned_free(&source);
+  pinned_free(&destination);
+}
+
+void test_c_commit_range()
+{
+  size_t page = pinned_page_size();
+  pinned_alloc_info allocation;
+  CHECK(pinned_alloc(page, PINNED_MAXSIZE_NORMAL, &allocation) == 0);
+
+  // Somewhere far past the end of the allocation, straddling a page boundary
+  size_t offset = page * 1000 + page / 2;
+  CHECK(pinned_commit_range(offset, page, &allocation) == 0);
+  CHECK(allocation.size == page);
+
+  char* sparse = (char*)allocation.data + page * 1000;
+  for (size_t i = 0; i < page * 2; i++)
+    CHECK(sparse[i] == 0);
+  memset(sparse, 3, page * 2);
+
+  // Decommitted pages come back as zeros
+  CHECK(pinned_decommit_range(page * 1000, page, &allocation) == 0);
+  CHECK(pinned_commit_range(page * 1000, page, &allocation) == 0);
+  for (size_t i = 0; i < page * 2; i++)
+    CHECK(sparse[i] == (i < page ? 0 : 3));
+
+  CHECK(pinned_commit_range(0, page, &allocation) != 0);
+  CHECK(pinned_commit_range(allocation.max_size - page, page * 2, &allocation) != 0);
+  CHECK(pinned_decommit_range(page * 1000, 0, &allocation) == 0);
+
+  pinned_free(&allocation);
+}
+
+void test_c_relocate()
+{
+  size_t page = pinned_page_size();
+  pinned_alloc_info allocation;
+  CHECK(pinned_alloc(page * 2, page * 2, &allocation) == 0);
+  for (size_t i = 0; i < allocation.size; i++)
+    ((char*)allocation.data)[i] = (char)(i % 251);
+
+  pinned_stats before;
+  pinned_get_stats(&before);
+
+  CHECK(pinned_realloc(page * 3, &allocation) != 0);
+  CHECK(pinned_relocate(page * 8, &allocation) == 0);
+  CHECK(allocation.size == page * 2);
+  CHECK(allocation.max_size == page * 8);
+  CHECK(pinned_realloc(page * 8, &allocation) == 0);
+  for (size_t i = 0; i < allocation.size; i++)
+    CHECK(((char*)allocation.data)[i] == (i < page * 2 ? (char)(i % 251) : 0));
+
+  pinned_stats after;
+  pinned_get_stats(&after);
+  CHECK(after.reserved_bytes == before.reserved_bytes + page * 6);
+
+  CHECK(pinned_relocate(page * 4, &allocation) != 0);
+
+  pinned_free(&allocation);
+}
+
+#ifndef _WIN32
+// File backed and shared allocations aren't implemented on windows yet
+void test_c_file_backed()
+{
+  const char* path = "test_c_file_backed.bin";
+  remove(path);
+
+  pinned_alloc_info allocation;
+  CHECK(pinned_alloc_file(path, 512, PINNED_MAXSIZE_NORMAL, &allocation) == 0);
+  CHECK(allocation.size >= 512);
+  CHECK(pinned_get_length(&allocation) == 0);
+
+  CHECK(pinned_realloc(allocation.size * 4, &allocation) == 0);
+  for (size_t i = 0; i < allocation.size; i++)
+    ((char*)allocation.data)[i] = (char)(i % 256);
+
+  size_t length = allocation.size - 100;
+  CHECK(pinned_sync(length, &allocation) == 0);
+
+  // Only one process at a time
+  pinned_alloc_info second;
+  CHECK(pinned_alloc_file(path, 0, PINNED_MAXSIZE_NORMAL, &second) != 0);
+
+  pinned_free(&allocation);
+
+  CHECK(pinned_alloc_file(path, 0, PINNED_MAXSIZE_NORMAL, &allocation) == 0);
+  CHECK(pinned_get_length(&allocation) == length);
+  CHECK(allocation.size >= length);
+  for (size_t i = 0; i < length; i++)
+    CHECK(((char*)allocation.data)[i] == (char)(i % 256));
+
+  // Shrinking cuts the recorded length down too
+  CHECK(pinned_realloc(512, &allocation) == 0);
+  CHECK(pinned_get_length(&allocation) == allocation.size);
+  for (size_t i = 0; i < allocation.size; i++)
+    CHECK(((char*)allocation.data)[i] == (char)(i % 256));
+
+  pinned_free(&allocation);
+  remove(path);
+}
+
+void test_c_shared()
+{
+  pinned_alloc_info owner;
+  CHECK(pinned_alloc_shared(512, PINNED_MAXSIZE_NORMAL, &owner) == 0);
+
+  for (size_t i = 0; i < 512; i++)
+    ((char*)owner.data)[i] = (char)(i % 256);
+  pinned_set_length(512, &owner);
+
+  pinned_alloc_info reader;
+  CHECK(pinned_attach(dup(owner.fd), &reader) == 0);
+  CHECK(reader.data != owner.data); // the owner's address is taken in this process
+  CHECK(pinned_get_length(&reader) == 512);
+  CHECK(reader.size >= 512);
+  for (size_t i = 0; i < 512; i++)
+    CHECK(((char*)reader.data)[i] == (char)(i % 256));
+
+  // Same memory, not a copy
+  ((char*)owner.data)[0] = 42;
+  CHECK(((char*)reader.data)[0] == 42);
+
+  // Readers can't resize or publish
+  CHECK(pinned_realloc(reader.size * 2, &reader) != 0);
+  pinned_set_length(0, &reader);
+  CHECK(pinned_get_length(&owner) == 512);
+
+  CHECK(pinned_realloc(owner.size * 4, &owner) == 0);
+  for (size_t i = 0; i < owner.size; i++)
+    ((char*)owner.data)[i] = (char)(i % 251);
+  pinned_set_length(owner.size, &owner);
+
+  CHECK(pinned_get_length(&reader) == owner.size);
+  CHECK(pinned_refresh(&reader) == 0);
+  CHECK(reader.size == owner.size);
+  for (size_t i = 0; i < reader.size; i++)
+    CHECK(((char*)reader.data)[i] == (char)(i % 251));
+
+  pinned_free(&reader);
+  pinned_free(&owner);
+}
+
+void test_c_snapshot()
+{
+  size_t page = pinned_page_size();
+  pinned_alloc_info owner;
+  CHECK(pinned_alloc_shared(page * 8, PINNED_MAXSIZE_NORMAL, &owner) == 0);
+  for (size_t i = 0; i < owner.size; i++)
+    ((char*)owner.data)[i] = (char)(i % 251);
+
+  void* data = owner.data;
+  pinned_alloc_info snapshot;
+  CHECK(pinned_snapshot(&owner, &snapshot) == 0);
+  CHECK(owner.data == data);
+  CHECK(snapshot.size == owner.size);
+  CHECK(snapshot.flags & PINNED_FLAG_READ_ONLY);
+  CHECK(owner.flags & PINNED_FLAG_COPY_ON_WRITE);
+
+  // The owner still sees its data, and its writes don't show up in the snapshot
+  for (size_t i = 0; i < owner.size; i++)
+    CHECK(((char*)owner.data)[i] == (char)(i % 251));
+  ((char*)owner.data)[0] = 1;
+  ((char*)owner.data)[page * 5 + 3] = 2;
+  CHECK(((char*)snapshot.data)[0] == 0);
+  CHECK(((char*)snapshot.data)[page * 5 + 3] == (char)((page * 5 + 3) % 251));
+
+  // Growing is fine, but anything that would change the file has to wait for the snapshot to go
+  CHECK(pinned_realloc(page * 16, &owner) == 0);
+  ((char*)owner.data)[page * 12] = 3;
+  pinned_alloc_info second;
+  CHECK(pinned_snapshot(&owner, &second) != 0);
+  CHECK(pinned_realloc(page * 4, &owner) != 0);
+  CHECK(pinned_discard(0, page * 2, &owner) != 0);
+
+  pinned_free(&snapshot);
+
+  // Now the changes go into the file, and the next snapshot has them
+  CHECK(pinned_snapshot(&owner, &second) == 0);
+  CHECK(second.size == page * 16);
+  CHECK(((char*)second.data)[0] == 1);
+  CHECK(((char*)second.data)[1] == 1);
+  CHECK(((char*)second.data)[page * 5 + 3] == 2);
+  CHECK(((char*)second.data)[page * 12] == 3);
+
+  // Snapshots outlive their allocation
+  pinned_free(&owner);
+  CHECK(((char*)second.data)[page * 5 + 3] == 2);
+  pinned_free(&second);
+
+  // Plain allocations can't be snapshotted
+  CHECK(pinned_alloc(page, PINNED_MAXSIZE_NORMAL, &owner) == 0);
+  CHECK(pinned_snapshot(&owner, &snapshot) != 0);
+  pinned_free(&owner);
+}
+
+void test_c_snapshot_file()
+{
+  const char* path = "test_c_snapshot_file.bin";
+  remove(path);
+
+  pinned_alloc_info allocation;
+  CHECK(pinned_alloc_file(path, pinned_page_size() * 2, PINNED_MAXSIZE_NORMAL, &allocation) == 0);
+  memset(allocation.data, 5, allocation.size);
+
+  pinned_alloc_info snapshot;
+  CHECK(pinned_snapshot(&allocation, &snapshot) == 0);
+  memset(allocation.data, 6, 100);
+  CHECK(pinned_sync(allocation.size, &allocation) != 0);
+  pinned_free(&snapshot);
+
+  // With the snapshot gone, what was written since makes it to the file
+  CHECK(pinned_sync(allocation.size, &allocation) == 0);
+  CHECK(!(allocation.flags & PINNED_FLAG_COPY_ON_WRITE));
+  pinned_free(&allocation);
+
+  CHECK(pinned_alloc_file(path, 0, PINNED_MAXSIZE_NORMAL, &allocation) == 0);
+  CHECK(((char*)allocation.data)[0] == 6);
+  CHECK(((char*)allocation.data)[99] == 6);
+  CHECK(((char*)allocation.data)[100] == 5);
+  pinned_free(&allocation);
+  remove(path);
+}
+
+void test_c_map_file()
+{
+  const char* path = "test_c_map_file.bin";
+  size_t page = pinned_page_size();
+  size_t file_size = page * 2 + 100;
+
+  FILE* file = fopen(path, "wb");
+  CHECK(file);
+  for (size_t i = 0; i < file_size; i++)
+    fputc((int)(i % 251), file);
+  fclose(file);
+
+  pinned_alloc_info allocation;
+  CHECK(pinned_alloc(0, PINNED_MAXSIZE_NORMAL, &allocation) == 0);
+
+  int fd = open(path, O_RDONLY);
+  CHECK(fd >= 0);
+  CHECK(pinned_map_file(fd, file_size + 1, &allocation) != 0);
+  CHECK(pinned_map_file(fd, file_size, &allocation) == 0);
+  close(fd);
+
+  CHECK(allocation.size == page * 3);
+  CHECK(allocation.flags & PINNED_FLAG_FILE_PAGES);
+  for (size_t i = 0; i < file_size; i++)
+    CHECK(((unsigned char*)allocation.data)[i] == i % 251);
+  CHECK(((char*)allocation.data)[file_size] == 0);
+
+  // Appending goes on straight after the file
+  CHECK(pinned_realloc(page * 5, &allocation) == 0);
+  memset((char*)allocation.data + file_size, 7, page * 5 - file_size);
+  CHECK(((unsigned char*)allocation.data)[file_size - 1] == (file_size - 1) % 251);
+
+  // Dropped pages come back zeroed, not with the file's contents
+  CHECK(pinned_discard(0, page, &allocation) == 0);
+  CHECK(((char*)allocation.data)[10] == 0);
+  CHECK(pinned_realloc(page, &allocation) == 0);
+  CHECK(pinned_realloc(page * 3, &allocation) == 0);
+  CHECK(((char*)allocation.data)[page + 10] == 0);
+  CHECK(((char*)allocation.data)[page * 2 + 200] == 0);
+
+  pinned_free(&allocation);
+
+  // The file itself is never written
+  file = fopen(path, "rb");
+  CHECK(file);
+  fseek(file, (long)file_size - 1, SEEK_SET);
+  CHECK(fgetc(file) == (int)((file_size - 1) % 251));
+  CHECK(fgetc(file) == EOF);
+  fclose(file);
+  remove(path);
+}
+
+void test_c_cold()
+{
+  size_t page = pinned_page_size();
+  size_t block = page * 4;
+  pinned_alloc_info allocation;
+  CHECK(pinned_alloc(block * 16, PINNED_MAXSIZE_NORMAL, &allocation) == 0);
+
+  // The first half compresses (a fill value per page), the second half doesn't
+  uint64_t* words = (uint64_t*)allocation.data;
+  size_t word_count = allocation.size / sizeof(uint64_t);
+  for (size_t i = 0; i < word_count; i++)
+    words[i] = i < word_count / 2 ? (i * sizeof(uint64_t)) / page : i * 0x9E3779B97F4A7C15ULL;
+
+  CHECK(pinned_cold_sweep(&allocation, NULL) != 0);
+  CHECK(pinned_cold_enable(page + 1, &allocation) != 0);
+  CHECK(pinned_cold_enable(block, &allocation) == 0);
+  CHECK(allocation.flags & PINNED_FLAG_COLD);
+
+  // The first sweep only arms the blocks, the second compresses the ones nothing touched in between
+  size_t compressed;
+  CHECK(pinned_cold_sweep(&allocation, &compressed) == 0);
+  CHECK(compressed == 0);
+  uint64_t touched = words[word_count / 4];
+  CHECK(pinned_cold_sweep(&allocation, &compressed) == 0);
+  CHECK(compressed == 7);
+
+  pinned_cold_stats stats;
+  CHECK(pinned_cold_get_stats(&allocation, &stats) == 0);
+  CHECK(stats.managed_bytes == block * 16);
+  CHECK(stats.cold_bytes == block * 7);
+  CHECK(stats.compressed_bytes > 0 && stats.compressed_bytes <= block * 7 / 2);
+
+  pinned_residency residency;
+  CHECK(pinned_get_residency(&allocation, 0, &residency) == 0);
+  CHECK(residency.resident_bytes <= block * 9);
+
+  // Everything reads back, whatever state its block was in
+  CHECK(touched == (word_count / 4 * sizeof(uint64_t)) / page);
+  for (size_t i = 0; i < word_count; i++)
+    CHECK(words[i] == (i < word_count / 2 ? (i * sizeof(uint64_t)) / page : i * 0x9E3779B97F4A7C15ULL));
+  CHECK(pinned_cold_get_stats(&allocation, &stats) == 0);
+  CHECK(stats.cold_bytes == 0);
+
+  // Writes to compressed blocks land, and resizing works as usual
+  CHECK(pinned_cold_sweep(&allocation, NULL) == 0);
+  CHECK(pinned_cold_sweep(&allocation, &compressed) == 0);
+  CHECK(compressed == 8);
+  words[0] = 42;
+  CHECK(pinned_realloc(block * 20, &allocation) == 0);
+  words[word_count + 1] = 43;
+  CHECK(pinned_realloc(block * 3 + page, &allocation) == 0);
+  CHECK(words[0] == 42 && words[block / sizeof(uint64_t)] == block / page);
+  CHECK(pinned_cold_get_stats(&allocation, &stats) == 0);
+  CHECK(stats.managed_bytes == block * 3);
+
+  // The kernel can't read cold blocks until they're woken up
+  CHECK(pinned_cold_sweep(&allocation, NULL) == 0);
+  CHECK(pinned_cold_sweep(&allocation, NULL) == 0);
+  CHECK(pinned_cold_get_stats(&allocation, &stats) == 0);
+  CHECK(stats.cold_bytes == block * 3);
+  int fds[2];
+  CHECK(pipe(fds) == 0);
+  CHECK(write(fds[1], words, 8) < 0 && errno == EFAULT);
+  CHECK(pinned_cold_wake(0, 8, &allocation) == 0);
+  CHECK(pinned_cold_wake(block * 3, page + 1, &allocation) == EINVAL);
+  CHECK(write(fds[1], words, 8) == 8);
+  uint64_t first_word = 0;
+  CHECK(read(fds[0], &first_word, 8) == 8 && first_word == 42);
+  close(fds[0]);
+  close(fds[1]);
+
+  CHECK(pinned_discard(0, page, &allocation) == EBUSY);
+  CHECK(pinned_cold_disable(&allocation) == 0);
+  CHECK(!(allocation.flags & PINNED_FLAG_COLD));
+  CHECK(words[block * 2 / sizeof(uint64_t)] == block * 2 / page);
+  CHECK(pinned_discard(0, page, &allocation) == 0);
+
+  // Freeing with blocks still compressed
+  CHECK(pinned_cold_enable(0, &allocation) == 0);
+  CHECK(pinned_cold_sweep(&allocation, NULL) == 0);
+  CHECK(pinned_cold_sweep(&allocation, NULL) == 0);
+  pinned_free(&allocation);
+}
+
+typedef struct dirty_runs
+{
+  size_t offsets[8];
+  size_t lengths[8];
+  size_t count;
+} dirty_runs;
+
+static void collect_dirty(size_t offset, size_t length, void* user)
+{
+  dirty_runs* runs = (dirty_runs*)user;
+  CHECK(runs->count < 8);
+  runs->offsets[runs->count] = offset;
+  runs->lengths[runs->count] = length;
+  runs->count++;
+}
+
+void test_c_dirty()
+{
+  size_t page = pinned_page_size();
+  pinned_alloc_info allocation;
+  CHECK(pinned_alloc(page * 16, PINNED_MAXSIZE_NORMAL, &allocation) == 0);
+  memset(allocation.data, 1, allocation.size);
+
+  dirty_runs runs = { { 0 }, { 0 }, 0 };
+  CHECK(pinned_dirty_checkpoint(&allocation, collect_dirty, &runs) != 0);
+  CHECK(pinned_dirty_enable(&allocation) == 0);
+  CHECK(allocation.flags & PINNED_FLAG_DIRTY);
+
+  char* data = (char*)allocation.data;
+  data[page + 5] = 2;
+  data[page * 2] = 2;
+  data[page * 7 + page - 1] = 2;
+  CHECK(data[page * 3] == 1); // reading doesn't count
+
+  CHECK(pinned_dirty_checkpoint(&allocation, collect_dirty, &runs) == 0);
+  CHECK(runs.count == 2);
+  CHECK(runs.offsets[0] == page && runs.lengths[0] == page * 2);
+  CHECK(runs.offsets[1] == page * 7 && runs.lengths[1] == page);
+
+  // Nothing changed since
+  runs.count = 0;
+  CHECK(pinned_dirty_checkpoint(&allocation, collect_dirty, &runs) == 0);
+  CHECK(runs.count == 0);
+
+  // Pages added by growing count as dirty, and the ones shrunk away are forgotten
+  CHECK(pinned_realloc(page * 20, &allocation) == 0);
+  data[page * 3] = 3;
+  CHECK(pinned_dirty_checkpoint(&allocation, collect_dirty, &runs) == 0);
+  CHECK(runs.count == 2);
+  CHECK(runs.offsets[0] == page * 3 && runs.lengths[0] == page);
+  CHECK(runs.offsets[1] == page * 16 && runs.lengths[1] == page * 4);
+  data[page * 18] = 3;
+
+  runs.count = 0;
+  CHECK(pinned_realloc(page * 10, &allocation) == 0);
+  data[page * 9] = 4;
+  CHECK(pinned_dirty_checkpoint(&allocation, collect_dirty, &runs) == 0);
+  CHECK(runs.count == 1);
+  CHECK(runs.offsets[0] == page * 9 && runs.lengths[0] == page);
+
+  // The kernel can't write into protected pages until they're marked
+  int fds[2];
+  CHECK(pipe(fds) == 0);
+  CHECK(write(fds[1], "abcd", 4) == 4);
+  CHECK(read(fds[0], data + page * 5, 2) < 0 && errno == EFAULT);
+  CHECK(pinned_dirty_mark(page * 5, 2, &allocation) == 0);
+  CHECK(read(fds[0], data + page * 5, 4) == 4);
+  close(fds[0]);
+  close(fds[1]);
+  CHECK(memcmp(data + page * 5, "abcd", 4) == 0);
+
+  runs.count = 0;
+  CHECK(pinned_dirty_mark(page * 10, 1, &allocation) == EINVAL);
+  CHECK(pinned_dirty_checkpoint(&allocation, collect_dirty, &runs) == 0);
+  CHECK(runs.count == 1);
+  CHECK(runs.offsets[0] == page * 5 && runs.lengths[0] == page);
+
+  CHECK(pinned_discard(0, page, &allocation) == EBUSY);
+  CHECK(pinned_cold_enable(0, &allocation) == EBUSY);
+  CHECK(pinned_dirty_disable(&allocation) == 0);
+  CHECK(!(allocation.flags & PINNED_FLAG_DIRTY));
+  data[page * 4] = 5;
+  CHECK(data[page + 5] == 2 && data[page * 9] == 4 && data[page * 4] == 5);
+
+  CHECK(pinned_dirty_enable(&allocation) == 0);
+  data[0] = 6;
+  pinned_free(&allocation);
+}
+#endif
+
+void test_c_stats()
+{
+  pinned_stats before;
+  pinned_get_stats(&before);
+
+  pinned_alloc_info allocation;
+  CHECK(pinned_alloc(0, PINNED_MAXSIZE_NORMAL, &allocation) == 0);
+  CHECK(pinned_realloc(pinned_page_size() * 4, &allocation) == 0);
+  CHECK(pinned_realloc(pinned_page_size(), &allocation) == 0);
+  CHECK(pinned_realloc(pinned_page_size(), &allocation) == 0);
+
+  pinned_stats during;
+  pinned_get_stats(&during);
+  CHECK(during.live_allocations == before.live_allocations + 1);
+  CHECK(during.reserved_bytes == before.reserved_bytes + allocation.max_size);
+  CHECK(during.committed_bytes == before.committed_bytes + pinned_page_size());
+  CHECK(during.grow_count == before.grow_count + 1);
+  CHECK(during.shrink_count == before.shrink_count + 1);
+  CHECK(during.mmap_calls > before.mmap_calls);
+  CHECK(during.mprotect_calls >= before.mprotect_calls + 2);
+
+  unsigned long long timed_before = 0, timed_during = 0;
+  for (int i = 0; i < PINNED_STATS_LATENCY_BUCKETS; i++)
+  {
+    timed_before += before.realloc_latency[i];
+    timed_during += during.realloc_latency[i];
+  }
+  CHECK(timed_during == timed_before + 3);
+
   pinned_free(&allocation);
+
+  pinned_stats after;
+  pinned_get_stats(&after);
+  CHECK(after.live_allocations == before.live_allocations);
+  CHECK(after.reserved_bytes == before.reserved_bytes);
+  CHECK(after.committed_bytes == before.committed_bytes);
+  CHECK(after.munmap_calls > before.munmap_calls);
+
+  // Resetting zeroes the counts, but not the totals
+  pinned_reset_stats();
+  pinned_get_stats(&after);
+  CHECK(after.mmap_calls == 0);
+  CHECK(after.grow_count == 0);
+  CHECK(after.live_allocations == before.live_allocations);
+}
+
+typedef struct residency_search
+{
+  void* data;
+  int found;
+  pinned_residency residency;
+} residency_search;
+
+static void find_residency(void* data, size_t max_size, const pinned_residency* residency, void* user)
+{
+  (void)max_size;
+  residency_search* search = (residency_search*)user;
+  if (data == search->data)
+  {
+    search->found++;
+    search->residency = *residency;
+  }
+}
+
+void test_c_residency()
+{
+  size_t page = pinned_page_size();
+  pinned_alloc_info allocation;
+  CHECK(pinned_alloc(page * 16, PINNED_MAXSIZE_NORMAL, &allocation) == 0);
+
+  // Committed, but nothing touched yet
+  pinned_residency residency;
+  CHECK(pinned_get_residency(&allocation, 0, &residency) == 0);
+  CHECK(residency.committed_bytes == page * 16);
+  CHECK(residency.resident_bytes == 0);
+
+  for (size_t i = 0; i < page * 4; i++)
+    ((char*)allocation.data)[i] = 1;
+
+  CHECK(pinned_get_residency(&allocation, 0, &residency) == 0);
+  CHECK(residency.resident_bytes == page * 4);
+
+#ifndef _WIN32
+  // Pages that were just faulted in have been accessed. After clearing, it depends on whether the CPU sets the
+  // referenced bits again, which some VMs are lazy about, so all we can check is that it's in range.
+  CHECK(pinned_get_residency(&allocation, PINNED_RESIDENCY_ACCESSED, &residency) == 0);
+  CHECK(residency.accessed_bytes > 0 && residency.accessed_bytes <= residency.committed_bytes);
+  CHECK(residency.resident_bytes == page * 4);
+
+  if (pinned_clear_accessed() == 0)
+  {
+    CHECK(pinned_get_residency(&allocation, PINNED_RESIDENCY_ACCESSED, &residency) == 0);
+    CHECK(residency.accessed_bytes <= residency.committed_bytes);
+  }
+#endif
+
+  // The dump sees it, with its current size
+  CHECK(pinned_realloc(page * 8, &allocation) == 0);
+  residency_search search = { allocation.data, 0, { 0, 0, 0 } };
+  CHECK(pinned_dump_residency(0, find_residency, &search) == 0);
+#ifndef PINNED_NO_STATS
+  CHECK(search.found == 1);
+  CHECK(search.residency.committed_bytes == page * 8);
+  CHECK(search.residency.resident_bytes == page * 4);
+#endif
+
+  pinned_free(&allocation);
+
+  search.found = 0;
+  CHECK(pinned_dump_residency(0, find_residency, &search) == 0);
+  CHECK(search.found == 0);
 }
 
 void run_c_tests()
@@ -69,4 +729,20 @@ void run_c_tests()
   test_c_pinned_grow();
   test_c_grow_from_empty();
   test_c_shrink();
+  test_c_discard();
+  test_c_placement();
+  test_c_move_pages();
+  test_c_commit_range();
+  test_c_relocate();
+  test_c_stats();
+  test_c_residency();
+#ifndef _WIN32
+  test_c_file_backed();
+  test_c_shared();
+  test_c_snapshot();
+  test_c_snapshot_file();
+  test_c_map_file();
+  test_c_cold();
+  test_c_dirty();
+#endif
 }
\ No newline at end of file
@@ -1,5 +1,11 @@
 #include "test.h"
 #include "../pinned.h"
+#include <vector>
+#include <atomic>
+#include <thread>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 
 class test_content
 {
@@ -186,6 +192,18 @@ void test_vec_shrink_to_fit()
   CHECK(vec.capacity() == original_capacity);
 }
 
+void test_vec_residency()
+{
+  pinned_vec<char> vec;
+  vec.resize(pinned_page_size() * 8);
+  CHECK(vec.residency().committed_bytes == vec.capacity());
+  CHECK(vec.residency().resident_bytes <= vec.capacity());
+
+  for (size_t i = 0; i < vec.size(); i++)
+    vec[i] = 1;
+  CHECK(vec.residency().resident_bytes >= vec.size());
+}
+
 void test_vec_insert_begin()
 {
   {
@@ -370,6 +388,653 @@ void test_vec_erase_range_middle()
   CHECK(vec[6].val == 9);
 }
 
+void test_vec_trivial_insert_erase()
+{
+  // Compare against std::vector doing the same thing
+  pinned_vec<uint32_t> vec;
+  std::vector<uint32_t> expected;
+
+  uint32_t seed = 1;
+  auto random = [&]() { seed = seed * 1664525 + 1013904223; return seed >> 8; };
+
+  for (uint32_t i = 0; i < 2000; i++)
+  {
+    uint32_t values[3] = { random(), random(), random() };
+    size_t pos = expected.empty() ? 0 : random() % (expected.size() + 1);
+    size_t n = 1 + random() % 3;
+
+    auto it = vec.insert(vec.begin() + pos, values, values + n);
+    CHECK(*it == values[0]);
+    expected.insert(expected.begin() + pos, values, values + n);
+
+    if (i % 3 == 0)
+    {
+      size_t erase_pos = random() % expected.size();
+      size_t erase_n = std::min<size_t>(1 + random() % 4, expected.size() - erase_pos);
+      vec.erase(vec.begin() + erase_pos, vec.begin() + erase_pos + erase_n);
+      expected.erase(expected.begin() + erase_pos, expected.begin() + erase_pos + erase_n);
+    }
+  }
+
+  CHECK(vec.size() == expected.size());
+  for (size_t i = 0; i < expected.size(); i++)
+    CHECK(vec[i] == expected[i]);
+}
+
+void test_vec_insert_self()
+{
+  pinned_vec<uint32_t> vec;
+  for (uint32_t i = 0; i < 10; i++)
+    vec.push_back(i);
+
+  // Range that straddles the insert position, so half of it gets shifted before it is copied
+  vec.insert(vec.begin() + 5, vec.begin() + 3, vec.begin() + 7);
+
+  uint32_t expected[] = { 0, 1, 2, 3, 4, 3, 4, 5, 6, 5, 6, 7, 8, 9 };
+  CHECK(vec.size() == 14);
+  for (size_t i = 0; i < 14; i++)
+    CHECK(vec[i] == expected[i]);
+
+  vec.insert(vec.begin(), vec.back());
+  CHECK(vec[0] == 9);
+  CHECK(vec.size() == 15);
+}
+
+void test_vec_trivial_resize()
+{
+  pinned_vec<uint64_t> vec(1000);
+  for (size_t i = 0; i < vec.size(); i++)
+    CHECK(vec[i] == 0);
+
+  for (size_t i = 0; i < vec.size(); i++)
+    vec[i] = ~uint64_t(0);
+
+  // Growing back over memory we've already used has to clear it
+  vec.resize(10);
+  vec.resize(2000);
+  for (size_t i = 10; i < vec.size(); i++)
+    CHECK(vec[i] == 0);
+
+  vec.pop_back();
+  vec.erase(vec.begin(), vec.begin() + 10);
+  vec.back() = 1;
+  vec[0] = 1;
+  vec.resize(vec.capacity());
+  for (size_t i = 1; i < vec.size(); i++)
+    CHECK(vec[i] == (i == 1988 ? 1 : 0));
+
+  // And so does regrowing after the pages were decommitted
+  for (size_t i = 0; i < vec.size(); i++)
+    vec[i] = ~uint64_t(0);
+  vec.resize(0);
+  vec.shrink_to_fit();
+  vec.resize(5000);
+  for (size_t i = 0; i < vec.size(); i++)
+    CHECK(vec[i] == 0);
+}
+
+void test_vec_append()
+{
+  pinned_vec<uint32_t> vec;
+  std::vector<uint32_t> source(100000);
+  for (uint32_t i = 0; i < source.size(); i++)
+    source[i] = i;
+
+  vec.append(source.data(), source.data() + source.size());
+  vec.append(source.begin(), source.begin() + 10);
+  CHECK(vec.size() == 100010);
+  for (uint32_t i = 0; i < 100000; i++)
+    CHECK(vec[i] == i);
+  for (uint32_t i = 0; i < 10; i++)
+    CHECK(vec[100000 + i] == i);
+
+  {
+    pinned_vec<test_content> contents;
+    std::vector<test_content> content_source(10, test_content(3));
+    contents.append(content_source.begin(), content_source.end());
+    CHECK(contents.size() == 10);
+    CHECK(contents[9].val == 3);
+    CHECK(test_content::live_count == 20);
+  }
+  CHECK(test_content::live_count == 0);
+
+  size_t old_size = vec.size();
+  vec.resize_uninitialized(old_size + 4096);
+  CHECK(vec.size() == old_size + 4096);
+  CHECK(vec.capacity() >= vec.size());
+  vec.back() = 5;
+  vec.resize_uninitialized(10);
+  CHECK(vec.size() == 10);
+  CHECK(vec[9] == 9);
+}
+
+void test_vec_placement()
+{
+  {
+    pinned_vec<test_content> vec(pinned_placement{ PINNED_NUMA_INTERLEAVE, 0 });
+    CHECK(vec.placement().policy == PINNED_NUMA_INTERLEAVE);
+
+    for (int32_t i = 0; i < 10000; i++)
+      vec.emplace_back(i);
+    for (int32_t i = 0; i < 10000; i++)
+      CHECK(vec[i].val == i);
+  }
+
+  {
+    pinned_vec<test_content> vec(100, PINNED_MAXSIZE_NORMAL, pinned_placement{ PINNED_NUMA_LOCAL, 0 });
+    CHECK(vec.placement().policy == PINNED_NUMA_LOCAL);
+    CHECK(test_content::live_count == 100);
+  }
+
+  CHECK(test_content::live_count == 0);
+}
+
+#ifndef _WIN32
+void test_vec_file_backed()
+{
+  const char* path = "test_vec_file_backed.bin";
+  remove(path);
+
+  {
+    pinned_vec<uint64_t> vec(pinned_file, path);
+    CHECK(vec.empty());
+
+    for (uint64_t i = 0; i < 100000; i++)
+      vec.push_back(i * 3);
+  }
+
+  {
+    pinned_vec<uint64_t> vec(pinned_file, path);
+    CHECK(vec.size() == 100000);
+    for (uint64_t i = 0; i < 100000; i++)
+      CHECK(vec[i] == i * 3);
+
+    vec.resize(10);
+    vec.push_back(7);
+    vec.sync();
+  }
+
+  {
+    pinned_vec<uint64_t> vec(pinned_file, path);
+    CHECK(vec.size() == 11);
+    CHECK(vec[9] == 27);
+    CHECK(vec.back() == 7);
+  }
+
+  remove(path);
+
+  // Files are picked with a tag, so a literal 0 is still a count and not a null path
+  pinned_vec<int> zero(0);
+  CHECK(zero.empty());
+}
+
+void test_vec_shared()
+{
+  pinned_vec<uint64_t> vec(pinned_shared);
+  for (uint64_t i = 0; i < 1000; i++)
+    vec.push_back(i);
+
+  pinned_shared_view<uint64_t> view(dup(vec.allocation_info().fd));
+  CHECK(view.refresh() == 0);
+
+  vec.publish();
+  CHECK(view.refresh() == 1000);
+  for (uint64_t i = 0; i < 1000; i++)
+    CHECK(view[i] == i);
+
+  const uint64_t* first = &view[0];
+  for (uint64_t i = 1000; i < 100000; i++)
+    vec.push_back(i);
+  vec.publish();
+
+  CHECK(view.refresh() == 100000);
+  CHECK(&view[0] == first);
+  for (uint64_t i = 0; i < 100000; i++)
+    CHECK(view[i] == i);
+}
+#endif
+
+// Counts live instances from any thread, and throws from the constructor once throw_at instances have been made
+struct parallel_content
+{
+  static std::atomic<int64_t> live_count;
+  static std::atomic<int64_t> constructed;
+  static int64_t throw_at;
+
+  parallel_content()
+  {
+    if (constructed++ == throw_at)
+      throw std::runtime_error("parallel_content");
+    live_count++;
+  }
+  ~parallel_content() { live_count--; }
+
+  uint64_t val = 7;
+};
+
+std::atomic<int64_t> parallel_content::live_count{0};
+std::atomic<int64_t> parallel_content::constructed{0};
+int64_t parallel_content::throw_at = -1;
+
+void test_vec_parallel_resize()
+{
+  // Big enough that it really is split between threads
+  constexpr size_t elements = (64 * 1024 * 1024) / sizeof(uint32_t);
+  {
+    pinned_vec<uint32_t> vec;
+    vec.resize(elements, pinned_parallel, 4);
+    CHECK(vec.size() == elements);
+    CHECK(vec.residency().resident_bytes >= elements * sizeof(uint32_t));
+    for (size_t i = 0; i < elements; i += 997)
+      CHECK(vec[i] == 0);
+
+    // Growing again over memory we've used has to clear it
+    std::fill(vec.begin(), vec.end(), 1u);
+    vec.resize(10);
+    vec.resize(elements, pinned_parallel, 4);
+    for (size_t i = 10; i < elements; i += 997)
+      CHECK(vec[i] == 0);
+    CHECK(vec[elements - 1] == 0);
+  }
+  {
+    pinned_vec<parallel_content> vec(elements / 2, pinned_parallel, 3);
+    CHECK(vec.size() == elements / 2);
+    CHECK(parallel_content::live_count == int64_t(elements / 2));
+    CHECK(vec.back().val == 7);
+
+    // A throwing constructor leaves the vector as it was
+    parallel_content::constructed = 0;
+    parallel_content::throw_at = int64_t(elements / 3);
+    bool threw = false;
+    try
+    {
+      vec.resize(elements * 2, pinned_parallel, 4);
+    }
+    catch (const std::runtime_error&)
+    {
+      threw = true;
+    }
+    parallel_content::throw_at = -1;
+    CHECK(threw);
+    CHECK(vec.size() == elements / 2);
+    CHECK(parallel_content::live_count == int64_t(elements / 2));
+
+    // Small resizes just go through resize()
+    vec.resize(vec.size() + 5, pinned_parallel);
+    CHECK(vec.size() == elements / 2 + 5);
+  }
+  CHECK(parallel_content::live_count == 0);
+}
+
+void test_vec_snapshot()
+{
+  pinned_vec<uint64_t> vec(pinned_shared);
+  for (uint64_t i = 0; i < 100000; i++)
+    vec.push_back(i);
+
+  pinned_snapshot_view<uint64_t> snapshot = vec.snapshot();
+  CHECK(snapshot.size() == vec.size());
+
+  // Read the snapshot on another thread while we keep changing the vector
+  uint64_t sum = 0;
+  std::thread reader([&]()
+  {
+    for (uint64_t value : snapshot)
+      sum += value;
+  });
+  for (uint64_t i = 0; i < vec.size(); i++)
+    vec[i] = 0;
+  for (uint64_t i = 0; i < 1000; i++)
+    vec.push_back(i);
+  reader.join();
+
+  CHECK(sum == 99999ull * 100000 / 2);
+  CHECK(snapshot.size() == 100000);
+  CHECK(snapshot[500] == 500);
+  CHECK(vec[500] == 0);
+
+  bool threw = false;
+  try
+  {
+    pinned_snapshot_view<uint64_t> second = vec.snapshot();
+  }
+  catch (const std::system_error&)
+  {
+    threw = true;
+  }
+  CHECK(threw);
+
+  {
+    pinned_snapshot_view<uint64_t> moved = std::move(snapshot);
+  }
+  pinned_snapshot_view<uint64_t> second = vec.snapshot();
+  CHECK(second.size() == 101000);
+  CHECK(second[500] == 0);
+  CHECK(second[100500] == 500);
+}
+
+void test_vec_cold_pages()
+{
+  // A fill value per 4 KiB, so every block compresses
+  size_t elements = 1 << 20;
+  pinned_vec<uint64_t> vec;
+  for (uint64_t i = 0; i < elements; i++)
+    vec.push_back(i / 512);
+  vec.enable_cold_pages();
+
+  // Readers and writers keep going while blocks are being compressed and brought back under them
+  std::atomic<bool> done(false);
+  std::atomic<size_t> mismatches(0);
+  std::vector<std::thread> threads;
+  for (uint64_t t = 0; t < 3; t++)
+  {
+    threads.emplace_back([&, t]()
+    {
+      uint64_t seed = t + 1;
+      while (!done)
+      {
+        seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+        size_t i = size_t(seed >> 33) % elements;
+        if (t == 0 && i % 512 == 0)
+          vec[i] = i / 512; // same value, but a write
+        else if (vec[i] != i / 512)
+          mismatches++;
+      }
+    });
+  }
+
+  size_t compressed = 0;
+  for (int sweep = 0; sweep < 50; sweep++)
+    compressed += vec.sweep_cold_pages();
+  done = true;
+  for (std::thread& thread : threads)
+    thread.join();
+
+  CHECK(mismatches == 0);
+  CHECK(compressed > 0);
+
+  vec.sweep_cold_pages();
+  vec.sweep_cold_pages();
+  pinned_cold_stats stats = vec.cold_stats();
+  CHECK(stats.cold_bytes == stats.managed_bytes);
+  CHECK(stats.compressed_bytes < stats.cold_bytes / 100);
+
+  vec.push_back(5);
+  CHECK(vec[elements] == 5);
+  CHECK(vec[elements - 1] == (elements - 1) / 512);
+  vec.disable_cold_pages();
+  for (size_t i = 0; i < elements; i++)
+    CHECK(vec[i] == i / 512);
+}
+
+void test_vec_dirty_tracking()
+{
+  size_t elements = 1 << 20;
+  pinned_vec<uint64_t> vec(elements);
+  std::vector<uint64_t> replica(vec.begin(), vec.end());
+  vec.enable_dirty_tracking();
+
+  // Copying just the dirty pages over keeps the replica in step, with writers going the whole time
+  size_t replicated = 0;
+  auto replicate = [&](size_t offset, size_t length)
+  {
+    memcpy(reinterpret_cast<char*>(replica.data()) + offset, reinterpret_cast<const char*>(vec.data()) + offset, length);
+    replicated += length;
+  };
+
+  std::atomic<bool> done(false);
+  std::vector<std::thread> writers;
+  for (uint64_t t = 0; t < 2; t++)
+  {
+    writers.emplace_back([&, t]()
+    {
+      uint64_t seed = t + 1;
+      while (!done)
+      {
+        seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+        // Only the first 1/8th, so most pages stay clean
+        vec[size_t(seed >> 33) % (elements / 8)] = seed;
+      }
+    });
+  }
+
+  for (int checkpoint = 0; checkpoint < 20; checkpoint++)
+  {
+    vec.checkpoint_dirty(replicate);
+    std::this_thread::yield();
+  }
+  done = true;
+  for (std::thread& writer : writers)
+    writer.join();
+
+  vec.checkpoint_dirty(replicate);
+  CHECK(memcmp(replica.data(), vec.data(), elements * sizeof(uint64_t)) == 0);
+  CHECK(replicated > 0);
+
+  // Untouched pages never get sent
+  replicated = 0;
+  vec[elements - 1] = 7;
+  vec.checkpoint_dirty(replicate);
+  CHECK(replicated == pinned_page_size());
+  CHECK(replica[elements - 1] == 7);
+
+  // Marked by hand, for writes the fault handler doesn't see
+  replicated = 0;
+  vec.mark_dirty(0, 1);
+  vec.checkpoint_dirty(replicate);
+  CHECK(replicated == pinned_page_size());
+
+  vec.disable_dirty_tracking();
+  vec[0] = 1;
+}
+
+void test_vec_growth_policy()
+{
+  constexpr size_t mebibyte = 1024 * 1024;
+  CHECK(pinned_growth_doubling::next_size(mebibyte, mebibyte + 1) == 2 * mebibyte);
+  CHECK(pinned_growth_step<mebibyte>::next_size(mebibyte, mebibyte + 1) == 2 * mebibyte);
+  CHECK(pinned_growth_step<mebibyte>::next_size(0, 5 * mebibyte) == 5 * mebibyte);
+  CHECK((pinned_growth_chunked<25, mebibyte>::next_size(8 * mebibyte, 8 * mebibyte + 1) == 10 * mebibyte));
+  CHECK((pinned_growth_chunked<25, mebibyte>::next_size(mebibyte, mebibyte + 1) == 2 * mebibyte));
+  CHECK((pinned_growth_chunked<25, mebibyte>::next_size(0, 20 * mebibyte) == 20 * mebibyte));
+
+  {
+    pinned_vec<uint32_t, pinned_growth_step<mebibyte>> vec;
+    for (uint32_t i = 0; i <= (3 * mebibyte) / sizeof(uint32_t); i++)
+      vec.push_back(i);
+    CHECK(vec.capacity() * sizeof(uint32_t) == 4 * mebibyte);
+    CHECK(vec.back() == (3 * mebibyte) / sizeof(uint32_t));
+  }
+  {
+    pinned_vec<uint32_t, pinned_growth_doubling> vec;
+    for (uint32_t i = 0; i <= (3 * mebibyte) / sizeof(uint32_t); i++)
+      vec.push_back(i);
+    CHECK(vec.capacity() * sizeof(uint32_t) >= 4 * mebibyte);
+  }
+  {
+    // Growth stops at max_size rather than failing
+    pinned_vec<char> vec(pinned_placement(), 3 * mebibyte);
+    vec.resize(2 * mebibyte);
+    vec.resize(3 * mebibyte);
+    CHECK(vec.size() == 3 * mebibyte);
+    CHECK(vec.capacity() == 3 * mebibyte);
+  }
+}
+
+void test_vec_move()
+{
+  {
+    pinned_vec<test_content> vec;
+    for (int32_t i = 0; i < 100; i++)
+      vec.emplace_back(i);
+
+    test_content* old_data = vec.data();
+    pinned_vec<test_content> moved(std::move(vec));
+    CHECK(moved.data() == old_data);
+    CHECK(moved.size() == 100);
+    CHECK(vec.empty());
+    CHECK(test_content::live_count == 100);
+
+    // The moved from vector can still be used
+    vec.emplace_back(5);
+    CHECK(vec.size() == 1 && vec[0].val == 5);
+    CHECK(vec.data() != old_data);
+
+    pinned_vec<test_content> copy(moved);
+    CHECK(copy.size() == 100);
+    CHECK(copy[99].val == 99);
+    CHECK(test_content::live_count == 201);
+
+    vec = std::move(copy);
+    CHECK(vec.size() == 100);
+    CHECK(copy.empty());
+    CHECK(test_content::live_count == 200);
+
+    copy = moved;
+    CHECK(copy.size() == 100);
+    CHECK(copy[42].val == 42);
+
+    vec = std::move(vec);
+    CHECK(vec.size() == 100);
+  }
+  CHECK(test_content::live_count == 0);
+}
+
+void test_vec_splice()
+{
+  size_t per_page = pinned_page_size() / sizeof(uint32_t);
+  {
+    pinned_vec<uint32_t> a;
+    pinned_vec<uint32_t> b;
+    for (uint32_t i = 0; i < per_page * 3; i++)
+      a.push_back(i);
+    for (uint32_t i = 0; i < per_page * 2 + 10; i++)
+      b.push_back(1000000 + i);
+
+    // Page aligned on both sides, so the pages move
+    a.splice(b);
+    CHECK(a.size() == per_page * 5 + 10);
+    CHECK(b.empty());
+    for (uint32_t i = 0; i < a.size(); i++)
+      CHECK(a[i] == (i < per_page * 3 ? i : 1000000 + i - per_page * 3));
+
+    // Growing again has to clear what came along on the last page
+    a.resize(a.size() + per_page);
+    CHECK(a.back() == 0);
+    a.resize(per_page * 5 + 10);
+
+    // Splitting a vector, page aligned
+    b.splice(a, per_page * 4);
+    CHECK(a.size() == per_page * 4);
+    CHECK(b.size() == per_page + 10);
+    CHECK(b[0] == 1000000 + per_page);
+    CHECK(a.back() == 1000000 + per_page - 1);
+
+    // Not aligned, so copied
+    a.splice(b, 3);
+    CHECK(b.size() == 3);
+    CHECK(a.size() == per_page * 5 + 7);
+    CHECK(a[per_page * 4] == 1000000 + per_page + 3);
+    CHECK(a.back() == 1000000 + per_page * 2 + 9);
+
+    bool threw = false;
+    try
+    {
+      a.splice(b, 4);
+    }
+    catch (const std::out_of_range&)
+    {
+      threw = true;
+    }
+    CHECK(threw);
+  }
+  {
+    pinned_vec<test_content> a;
+    pinned_vec<test_content> b;
+    a.emplace_back(1);
+    for (int32_t i = 0; i < 10; i++)
+      b.emplace_back(i);
+
+    a.splice(b, 5);
+    CHECK(a.size() == 6);
+    CHECK(b.size() == 5);
+    CHECK(a[1].val == 5 && a[5].val == 9);
+    CHECK(test_content::live_count == 11);
+  }
+  CHECK(test_content::live_count == 0);
+}
+
+struct relocations
+{
+  uint32_t* old_data = nullptr;
+  uint32_t* new_data = nullptr;
+  int count = 0;
+};
+
+void test_vec_relocate()
+{
+  size_t page = pinned_page_size();
+  size_t per_page = page / sizeof(uint32_t);
+
+  pinned_vec<uint32_t> vec(pinned_placement(), page * 4);
+  relocations seen;
+  vec.on_relocate([](uint32_t* old_data, uint32_t* new_data, void* user)
+  {
+    relocations* r = static_cast<relocations*>(user);
+    r->old_data = old_data;
+    r->new_data = new_data;
+    r->count++;
+  }, &seen);
+
+  uint32_t* first = vec.data();
+  for (uint32_t i = 0; i < per_page * 4; i++)
+    vec.push_back(i);
+  CHECK(seen.count == 0);
+
+  // Growing past max_size moves the vector instead of throwing
+  vec.push_back(uint32_t(per_page * 4));
+  CHECK(seen.count == 1);
+  CHECK(seen.old_data == first && seen.new_data == vec.data());
+  CHECK(vec.max_size() == per_page * 8);
+  for (uint32_t i = 0; i <= per_page * 4; i++)
+    CHECK(vec[i] == i);
+
+  vec.reserve(per_page * 20);
+  CHECK(seen.count == 2);
+  CHECK(vec.max_size() == per_page * 32);
+  CHECK(vec.back() == per_page * 4);
+
+  // Without a callback, it's std::bad_alloc as before
+  vec.on_relocate(nullptr);
+  bool threw = false;
+  try
+  {
+    vec.reserve(per_page * 33);
+  }
+  catch (const std::bad_alloc&)
+  {
+    threw = true;
+  }
+  CHECK(threw);
+  CHECK(vec.size() == per_page * 4 + 1);
+
+  // Pushing one of our own elements while relocating reads it before the old reservation goes away
+  vec.on_relocate([](uint32_t*, uint32_t*, void* user) { static_cast<relocations*>(user)->count++; }, &seen);
+  vec.resize(vec.max_size());
+  vec[0] = 12345;
+  vec.push_back(vec[0]);
+  CHECK(seen.count == 3);
+  CHECK(vec.back() == 12345);
+
+  // Same for inserting a range of ourselves
+  vec.resize(vec.max_size());
+  vec[1] = 678;
+  vec.insert(vec.begin(), vec.begin(), vec.begin() + 2);
+  CHECK(seen.count == 4);
+  CHECK(vec.size() == vec.max_size() / 2 + 2);
+  CHECK(vec[0] == 12345 && vec[1] == 678 && vec[2] == 12345 && vec[3] == 678);
+}
+
 #undef vec_t
 
 extern "C" void run_c_tests();
@@ -384,6 +1049,8 @@ int main()
   test_vec_clear();
   test_vec_realloc();
   test_vec_shrink_to_fit();
+  test_vec_residency();
+  test_vec_parallel_resize();
   test_vec_insert_begin();
   test_vec_insert_middle();
   test_vec_move_insert_range();
@@ -391,6 +1058,22 @@ int main()
   test_vec_erase_range_begin();
   test_vec_erase_range_end();
   test_vec_erase_range_middle();
+  test_vec_trivial_insert_erase();
+  test_vec_insert_self();
+  test_vec_trivial_resize();
+  test_vec_append();
+  test_vec_placement();
+  test_vec_growth_policy();
+  test_vec_move();
+  test_vec_splice();
+  test_vec_relocate();
+#ifndef _WIN32
+  test_vec_file_backed();
+  test_vec_shared();
+  test_vec_snapshot();
+  test_vec_cold_pages();
+  test_vec_dirty_tracking();
+#endif
 
   fputs("All tests passed!\n", stderr);
   return 0;
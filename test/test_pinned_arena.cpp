@@ -0,0 +1,151 @@
+#include "test.h"
+#include "../pinned_arena.hpp"
+#include <vector>
+#include <string>
+#include <cstring>
+
+void test_arena_allocate()
+{
+  pinned_arena arena;
+  CHECK(arena.used() == 0);
+  CHECK(arena.committed() == 0);
+
+  char* a = (char*)arena.allocate(3, 1);
+  uint64_t* b = arena.allocate_array<uint64_t>(10);
+  CHECK((uintptr_t)b % alignof(uint64_t) == 0);
+  CHECK((char*)b >= a + 3);
+
+  void* page_aligned = arena.allocate(1, 4096);
+  CHECK((uintptr_t)page_aligned % 4096 == 0);
+
+  // Growing never moves anything
+  memset(a, 'a', 3);
+  for (int i = 0; i < 10; i++)
+    b[i] = i;
+  for (int i = 0; i < 1000; i++)
+    memset(arena.allocate(1000), 0xFF, 1000);
+  CHECK(a[0] == 'a' && a[2] == 'a');
+  for (int i = 0; i < 10; i++)
+    CHECK(b[i] == uint64_t(i));
+
+  struct point { int x, y; };
+  point* p = arena.create<point>(point{ 1, 2 });
+  CHECK(p->x == 1 && p->y == 2);
+
+  CHECK(arena.used() <= arena.committed());
+  CHECK(arena.peak() == arena.used());
+}
+
+void test_arena_rewind()
+{
+  pinned_arena arena;
+  arena.allocate(100);
+
+  pinned_arena::marker mark = arena.mark();
+  void* first = arena.allocate(1000);
+  arena.allocate(5000);
+  arena.rewind(mark);
+  CHECK(arena.used() == mark.offset);
+  CHECK(arena.allocate(1000) == first);
+
+  size_t before_scope = arena.used();
+  {
+    pinned_arena::scope scope(arena);
+    arena.allocate(1024 * 1024);
+    CHECK(arena.used() > 1024 * 1024);
+  }
+  CHECK(arena.used() == before_scope);
+  CHECK(arena.peak() > 1024 * 1024);
+
+  // Rewinding keeps the pages by default, trim() gives them back
+  size_t committed = arena.committed();
+  CHECK(committed > 1024 * 1024);
+  arena.reset();
+  CHECK(arena.used() == 0);
+  CHECK(arena.committed() == committed);
+  arena.trim();
+  CHECK(arena.committed() == 0);
+}
+
+void test_arena_retain_limit()
+{
+  const size_t retain = 256 * 1024;
+  pinned_arena arena(PINNED_MAXSIZE_NORMAL, retain);
+
+  arena.allocate(100 * 1024);
+  pinned_arena::marker mark = arena.mark();
+  arena.allocate(4 * 1024 * 1024);
+  CHECK(arena.committed() > 4 * 1024 * 1024);
+
+  arena.rewind(mark);
+  CHECK(arena.committed() == retain);
+
+  // Still usable, and small requests don't touch the OS at all after that
+  arena.allocate(50 * 1024);
+  CHECK(arena.committed() == retain);
+}
+
+void test_arena_max_size()
+{
+  pinned_arena arena(1024 * 1024);
+  arena.allocate(1000 * 1024);
+
+  bool threw = false;
+  try
+  {
+    arena.allocate(100 * 1024);
+  }
+  catch (std::bad_alloc&)
+  {
+    threw = true;
+  }
+  CHECK(threw);
+
+  threw = false;
+  try
+  {
+    arena.allocate(SIZE_MAX - 10);
+  }
+  catch (std::bad_alloc&)
+  {
+    threw = true;
+  }
+  CHECK(threw);
+  CHECK(arena.used() == 1000 * 1024);
+}
+
+void test_arena_pmr()
+{
+  pinned_arena arena;
+  pinned_arena_resource resource(arena);
+
+  {
+    std::pmr::vector<std::pmr::string> strings(&resource);
+    for (int i = 0; i < 1000; i++)
+      strings.emplace_back("a string long enough to not fit in the small string buffer " + std::to_string(i));
+
+    CHECK(strings[999] == "a string long enough to not fit in the small string buffer 999");
+    CHECK(strings.get_allocator().resource() == &resource);
+    CHECK(strings[0].get_allocator().resource() == &resource);
+    CHECK(arena.used() > 1000 * 60);
+  }
+
+  pinned_arena_resource other(arena);
+  pinned_arena other_arena;
+  pinned_arena_resource different(other_arena);
+  CHECK(resource.is_equal(other));
+  CHECK(!resource.is_equal(different));
+  CHECK(!resource.is_equal(*std::pmr::new_delete_resource()));
+}
+
+int main()
+{
+  test_arena_allocate();
+  test_arena_rewind();
+  test_arena_retain_limit();
+  test_arena_max_size();
+  test_arena_pmr();
+
+  fputs("All tests passed!\n", stderr);
+  return 0;
+}
@@ -0,0 +1,184 @@
+#include "test.h"
+#include "../pinned_hash_map.hpp"
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+void test_map_basic()
+{
+  pinned_hash_map<int, int> map;
+  CHECK(map.empty());
+  CHECK(map.find(1) == map.end());
+
+  CHECK(map.insert({ 1, 10 }).second);
+  CHECK(!map.insert({ 1, 20 }).second);
+  CHECK(map.at(1) == 10);
+  CHECK(map.size() == 1);
+
+  map[2] = 20;
+  CHECK(map[2] == 20);
+  CHECK(map.count(2) == 1);
+  CHECK(map.count(3) == 0);
+
+  map.insert_or_assign(1, 11);
+  CHECK(map.at(1) == 11);
+
+  bool threw = false;
+  try
+  {
+    map.at(3);
+  }
+  catch (std::out_of_range&)
+  {
+    threw = true;
+  }
+  CHECK(threw);
+
+  CHECK(map.erase(1) == 1);
+  CHECK(map.erase(1) == 0);
+  CHECK(!map.contains(1));
+  CHECK(map.size() == 1);
+
+  map.clear();
+  CHECK(map.empty());
+  CHECK(map.begin() == map.end());
+  map[5] = 6;
+  CHECK(map.at(5) == 6);
+}
+
+void test_map_stable_addresses()
+{
+  pinned_hash_map<uint64_t, uint64_t> map;
+
+  std::vector<uint64_t*> pointers;
+  bool saw_rehash = false;
+  for (uint64_t i = 0; i < 200000; i++)
+  {
+    pointers.push_back(&map[i]);
+    *pointers.back() = i * 3;
+    saw_rehash = saw_rehash || map.is_rehashing();
+
+    // Everything has to stay findable while the index is moving
+    if (i % 997 == 0)
+    {
+      for (uint64_t j = 0; j <= i; j += 101)
+        CHECK(map.find(j) != map.end() && &map.find(j)->second == pointers[j]);
+    }
+  }
+
+  CHECK(saw_rehash);
+  CHECK(map.size() == 200000);
+  for (uint64_t i = 0; i < 200000; i++)
+  {
+    CHECK(&map.at(i) == pointers[i]);
+    CHECK(*pointers[i] == i * 3);
+  }
+}
+
+void test_map_erase_reuse()
+{
+  pinned_hash_map<std::string, std::string> map;
+  for (int i = 0; i < 10000; i++)
+    map[std::to_string(i)] = "value " + std::to_string(i);
+
+  std::string* survivor = &map.at("9999");
+
+  for (int i = 0; i < 10000; i += 2)
+    CHECK(map.erase(std::to_string(i)) == 1);
+  CHECK(map.size() == 5000);
+
+  size_t iterated = 0;
+  for (auto& entry : map)
+  {
+    CHECK(std::stoi(entry.first) % 2 == 1);
+    CHECK(entry.second == "value " + entry.first);
+    iterated++;
+  }
+  CHECK(iterated == 5000);
+
+  // Erased entries get reused, and erasing never moves the rest
+  for (int i = 0; i < 10000; i += 2)
+    map[std::to_string(i)] = "again";
+  CHECK(map.size() == 10000);
+  CHECK(&map.at("9999") == survivor);
+  CHECK(*survivor == "value 9999");
+  CHECK(map.at("42") == "again");
+
+  // Erasing through iterators
+  for (auto it = map.begin(); it != map.end();)
+  {
+    if (it->second == "again")
+      it = map.erase(it);
+    else
+      ++it;
+  }
+  CHECK(map.size() == 5000);
+  CHECK(!map.contains("42"));
+  CHECK(map.contains("43"));
+}
+
+void test_map_churn()
+{
+  // Lots of inserts and erases, checked against std::unordered_map, so erased markers build up and force rehashes
+  // into a same-size index
+  pinned_hash_map<uint32_t, uint32_t> map;
+  std::unordered_map<uint32_t, uint32_t> expected;
+
+  uint32_t state = 12345;
+  for (int i = 0; i < 300000; i++)
+  {
+    state = state * 1664525 + 1013904223;
+    uint32_t key = (state >> 8) % 5000;
+    if (state & 1)
+    {
+      map[key] = uint32_t(i);
+      expected[key] = uint32_t(i);
+    }
+    else
+    {
+      CHECK(map.erase(key) == expected.erase(key));
+    }
+  }
+
+  CHECK(map.size() == expected.size());
+  for (auto& entry : expected)
+    CHECK(map.at(entry.first) == entry.second);
+}
+
+void test_map_reserve()
+{
+  pinned_hash_map<int, int> map;
+  map.reserve(100000);
+  size_t buckets = map.bucket_count();
+  CHECK(!map.is_rehashing());
+
+  for (int i = 0; i < 100000; i++)
+    map[i] = i;
+
+  CHECK(map.bucket_count() == buckets);
+  CHECK(!map.is_rehashing());
+
+  pinned_hash_map<int, int> small(1024 * 1024);
+  bool threw = false;
+  try
+  {
+    small.reserve(small.max_size() + 1);
+  }
+  catch (std::bad_alloc&)
+  {
+    threw = true;
+  }
+  CHECK(threw);
+}
+
+int main()
+{
+  test_map_basic();
+  test_map_stable_addresses();
+  test_map_erase_reuse();
+  test_map_churn();
+  test_map_reserve();
+
+  fputs("All tests passed!\n", stderr);
+  return 0;
+}
@@ -0,0 +1,155 @@
+#include "test.h"
+#include "../pinned_io_buffer.hpp"
+#include <cstdio>
+#include <string>
+
+#ifndef _WIN32
+static const char* write_test_file(size_t size)
+{
+  const char* path = "test_pinned_io_buffer.bin";
+  FILE* file = fopen(path, "wb");
+  CHECK(file);
+  for (size_t i = 0; i < size; i++)
+    fputc(int(i % 251), file);
+  fclose(file);
+  return path;
+}
+
+static bool matches_pattern(const char* data, size_t size)
+{
+  for (size_t i = 0; i < size; i++)
+  {
+    if ((unsigned char)data[i] != i % 251)
+      return false;
+  }
+  return true;
+}
+
+void test_io_buffer_read_all()
+{
+  const size_t file_size = 3 * 1024 * 1024 + 17;
+  const char* path = write_test_file(file_size);
+
+  pinned_io_buffer buffer;
+  int fd = open(path, O_RDONLY);
+  CHECK(fd >= 0);
+  CHECK(buffer.read_all(fd) == file_size);
+  CHECK(buffer.size() == file_size);
+  CHECK(matches_pattern(buffer.data(), buffer.size()));
+
+  // At the end of the file already
+  CHECK(buffer.read_from(fd) == 0);
+  close(fd);
+
+  // Reading more appends, without moving what's there
+  const char* first = buffer.data();
+  fd = open(path, O_RDONLY);
+  CHECK(buffer.read_from(fd, 1000) == 1000);
+  close(fd);
+  CHECK(buffer.data() == first);
+  CHECK(buffer.size() == file_size + 1000);
+  CHECK(matches_pattern(buffer.data() + file_size, 1000));
+
+  remove(path);
+}
+
+void test_io_buffer_pipe()
+{
+  int fds[2];
+  CHECK(pipe(fds) == 0);
+
+  std::string message = "hello, pinned world";
+  CHECK(write(fds[1], message.data(), message.size()) == ssize_t(message.size()));
+
+  pinned_io_buffer header;
+  pinned_io_buffer body;
+  CHECK(pinned_io_buffer::readv_from(fds[0], { { &header, 5 }, { &body, 100 } }) == ssize_t(message.size()));
+  CHECK(std::string(header.data(), header.size()) == "hello");
+  CHECK(std::string(body.data(), body.size()) == ", pinned world");
+
+  // Two targets in the same buffer would overlap
+  bool threw = false;
+  try
+  {
+    pinned_io_buffer::readv_from(fds[0], { { &header, 5 }, { &header, 5 } });
+  }
+  catch (const std::system_error& e)
+  {
+    threw = e.code().value() == EINVAL;
+  }
+  CHECK(threw);
+  CHECK(header.size() == 5);
+
+  // Nothing to read on a non-blocking pipe
+  fcntl(fds[0], F_SETFL, O_NONBLOCK);
+  CHECK(header.read_from(fds[0]) == -1);
+
+  close(fds[1]);
+  CHECK(header.read_from(fds[0]) == 0);
+  close(fds[0]);
+
+  // write_span() / commit_write() for anything else
+  pinned_io_buffer::span space = header.write_span(3);
+  CHECK(space.size >= 3);
+  memcpy(space.data, "!!!", 3);
+  header.commit_write(3);
+  CHECK(std::string(header.data(), header.size()) == "hello!!!");
+
+  header.clear();
+  CHECK(header.empty());
+}
+
+void test_io_buffer_map_file()
+{
+  const size_t file_size = pinned_page_size() * 10 + 123;
+  const char* path = write_test_file(file_size);
+
+  {
+    pinned_io_buffer buffer;
+    buffer.map_file(path);
+    CHECK(buffer.size() == file_size);
+    CHECK(matches_pattern(buffer.data(), buffer.size()));
+
+    // Appending carries on in place after the file
+    const char* first = buffer.data();
+    pinned_io_buffer::span space = buffer.write_span(pinned_page_size() * 4);
+    CHECK(space.data == first + file_size);
+    memset(space.data, 1, pinned_page_size() * 4);
+    buffer.commit_write(pinned_page_size() * 4);
+    CHECK(buffer.size() == file_size + pinned_page_size() * 4);
+    CHECK(matches_pattern(buffer.data(), file_size));
+
+    // Writes stay in the buffer
+    buffer.data()[0] = 'x';
+  }
+
+  FILE* file = fopen(path, "rb");
+  CHECK(fgetc(file) == 0);
+  fclose(file);
+  remove(path);
+
+  bool threw = false;
+  try
+  {
+    pinned_io_buffer buffer;
+    buffer.map_file("this file does not exist");
+  }
+  catch (const std::system_error&)
+  {
+    threw = true;
+  }
+  CHECK(threw);
+}
+#endif
+
+int main()
+{
+#ifndef _WIN32
+  test_io_buffer_read_all();
+  test_io_buffer_pipe();
+  test_io_buffer_map_file();
+#endif
+
+  fputs("All tests passed!\n", stderr);
+  return 0;
+}
@@ -0,0 +1,186 @@
+#include "test.h"
+#include "../pinned_log.hpp"
+#include <thread>
+#include <vector>
+
+struct record
+{
+  uint64_t index;
+  uint64_t check;
+};
+
+static uint64_t check_value(uint64_t index)
+{
+  return index * 0x9E3779B97F4A7C15ULL + 1;
+}
+
+void test_log_publish()
+{
+  pinned_log<record> log;
+  pinned_log<record>::reader reader(log);
+
+  CHECK(reader.take_snapshot().empty());
+
+  for (uint64_t i = 0; i < 100; i++)
+    log.append(record{ i, check_value(i) });
+
+  CHECK(log.written_size() == 100);
+  CHECK(reader.take_snapshot().empty());
+
+  log.publish();
+  pinned_log<record>::snapshot snapshot = reader.take_snapshot();
+  CHECK(snapshot.size() == 100);
+  CHECK(snapshot.first_index == 0);
+  for (uint64_t i = 0; i < 100; i++)
+    CHECK(snapshot[i].index == i);
+
+  // Appending more doesn't move anything
+  std::vector<record> batch;
+  for (uint64_t i = 100; i < 100000; i++)
+    batch.push_back(record{ i, check_value(i) });
+  log.append(batch.begin(), batch.end());
+  log.publish();
+
+  CHECK(snapshot.size() == 100);
+  CHECK(snapshot.first == reader.take_snapshot().first);
+  CHECK(reader.take_snapshot().size() == 100000);
+}
+
+void test_log_truncate()
+{
+  pinned_log<record> log;
+  for (uint64_t i = 0; i < 100000; i++)
+    log.append(record{ i, check_value(i) });
+  log.publish();
+
+  pinned_log<record>::reader reader(log);
+  pinned_log<record>::snapshot old_snapshot = reader.take_snapshot();
+
+  pinned_log<record>::reader other_reader(log);
+
+  log.truncate_front(50000);
+  CHECK(log.front() == 50000);
+
+  pinned_log<record>::snapshot snapshot = other_reader.take_snapshot();
+  CHECK(snapshot.first_index == 50000);
+  CHECK(snapshot.size() == 50000);
+  CHECK(snapshot[0].index == 50000);
+
+  // The first reader still has a snapshot from before, so nothing can be released yet
+  for (uint64_t i = 0; i < old_snapshot.size(); i++)
+    CHECK(old_snapshot[i].check == check_value(i));
+
+  // Once it's done with it, the truncated pages are given back, and read as zero
+  reader.release();
+  log.reclaim();
+  CHECK(log.data()[0].index == 0);
+  CHECK(log.data()[0].check == 0);
+  CHECK(log.data()[50000].check == check_value(50000));
+
+  // Truncating past the published end stops at it
+  log.truncate_front(1000000);
+  CHECK(log.front() == 100000);
+  CHECK(other_reader.take_snapshot().empty());
+}
+
+void test_log_reader_slots()
+{
+  pinned_log<record, 2> log;
+  {
+    pinned_log<record, 2>::reader a(log);
+    pinned_log<record, 2>::reader b(log);
+
+    bool threw = false;
+    try
+    {
+      pinned_log<record, 2>::reader c(log);
+    }
+    catch (const std::runtime_error&)
+    {
+      threw = true;
+    }
+    CHECK(threw);
+  }
+
+  pinned_log<record, 2>::reader a(log);
+  pinned_log<record, 2>::reader b(log);
+}
+
+void test_log_concurrent()
+{
+  constexpr uint64_t total = 2000000;
+  pinned_log<record> log;
+  std::atomic<bool> done{false};
+
+  std::vector<std::thread> readers;
+  for (int32_t r = 0; r < 4; r++)
+  {
+    readers.emplace_back([&]()
+    {
+      pinned_log<record>::reader reader(log);
+      while (!done.load())
+      {
+        pinned_log<record>::snapshot snapshot = reader.take_snapshot();
+        for (size_t i = 0; i < snapshot.size(); i += 97)
+        {
+          CHECK(snapshot[i].index == snapshot.first_index + i);
+          CHECK(snapshot[i].check == check_value(snapshot.first_index + i));
+        }
+      }
+    });
+  }
+
+  for (uint64_t i = 0; i < total; i++)
+  {
+    log.append(record{ i, check_value(i) });
+    if (i % 1000 == 999)
+      log.publish();
+    if (i % 100000 == 99999)
+      log.truncate_front(i - 50000);
+  }
+  log.publish();
+
+  done = true;
+  for (std::thread& reader : readers)
+    reader.join();
+
+  log.reclaim();
+  CHECK(log.published_size() == total);
+}
+
+void test_log_full()
+{
+  // Doubling stops at max_size, so a log can hold every record up to it
+  pinned_log<char> log(3 * 4096);
+  CHECK(log.max_size() == 3 * 4096);
+  for (size_t i = 0; i < 9000; i++)
+    log.append(char(i));
+
+  std::vector<char> rest(log.max_size() - 9000, 'x');
+  log.append(rest.begin(), rest.end());
+  CHECK(log.written_size() == log.max_size());
+
+  bool threw = false;
+  try
+  {
+    log.append('y');
+  }
+  catch (const std::bad_alloc&)
+  {
+    threw = true;
+  }
+  CHECK(threw);
+  CHECK(log.written_size() == log.max_size());
+}
+
+int main()
+{
+  test_log_publish();
+  test_log_truncate();
+  test_log_reader_slots();
+  test_log_concurrent();
+  test_log_full();
+
+  fputs("All tests passed!\n", stderr);
+  return 0;
+}
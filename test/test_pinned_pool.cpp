@@ -0,0 +1,194 @@
+#include "test.h"
+#include "../pinned_pool.hpp"
+#include <thread>
+#include <vector>
+#include <string>
+
+struct node
+{
+  node(uint64_t value) : value(value), check(~value) {}
+  uint64_t value;
+  uint64_t check;
+  node* next = nullptr;
+};
+
+void test_pool_basic()
+{
+  pinned_pool<node> pool;
+
+  node* a = pool.create(1);
+  node* b = pool.create(2);
+  CHECK(a != b);
+  CHECK(a->value == 1 && b->value == 2);
+
+  // Lots more allocations don't move the first ones
+  std::vector<node*> nodes;
+  for (uint64_t i = 0; i < 100000; i++)
+    nodes.push_back(pool.create(i));
+  CHECK(a->value == 1 && b->value == 2);
+  for (uint64_t i = 0; i < 100000; i++)
+    CHECK(nodes[i]->value == i && nodes[i]->check == ~i);
+
+  // Freed slots are reused
+  pool.destroy(b);
+  CHECK(pool.create(3) == b);
+
+  size_t touched = pool.slots_touched();
+  for (node* n : nodes)
+    pool.destroy(n);
+  for (uint64_t i = 0; i < 100000; i++)
+    pool.create(i);
+  CHECK(pool.slots_touched() == touched);
+}
+
+void test_pool_strings()
+{
+  // Non-trivial types work too
+  pinned_pool<std::string> pool;
+  std::string* s = pool.create("a long enough string to go on the heap, to check the destructor runs");
+  CHECK(s->size() > 20);
+  pool.destroy(s);
+}
+
+void test_pool_cache()
+{
+  pinned_pool<node> pool;
+  std::vector<node*> nodes;
+
+  {
+    pinned_pool<node>::cache cache(pool);
+    for (uint64_t i = 0; i < 1000; i++)
+      nodes.push_back(cache.create(i));
+
+    // Freeing more than a couple of batches sends some back to the pool
+    for (node* n : nodes)
+      cache.destroy(n);
+    nodes.clear();
+  }
+
+  // The cache gave everything back when it was destroyed, so these all reuse slots
+  size_t touched = pool.slots_touched();
+  for (uint64_t i = 0; i < 1000; i++)
+    nodes.push_back(pool.create(i));
+  CHECK(pool.slots_touched() == touched);
+
+  // Freed through the pool, allocated through a cache
+  for (node* n : nodes)
+    pool.destroy(n);
+  pinned_pool<node>::cache cache(pool);
+  for (uint64_t i = 0; i < 1000; i++)
+    cache.create(i);
+  CHECK(pool.slots_touched() == touched);
+}
+
+void test_pool_threads()
+{
+  pinned_pool<node> pool;
+  const int thread_count = 4;
+  bool ok[thread_count];
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < thread_count; t++)
+  {
+    threads.emplace_back([&pool, &ok, t]()
+    {
+      pinned_pool<node>::cache cache(pool);
+      std::vector<node*> mine;
+      bool good = true;
+      uint32_t seed = t + 1;
+
+      for (uint64_t i = 0; i < 200000; i++)
+      {
+        seed = seed * 1664525 + 1013904223;
+        if (mine.empty() || (seed >> 16) % 3 != 0)
+        {
+          mine.push_back(((seed >> 8) & 1) ? cache.create(i) : pool.create(i));
+        }
+        else
+        {
+          node* n = mine.back();
+          mine.pop_back();
+          good = good && n->check == ~n->value;
+          ((seed >> 9) & 1) ? cache.destroy(n) : pool.destroy(n);
+        }
+      }
+
+      for (node* n : mine)
+      {
+        good = good && n->check == ~n->value;
+        cache.destroy(n);
+      }
+      ok[t] = good;
+    });
+  }
+
+  for (std::thread& thread : threads)
+    thread.join();
+  for (int t = 0; t < thread_count; t++)
+    CHECK(ok[t]);
+}
+
+void test_pool_trim()
+{
+  pinned_pool<node> pool;
+
+  std::vector<node*> nodes;
+  for (uint64_t i = 0; i < 10000; i++)
+    nodes.push_back(pool.create(i));
+
+  CHECK(pool.trim() == 0);
+
+  // Free everything except the first and last few, so there's a free run in the middle
+  for (size_t i = 10; i < nodes.size() - 10; i++)
+    pool.destroy(nodes[i]);
+
+  size_t released = pool.trim();
+  CHECK(released > 0);
+  CHECK(released < nodes.size() * sizeof(node));
+  for (size_t i = 0; i < 10; i++)
+  {
+    CHECK(nodes[i]->value == i);
+    CHECK(nodes[nodes.size() - 1 - i]->value == nodes.size() - 1 - i);
+  }
+
+  // The trimmed slots are still usable
+  size_t touched = pool.slots_touched();
+  for (uint64_t i = 0; i < 9980; i++)
+  {
+    node* n = pool.create(i);
+    CHECK(n->value == i && n->check == ~i);
+  }
+  CHECK(pool.slots_touched() == touched);
+}
+
+void test_pool_max_size()
+{
+  pinned_pool<node> pool(64 * 1024);
+  size_t max_slots = pool.max_slots();
+  for (size_t i = 0; i < max_slots; i++)
+    pool.create(i);
+
+  bool threw = false;
+  try
+  {
+    pool.create(0);
+  }
+  catch (std::bad_alloc&)
+  {
+    threw = true;
+  }
+  CHECK(threw);
+}
+
+int main()
+{
+  test_pool_basic();
+  test_pool_strings();
+  test_pool_cache();
+  test_pool_threads();
+  test_pool_trim();
+  test_pool_max_size();
+
+  fputs("All tests passed!\n", stderr);
+  return 0;
+}
@@ -0,0 +1,153 @@
+#include "test.h"
+#include "../pinned_ring.hpp"
+#include <thread>
+#include <cstring>
+
+void test_ring_double_mapping()
+{
+  pinned_ring_info ring;
+  CHECK(pinned_ring_alloc(1, 1024 * 1024, &ring) == 0);
+  CHECK(ring.capacity == pinned_page_size());
+
+  char* data = (char*)ring.data;
+  data[0] = 'a';
+  CHECK(data[ring.capacity] == 'a');
+  data[ring.capacity * 2 - 1] = 'z';
+  CHECK(data[ring.capacity - 1] == 'z');
+
+  pinned_ring_free(&ring);
+}
+
+void test_ring_wraparound()
+{
+  pinned_ring ring(1);
+  size_t capacity = ring.capacity();
+
+  // Move the offsets near the end, so the next write wraps
+  ring.commit_write(capacity - 10);
+  ring.consume(capacity - 10);
+  CHECK(ring.empty());
+
+  pinned_ring::span space = ring.write_span();
+  CHECK(space.size == capacity);
+  for (size_t i = 0; i < 100; i++)
+    space.data[i] = char(i);
+  ring.commit_write(100);
+
+  pinned_ring::span input = ring.read_span();
+  CHECK(input.size == 100);
+  for (size_t i = 0; i < 100; i++)
+    CHECK(input.data[i] == char(i));
+
+  // The wrapped part really did land at the start of the ring
+  pinned_ring::span after = ring.write_span();
+  CHECK(after.size == capacity - 100);
+  CHECK(after.data == input.data + 100 - capacity);
+
+  ring.consume(100);
+  CHECK(ring.empty());
+  CHECK(ring.producer_offset() == capacity + 90);
+  CHECK(ring.consumer_offset() == capacity + 90);
+}
+
+void test_ring_resize()
+{
+  pinned_ring ring(1, 1024 * 1024);
+  size_t capacity = ring.capacity();
+
+  ring.commit_write(capacity - 100);
+  ring.consume(capacity - 100);
+
+  pinned_ring::span space = ring.write_span();
+  for (size_t i = 0; i < 300; i++)
+    space.data[i] = char(i * 7);
+  ring.commit_write(300);
+
+  ring.resize(capacity * 4);
+  CHECK(ring.capacity() == capacity * 4);
+  CHECK(ring.size() == 300);
+  CHECK(ring.producer_offset() == capacity + 200);
+
+  pinned_ring::span input = ring.read_span();
+  CHECK(input.size == 300);
+  for (size_t i = 0; i < 300; i++)
+    CHECK(input.data[i] == char(i * 7));
+
+  // Fill right up, which wraps in the bigger ring too
+  CHECK(ring.write_span().size == capacity * 4 - 300);
+  memset(ring.write_span().data, 'x', capacity * 4 - 300);
+  ring.commit_write(capacity * 4 - 300);
+  CHECK(ring.write_span().size == 0);
+  ring.consume(capacity * 4 - 10);
+
+  // Shrink back down with the remaining bytes straddling the new ring's end
+  ring.resize(capacity);
+  CHECK(ring.capacity() == capacity);
+  input = ring.read_span();
+  CHECK(input.size == 10);
+  for (size_t i = 0; i < 10; i++)
+    CHECK(input.data[i] == 'x');
+
+  CHECK(ring.write_span().size == capacity - 10);
+
+  bool threw = false;
+  try
+  {
+    ring.resize(1024 * 1024 * 2);
+  }
+  catch (std::bad_alloc&)
+  {
+    threw = true;
+  }
+  CHECK(threw);
+}
+
+void test_ring_spsc()
+{
+  pinned_ring ring(1);
+  const uint64_t total = 4 * 1024 * 1024;
+
+  std::thread producer([&]()
+  {
+    uint64_t next = 0;
+    while (next < total)
+    {
+      pinned_ring::span space = ring.write_span();
+      size_t n = size_t(std::min<uint64_t>(space.size, total - next));
+      for (size_t i = 0; i < n; i++)
+        space.data[i] = char((next + i) * 31);
+      ring.commit_write(n);
+      next += n;
+      if (n == 0)
+        std::this_thread::yield();
+    }
+  });
+
+  uint64_t next = 0;
+  bool ok = true;
+  while (next < total)
+  {
+    pinned_ring::span input = ring.read_span();
+    for (size_t i = 0; i < input.size; i++)
+      ok = ok && input.data[i] == char((next + i) * 31);
+    ring.consume(input.size);
+    next += input.size;
+    if (input.size == 0)
+      std::this_thread::yield();
+  }
+
+  producer.join();
+  CHECK(ok);
+  CHECK(ring.empty());
+}
+
+int main()
+{
+  test_ring_double_mapping();
+  test_ring_wraparound();
+  test_ring_resize();
+  test_ring_spsc();
+
+  fputs("All tests passed!\n", stderr);
+  return 0;
+}
@@ -0,0 +1,241 @@
+#include "test.h"
+#include "../pinned_small_vec.hpp"
+#include <cstdint>
+#include <vector>
+
+class counted
+{
+public:
+  static int32_t live_count;
+
+  counted() { live_count++; }
+  explicit counted(int32_t val) : counted() { this->val = val; }
+  counted(const counted& other) : counted() { this->val = other.val; }
+  counted(counted&& other) noexcept : counted() { this->val = other.val; other.val = 0; }
+  ~counted() { live_count--; }
+
+  counted& operator=(const counted& other) = default;
+
+  int32_t val = -1;
+};
+
+int32_t counted::live_count = 0;
+
+// Copies fail once copies_left runs out, and moving isn't noexcept
+class fragile
+{
+public:
+  static int32_t copies_left;
+
+  explicit fragile(int32_t val = 0) : val(val) {}
+  fragile(const fragile& other) : val(other.val)
+  {
+    if (copies_left-- == 0)
+      throw std::runtime_error("copy failed");
+  }
+  fragile(fragile&& other) : val(other.val) { other.val = 0; }
+
+  int32_t val;
+};
+
+int32_t fragile::copies_left = 0;
+
+void test_small_vec_inline()
+{
+  {
+    pinned_small_vec<counted, 8> vec;
+    CHECK(vec.empty());
+    CHECK(vec.capacity() == 8);
+    CHECK(!vec.is_pinned());
+
+    for (int32_t i = 0; i < 8; i++)
+      vec.emplace_back(i);
+
+    CHECK(!vec.is_pinned());
+    CHECK(vec.size() == 8);
+    CHECK(counted::live_count == 8);
+    CHECK((char*)vec.data() >= (char*)&vec && (char*)vec.data() < (char*)(&vec + 1));
+
+    for (int32_t i = 0; i < 8; i++)
+      CHECK(vec[i].val == i);
+
+    vec.pop_back();
+    CHECK(vec.back().val == 6);
+    CHECK(counted::live_count == 7);
+  }
+  CHECK(counted::live_count == 0);
+}
+
+void test_small_vec_spill()
+{
+  {
+    pinned_small_vec<counted, 4> vec;
+    for (int32_t i = 0; i < 4; i++)
+      vec.emplace_back(i);
+
+    // Pushing one of our own inline elements while spilling
+    vec.push_back(vec[1]);
+    CHECK(vec.is_pinned());
+    CHECK(vec.size() == 5);
+    CHECK(vec.capacity() >= 5);
+    CHECK(counted::live_count == 5);
+    CHECK(vec[4].val == 1);
+
+    counted* first = &vec[0];
+    for (int32_t i = 5; i < 10000; i++)
+      vec.emplace_back(i);
+    CHECK(first == &vec[0]);
+
+    for (int32_t i = 0; i < 4; i++)
+      CHECK(vec[i].val == i);
+    for (int32_t i = 5; i < 10000; i++)
+      CHECK(vec[i].val == i);
+
+    vec.resize(2);
+    CHECK(vec.is_pinned());
+    CHECK(counted::live_count == 2);
+  }
+  CHECK(counted::live_count == 0);
+}
+
+void test_small_vec_reserve()
+{
+  pinned_small_vec<uint32_t, 8> vec;
+  vec.reserve(4);
+  CHECK(!vec.is_pinned());
+
+  vec.reserve(9);
+  CHECK(vec.is_pinned());
+  CHECK(vec.capacity() >= 9);
+  CHECK(vec.empty());
+
+  vec.resize(100, 7);
+  for (size_t i = 0; i < vec.size(); i++)
+    CHECK(vec[i] == 7);
+
+  // A copy that throws halfway through moving out leaves the inline elements as they were
+  pinned_small_vec<fragile, 4> fragiles;
+  for (int32_t i = 0; i < 4; i++)
+    fragiles.emplace_back(i);
+
+  fragile::copies_left = 2;
+  bool threw = false;
+  try
+  {
+    fragiles.reserve(16);
+  }
+  catch (const std::runtime_error&)
+  {
+    threw = true;
+  }
+  CHECK(threw);
+  CHECK(!fragiles.is_pinned());
+  CHECK(fragiles.size() == 4);
+  for (int32_t i = 0; i < 4; i++)
+    CHECK(fragiles[size_t(i)].val == i);
+
+  fragile::copies_left = 4;
+  fragiles.reserve(16);
+  CHECK(fragiles.is_pinned());
+  CHECK(fragiles[3].val == 3);
+
+  // Doubling stops at max_size, so every element up to it can be used
+  pinned_small_vec<char, 8, 3 * 4096> full;
+  CHECK(full.max_size() == 3 * 4096);
+  for (size_t i = 0; i < full.max_size(); i++)
+    full.push_back(char(i));
+  CHECK(full.size() == 3 * 4096 && full.back() == char(3 * 4096 - 1));
+
+  threw = false;
+  try
+  {
+    full.push_back(0);
+  }
+  catch (const std::bad_alloc&)
+  {
+    threw = true;
+  }
+  CHECK(threw);
+}
+
+void test_small_vec_swap()
+{
+  {
+    pinned_small_vec<counted, 4> small;
+    small.emplace_back(1);
+    small.emplace_back(2);
+
+    pinned_small_vec<counted, 4> big;
+    for (int32_t i = 0; i < 100; i++)
+      big.emplace_back(i);
+    counted* big_data = big.data();
+
+    small.swap(big);
+    CHECK(small.size() == 100);
+    CHECK(small.is_pinned());
+    CHECK(small.data() == big_data);
+    CHECK(big.size() == 2);
+    CHECK(!big.is_pinned());
+    CHECK(big[0].val == 1);
+    CHECK(big[1].val == 2);
+    CHECK(counted::live_count == 102);
+
+    pinned_small_vec<counted, 4> other;
+    other.emplace_back(3);
+    other.swap(big);
+    CHECK(other.size() == 2);
+    CHECK(other[1].val == 2);
+    CHECK(big.size() == 1);
+    CHECK(big[0].val == 3);
+  }
+  CHECK(counted::live_count == 0);
+}
+
+void test_small_vec_move()
+{
+  {
+    // Lots of small vectors in a std::vector, which moves them around as it grows, some inline and some pinned
+    std::vector<pinned_small_vec<counted, 8>> all;
+    for (int32_t i = 0; i < 1000; i++)
+    {
+      all.emplace_back();
+      for (int32_t j = 0; j < i % 20; j++)
+        all.back().emplace_back(i * 100 + j);
+    }
+
+    for (int32_t i = 0; i < 1000; i++)
+    {
+      CHECK(all[size_t(i)].size() == size_t(i % 20));
+      CHECK(all[size_t(i)].is_pinned() == (i % 20 > 8));
+      for (int32_t j = 0; j < i % 20; j++)
+        CHECK(all[size_t(i)][size_t(j)].val == i * 100 + j);
+    }
+
+    // A pinned vector keeps its reservation, so pointers into it survive the move
+    counted* pinned_data = all[19].data();
+    pinned_small_vec<counted, 8> moved(std::move(all[19]));
+    CHECK(moved.data() == pinned_data);
+    CHECK(all[19].empty() && !all[19].is_pinned());
+
+    moved = std::move(all[5]);
+    CHECK(moved.size() == 5 && !moved.is_pinned());
+    CHECK(moved[4].val == 504);
+    CHECK(all[5].empty());
+
+    all[5] = std::move(all[18]);
+    CHECK(all[5].size() == 18 && all[5][17].val == 1817);
+  }
+  CHECK(counted::live_count == 0);
+}
+
+int main()
+{
+  test_small_vec_inline();
+  test_small_vec_spill();
+  test_small_vec_reserve();
+  test_small_vec_swap();
+  test_small_vec_move();
+
+  fputs("All tests passed!\n", stderr);
+  return 0;
+}
@@ -0,0 +1,172 @@
+#include "test.h"
+#include "../pinned_soa.hpp"
+#include <string>
+
+void test_soa_basic()
+{
+  pinned_soa<float, uint32_t, std::string> soa;
+  CHECK(soa.empty());
+
+  soa.push_back(1.0f, 10, "one");
+  soa.emplace_back(2.0f, 20u, "two");
+  CHECK(soa.size() == 2);
+
+  CHECK(soa.get<0>(0) == 1.0f);
+  CHECK(soa.get<1>(1) == 20);
+  CHECK(soa.get<2>(1) == "two");
+
+  auto [x, id, name] = soa[0];
+  CHECK(x == 1.0f && id == 10 && name == "one");
+  x = 5.0f;
+  name += "!";
+  CHECK(soa.get<0>(0) == 5.0f);
+  CHECK(std::get<2>(soa.back()) == "two");
+  CHECK(std::get<2>(soa.front()) == "one!");
+
+  const pinned_soa<float, uint32_t, std::string>& const_soa = soa;
+  CHECK(std::get<1>(const_soa[1]) == 20);
+  CHECK(const_soa.column<2>()[1] == "two");
+
+  bool threw = false;
+  try
+  {
+    soa.at(2);
+  }
+  catch (std::out_of_range&)
+  {
+    threw = true;
+  }
+  CHECK(threw);
+
+  soa.pop_back();
+  CHECK(soa.size() == 1);
+  soa.clear();
+  CHECK(soa.empty());
+}
+
+void test_soa_columns_stable()
+{
+  pinned_soa<double, uint8_t> soa;
+  soa.push_back(0.0, 0);
+
+  double* doubles = soa.column_data<0>();
+  uint8_t* bytes = soa.column_data<1>();
+
+  for (int i = 1; i < 100000; i++)
+    soa.push_back(double(i), uint8_t(i));
+
+  // Appending never moved the columns
+  CHECK(soa.column_data<0>() == doubles);
+  CHECK(soa.column_data<1>() == bytes);
+  CHECK(soa.capacity() >= soa.size());
+
+  double sum = 0;
+  for (double d : soa.column<0>())
+    sum += d;
+  CHECK(sum == 99999.0 * 100000.0 / 2.0);
+  CHECK(soa.column<1>().size() == 100000);
+  CHECK(bytes[1000] == uint8_t(1000));
+
+  size_t rows = 0;
+  for (auto [d, b] : soa)
+  {
+    CHECK(uint8_t(d) == b);
+    rows++;
+  }
+  CHECK(rows == soa.size());
+}
+
+void test_soa_resize()
+{
+  pinned_soa<int, std::string> soa;
+  soa.resize(10);
+  CHECK(soa.size() == 10);
+  CHECK(soa.get<0>(9) == 0);
+  CHECK(soa.get<1>(9).empty());
+
+  soa.get<1>(3) = "three";
+  soa.resize(4);
+  CHECK(soa.size() == 4);
+  CHECK(soa.get<1>(3) == "three");
+
+  soa.reserve(1000);
+  CHECK(soa.capacity() >= 1000);
+  CHECK(soa.size() == 4);
+}
+
+struct throws_on_copy
+{
+  throws_on_copy() = default;
+  throws_on_copy(const throws_on_copy&) { throw 1; }
+};
+
+static int live_strings = 0;
+struct counted
+{
+  counted() { live_strings++; }
+  counted(const counted&) { live_strings++; }
+  ~counted() { live_strings--; }
+};
+
+void test_soa_exceptions()
+{
+  {
+    pinned_soa<counted, throws_on_copy> soa;
+    counted c;
+    throws_on_copy t;
+    bool threw = false;
+    try
+    {
+      soa.push_back(c, t);
+    }
+    catch (int)
+    {
+      threw = true;
+    }
+    CHECK(threw);
+    CHECK(soa.size() == 0);
+    CHECK(live_strings == 1); // just c, the copy in the first column was destroyed
+  }
+  CHECK(live_strings == 0);
+
+  pinned_soa<int, int> small(64 * 1024);
+  bool threw = false;
+  try
+  {
+    small.reserve(small.max_size() + 1);
+  }
+  catch (std::bad_alloc&)
+  {
+    threw = true;
+  }
+  CHECK(threw);
+
+  // Doubling stops at max_size, so every row up to it can be used
+  pinned_soa<uint64_t> full(4096 * 3);
+  CHECK(full.max_size() == 1536);
+  for (uint64_t i = 0; i < 1536; i++)
+    full.push_back(i);
+  CHECK(full.size() == 1536 && full.get<0>(1535) == 1535);
+
+  threw = false;
+  try
+  {
+    full.push_back(0);
+  }
+  catch (std::bad_alloc&)
+  {
+    threw = true;
+  }
+  CHECK(threw);
+}
+
+int main()
+{
+  test_soa_basic();
+  test_soa_columns_stable();
+  test_soa_resize();
+  test_soa_exceptions();
+
+  fputs("All tests passed!\n", stderr);
+  return 0;
+}
@@ -0,0 +1,118 @@
+#include "test.h"
+#include "../pinned_sparse_array.hpp"
+#include <cstdint>
+#include <map>
+
+struct point
+{
+  int32_t x;
+  int32_t y;
+};
+
+void test_sparse_array_basic()
+{
+  // 40 bit keys, 8 TiB of address space
+  pinned_sparse_array<uint64_t> array(uint64_t(1) << 40);
+  CHECK(array.size() == uint64_t(1) << 40);
+  CHECK(array.committed_pages() == 0);
+
+  CHECK(array[12345] == 0);
+  CHECK(array[(uint64_t(1) << 40) - 1] == 0);
+  CHECK(!array.is_committed(12345));
+
+  array.set(12345, 7);
+  array.set((uint64_t(1) << 40) - 1, 8);
+  array.ref(uint64_t(1) << 35) = 9;
+  CHECK(array[12345] == 7);
+  CHECK(array[12346] == 0);
+  CHECK(array[(uint64_t(1) << 40) - 1] == 8);
+  CHECK(array[uint64_t(1) << 35] == 9);
+  CHECK(array.committed_pages() == 3);
+  CHECK(array.committed_bytes() == 3 * pinned_page_size());
+
+  // Setting 0 where nothing was ever set doesn't commit anything
+  array.set(uint64_t(1) << 30, 0);
+  CHECK(array.committed_pages() == 3);
+
+  // Putting a page back to all zeros gives it back
+  array.reset(12345);
+  CHECK(array.committed_pages() == 2);
+  CHECK(!array.is_committed(12345));
+  CHECK(array[12345] == 0);
+
+  // Writes through ref() wait for trim()
+  array.ref(uint64_t(1) << 35) = 0;
+  CHECK(array.committed_pages() == 2);
+  CHECK(array.trim() == 1);
+  CHECK(array.committed_pages() == 1);
+
+  array.clear();
+  CHECK(array.committed_pages() == 0);
+  CHECK(array[(uint64_t(1) << 40) - 1] == 0);
+
+  bool threw = false;
+  try
+  {
+    array.at(uint64_t(1) << 40);
+  }
+  catch (const std::out_of_range&)
+  {
+    threw = true;
+  }
+  CHECK(threw);
+}
+
+void test_sparse_array_iterate()
+{
+  pinned_sparse_array<point> array(uint64_t(1) << 32);
+  std::map<uint64_t, point> expected;
+
+  uint64_t seed = 1;
+  for (int i = 0; i < 1000; i++)
+  {
+    // Clustered keys, with some pages holding many
+    seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+    uint64_t key = (seed >> 33) % 4096 * 1000003 % (uint64_t(1) << 32);
+    point value = { int32_t(i + 1), int32_t(key % 1000) };
+    array.set(key, value);
+    expected[key] = value;
+  }
+
+  // A zero value in the middle of a committed page isn't visited
+  uint64_t erased = expected.begin()->first;
+  array.reset(erased);
+  expected.erase(erased);
+
+  size_t visited = 0;
+  uint64_t last_key = 0;
+  for (auto entry : array)
+  {
+    CHECK(visited == 0 || entry.key > last_key);
+    auto it = expected.find(entry.key);
+    CHECK(it != expected.end());
+    CHECK(entry.value.x == it->second.x && entry.value.y == it->second.y);
+    last_key = entry.key;
+    visited++;
+  }
+  CHECK(visited == expected.size());
+
+  const pinned_sparse_array<point>& const_array = array;
+  CHECK(const_array.begin() != const_array.end());
+  CHECK((*const_array.begin()).key == expected.begin()->first);
+
+  // Writing through an iterator
+  for (auto entry : array)
+    entry.value.x = 0, entry.value.y = 0;
+  CHECK(array.begin() == array.end());
+  array.trim();
+  CHECK(array.committed_pages() == 0);
+}
+
+int main()
+{
+  test_sparse_array_basic();
+  test_sparse_array_iterate();
+
+  fputs("All tests passed!\n", stderr);
+  return 0;
+}
@@ -0,0 +1,147 @@
+#include "test.h"
+#include "../pinned_static_vec.hpp"
+#include <cstdint>
+
+class counted
+{
+public:
+  static int32_t live_count;
+
+  counted() { live_count++; }
+  explicit counted(int32_t val) : counted() { this->val = val; }
+  counted(const counted& other) : counted() { this->val = other.val; }
+  counted(counted&& other) noexcept : counted() { this->val = other.val; other.val = 0; }
+  ~counted() { live_count--; }
+
+  int32_t val = -1;
+};
+
+int32_t counted::live_count = 0;
+
+constexpr size_t mebibyte = 1024 * 1024;
+
+void test_static_vec_basic()
+{
+  static_assert(sizeof(pinned_static_vec<uint32_t, mebibyte>) < sizeof(pinned_vec<uint32_t>), "should be smaller than a pinned_vec");
+  static_assert(pinned_static_vec<uint32_t, mebibyte>::max_size() == mebibyte / 4, "max_size is known at compile time");
+
+  {
+    pinned_static_vec<counted, mebibyte> vec;
+    CHECK(vec.empty());
+    CHECK(vec.capacity() == 0);
+    CHECK(vec.data() == nullptr);
+
+    vec.emplace_back(0);
+    counted* first = vec.data();
+    for (int32_t i = 1; i < 10000; i++)
+      vec.emplace_back(i);
+
+    CHECK(vec.data() == first);
+    CHECK(vec.size() == 10000);
+    CHECK(vec.capacity() >= 10000);
+    CHECK(counted::live_count == 10000);
+    for (int32_t i = 0; i < 10000; i++)
+      CHECK(vec[i].val == i);
+
+    pinned_alloc_info allocation = vec.allocation_info();
+    CHECK(allocation.data == vec.data());
+    CHECK(allocation.size >= vec.capacity() * sizeof(counted));
+    CHECK(allocation.size % pinned_page_size() == 0);
+
+    vec.pop_back();
+    CHECK(vec.back().val == 9998);
+    vec.resize(5);
+    CHECK(counted::live_count == 5);
+    vec.shrink_to_fit();
+    CHECK(vec.capacity() == 5);
+    CHECK(vec.data() == first);
+    CHECK(vec.at(4).val == 4);
+  }
+  CHECK(counted::live_count == 0);
+}
+
+void test_static_vec_limits()
+{
+  pinned_static_vec<uint64_t, mebibyte> vec;
+  vec.resize(vec.max_size());
+  CHECK(vec.size() == mebibyte / sizeof(uint64_t));
+  CHECK(vec.back() == 0);
+
+  bool threw = false;
+  try
+  {
+    vec.push_back(1);
+  }
+  catch (const std::bad_alloc&)
+  {
+    threw = true;
+  }
+  CHECK(threw);
+
+  threw = false;
+  try
+  {
+    vec.at(vec.size());
+  }
+  catch (const std::out_of_range&)
+  {
+    threw = true;
+  }
+  CHECK(threw);
+}
+
+void test_static_vec_move()
+{
+  {
+    pinned_static_vec<counted, mebibyte> a(100, counted(7));
+    pinned_static_vec<counted, mebibyte> b(std::move(a));
+    CHECK(a.empty() && a.data() == nullptr);
+    CHECK(b.size() == 100 && b[99].val == 7);
+
+    a.emplace_back(1);
+    b = std::move(a);
+    CHECK(b.size() == 1 && b[0].val == 1);
+    CHECK(counted::live_count == 1);
+
+    pinned_static_vec<counted, mebibyte> c;
+    c.swap(b);
+    CHECK(c.size() == 1 && b.empty());
+  }
+  CHECK(counted::live_count == 0);
+}
+
+void test_static_vec_stats()
+{
+  pinned_stats before;
+  pinned_get_stats(&before);
+  {
+    pinned_static_vec<uint32_t, mebibyte> vec;
+    for (uint32_t i = 0; i < 100000; i++)
+      vec.push_back(i);
+
+    pinned_stats during;
+    pinned_get_stats(&during);
+    CHECK(during.live_allocations == before.live_allocations + 1);
+    CHECK(during.committed_bytes == before.committed_bytes + vec.allocation_info().size);
+
+    pinned_alloc_info allocation = vec.allocation_info();
+    pinned_residency residency;
+    CHECK(pinned_get_residency(&allocation, 0, &residency) == 0);
+    CHECK(residency.committed_bytes == allocation.size);
+  }
+  pinned_stats after;
+  pinned_get_stats(&after);
+  CHECK(after.live_allocations == before.live_allocations);
+  CHECK(after.committed_bytes == before.committed_bytes);
+}
+
+int main()
+{
+  test_static_vec_basic();
+  test_static_vec_limits();
+  test_static_vec_move();
+  test_static_vec_stats();
+
+  fputs("All tests passed!\n", stderr);
+  return 0;
+}